@@ -23,6 +23,7 @@
 #include "spdlog/spdlog.h"
 
 #include "protocol/Client.h"
+#include "protocol/ConstantValues.h"
 #include "utils/TextUtilities.h"
 
 namespace {
@@ -33,6 +34,12 @@ inline Client *getContextClient(DOKAN_FILE_INFO *dokan_file_info)
     return reinterpret_cast<Client *>(context_value);
 }
 
+// File opened for the handle by CreateFile, or null if there is none
+inline OpenedFile *getContextFile(DOKAN_FILE_INFO *dokan_file_info)
+{
+    return reinterpret_cast<OpenedFile *>(dokan_file_info->Context);
+}
+
 NTSTATUS DOKAN_CALLBACK ninepfs_createfile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
                                            ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG ShareAccess,
                                            ULONG CreateDisposition, ULONG CreateOptions,
@@ -45,17 +52,124 @@ NTSTATUS DOKAN_CALLBACK ninepfs_createfile(LPCWSTR FileName, PDOKAN_IO_SECURITY_
         return STATUS_NO_SUCH_FILE;
     }
 
+    // The file is walked to and opened once here, and the other callbacks on the handle reuse it through the context
+    Client *ninep_client = getContextClient(DokanFileInfo);
+    std::string path = convertWstringToUtf8(filename_str);
+    OpenedFile *opened_file;
+    try {
+        opened_file = ninep_client->openFile(path);
+    }
+    catch (const RequestTimedOut &) {
+        return STATUS_IO_TIMEOUT;
+    }
+    catch (const ClientException &e) {
+        spdlog::debug("Could not open file: {}", e.what());
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    bool is_created = false;
+    if (!opened_file) {
+        bool may_create = CreateDisposition == FILE_CREATE || CreateDisposition == FILE_OPEN_IF ||
+                          CreateDisposition == FILE_OVERWRITE_IF || CreateDisposition == FILE_SUPERSEDE;
+        if (!may_create) {
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+
+        try {
+            opened_file = ninep_client->createFile(path, CreateOptions & FILE_DIRECTORY_FILE);
+        }
+        catch (const RequestTimedOut &) {
+            return STATUS_IO_TIMEOUT;
+        }
+        catch (const FileNotFound &) {
+            return STATUS_OBJECT_PATH_NOT_FOUND;
+        }
+        catch (const ClientException &e) {
+            spdlog::debug("Could not create file: {}", e.what());
+            return STATUS_ACCESS_DENIED;
+        }
+
+        is_created = true;
+    }
+
+    bool is_directory = ninep_client->isDirectory(opened_file);
+
+    NTSTATUS status = STATUS_SUCCESS;
+    if (!is_created && CreateDisposition == FILE_CREATE) {
+        status = STATUS_OBJECT_NAME_COLLISION;
+    } else if (is_directory && (CreateOptions & FILE_NON_DIRECTORY_FILE)) {
+        status = STATUS_FILE_IS_A_DIRECTORY;
+    } else if (!is_directory && (CreateOptions & FILE_DIRECTORY_FILE)) {
+        status = STATUS_NOT_A_DIRECTORY;
+    }
+
+    bool is_overwritten = CreateDisposition == FILE_OVERWRITE || CreateDisposition == FILE_OVERWRITE_IF ||
+                          CreateDisposition == FILE_SUPERSEDE;
+    bool is_written = DesiredAccess & (FILE_WRITE_DATA | FILE_APPEND_DATA | GENERIC_WRITE | GENERIC_ALL);
+    if (status == STATUS_SUCCESS && !is_directory && !is_created && (is_overwritten || is_written)) {
+        try {
+            if (!ninep_client->openFileForWriting(opened_file)) {
+                status = STATUS_ACCESS_DENIED;
+            } else if (is_overwritten) {
+                ninep_client->setFileSize(opened_file, 0);
+            }
+        }
+        catch (const RequestTimedOut &) {
+            status = STATUS_IO_TIMEOUT;
+        }
+        catch (const ClientException &e) {
+            spdlog::debug("Could not overwrite file: {}", e.what());
+            status = STATUS_ACCESS_DENIED;
+        }
+    }
+
+    if (status != STATUS_SUCCESS) {
+        ninep_client->closeFile(opened_file);
+        return status;
+    }
+
+    DokanFileInfo->IsDirectory = is_directory;
+    DokanFileInfo->Context = reinterpret_cast<ULONG64>(opened_file);
+
+    // Opening an existing file with a disposition that would have created it is reported as such, as Windows expects
+    bool may_have_created = CreateDisposition == FILE_OPEN_IF || CreateDisposition == FILE_OVERWRITE_IF ||
+                            CreateDisposition == FILE_SUPERSEDE;
+    if (!is_created && may_have_created) {
+        return STATUS_OBJECT_NAME_COLLISION;
+    }
+
     return STATUS_SUCCESS;
 }
 
+// The file is kept open until CloseFile, as paging I/O on it may still arrive after Cleanup
+// The data written through the handle is sent here at the latest, as the file is expected to be up to date on the
+// server once the last handle to it has been closed. Cleanup has no status to fail with, so a failure to send it is
+// only logged, whereas FlushFileBuffers reports it as a write error.
 void DOKAN_CALLBACK ninepfs_cleanup(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"Cleanup: {}", FileName);
+
+    OpenedFile *opened_file = getContextFile(DokanFileInfo);
+    if (opened_file) {
+        try {
+            getContextClient(DokanFileInfo)->flushFile(opened_file);
+        }
+        catch (const ClientException &e) {
+            spdlog::error(L"Could not send the data written to {}", FileName);
+            spdlog::debug("Error: {}", e.what());
+        }
+    }
 }
 
 void DOKAN_CALLBACK ninepfs_closeFile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"CloseFile: {}", FileName);
+
+    OpenedFile *opened_file = getContextFile(DokanFileInfo);
+    if (opened_file) {
+        getContextClient(DokanFileInfo)->closeFile(opened_file);
+        DokanFileInfo->Context = 0;
+    }
 }
 
 NTSTATUS DOKAN_CALLBACK ninepfs_readfile(LPCWSTR file_name, LPVOID buffer, DWORD buffer_length, LPDWORD read_length,
@@ -63,11 +177,24 @@ NTSTATUS DOKAN_CALLBACK ninepfs_readfile(LPCWSTR file_name, LPVOID buffer, DWORD
 {
     spdlog::info(L"ReadFile: {}, buffer_length: {}, read_length: {}, offset: {}", file_name, buffer_length, *read_length, offset);
     Client *ninep_client = getContextClient(dokan_file_info);
-    *read_length = ninep_client->readFile(file_name, offset, buffer, buffer_length);
+    OpenedFile *opened_file = getContextFile(dokan_file_info);
+    int64_t read_size;
+    try {
+        if (opened_file) {
+            read_size = ninep_client->readFile(opened_file, offset, buffer, buffer_length);
+        } else {
+            read_size = ninep_client->readFile(convertWstringToUtf8(file_name), offset, buffer, buffer_length);
+        }
+    }
+    catch (const RequestTimedOut &) {
+        return STATUS_IO_TIMEOUT;
+    }
 
-    if (*read_length > 0) {
+    if (read_size > 0) {
+        *read_length = static_cast<DWORD>(read_size);
         return STATUS_SUCCESS;
-    } else if (read_length == 0) {
+    } else if (read_size == 0) {
+        *read_length = 0;
         return STATUS_END_OF_FILE;
     } else {
         return STATUS_OBJECT_NAME_NOT_FOUND;
@@ -78,13 +205,65 @@ NTSTATUS DOKAN_CALLBACK ninepfs_writefile(LPCWSTR FileName, LPCVOID Buffer, DWOR
                                           LPDWORD NumberOfBytesWritten, LONGLONG Offset,
                                           PDOKAN_FILE_INFO DokanFileInfo)
 {
-    spdlog::info(L"WriteFile: {}", FileName);
+    spdlog::info(L"WriteFile: {}, length: {}, offset: {}", FileName, NumberOfBytesToWrite, Offset);
+    *NumberOfBytesWritten = 0;
+
+    Client *ninep_client = getContextClient(DokanFileInfo);
+    OpenedFile *opened_file = getContextFile(DokanFileInfo);
+    if (!opened_file || DokanFileInfo->IsDirectory) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    try {
+        uint64_t offset = Offset;
+        uint64_t length = NumberOfBytesToWrite;
+        if (DokanFileInfo->WriteToEndOfFile || DokanFileInfo->PagingIo) {
+            uint64_t file_size = ninep_client->getFileInformation(opened_file).length;
+
+            // Paging I/O must not extend the file, as it writes whole pages
+            if (DokanFileInfo->WriteToEndOfFile) {
+                offset = file_size;
+            } else if (offset >= file_size) {
+                return STATUS_SUCCESS;
+            } else {
+                length = (std::min)(length, file_size - offset);
+            }
+        }
+
+        ninep_client->writeFile(opened_file, offset, Buffer, length);
+        *NumberOfBytesWritten = static_cast<DWORD>(length);
+    }
+    catch (const RequestTimedOut &) {
+        return STATUS_IO_TIMEOUT;
+    }
+    catch (const ClientException &e) {
+        spdlog::debug("Could not write file: {}", e.what());
+        return STATUS_UNEXPECTED_IO_ERROR;
+    }
+
     return STATUS_SUCCESS;
 }
 
 NTSTATUS DOKAN_CALLBACK ninepfs_flushfilebuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"FlushFileBuffers: {}", FileName);
+
+    OpenedFile *opened_file = getContextFile(DokanFileInfo);
+    if (!opened_file) {
+        return STATUS_SUCCESS;
+    }
+
+    try {
+        getContextClient(DokanFileInfo)->flushFile(opened_file);
+    }
+    catch (const RequestTimedOut &) {
+        return STATUS_IO_TIMEOUT;
+    }
+    catch (const ClientException &e) {
+        spdlog::debug("Could not flush file: {}", e.what());
+        return STATUS_UNEXPECTED_IO_ERROR;
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -106,7 +285,7 @@ void storeTimestampIntoFiletime(uint64_t input, FILETIME *filetime)
 void fillByHandleFileInformation(const RStat &rstat, BY_HANDLE_FILE_INFORMATION *by_handle_file_information)
 {
     by_handle_file_information->dwFileAttributes =
-        (rstat.qid.type & 0x80) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+        (rstat.qid.type & constant::QTDIR) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
     storeTimestampIntoFiletime(rstat.mtime, &by_handle_file_information->ftCreationTime);
     storeTimestampIntoFiletime(rstat.mtime, &by_handle_file_information->ftLastWriteTime);
     storeTimestampIntoFiletime(rstat.atime, &by_handle_file_information->ftLastAccessTime);
@@ -124,7 +303,22 @@ NTSTATUS DOKAN_CALLBACK ninepfs_getfileInformation(LPCWSTR file_name, LPBY_HANDL
     spdlog::info(L"GetFileInformation: {}", file_name);
 
     Client *ninep_client = getContextClient(dokan_file_info);
-    std::optional<RStat> rstat = ninep_client->getFileInformation(file_name);
+    OpenedFile *opened_file = getContextFile(dokan_file_info);
+    std::optional<RStat> rstat;
+    try {
+        if (opened_file) {
+            rstat = ninep_client->getFileInformation(opened_file);
+        } else {
+            rstat = ninep_client->getFileInformation(convertWstringToUtf8(file_name));
+        }
+    }
+    catch (const RequestTimedOut &) {
+        return STATUS_IO_TIMEOUT;
+    }
+    catch (const ClientException &e) {
+        spdlog::debug("Could not get file information: {}", e.what());
+        return STATUS_FILE_NOT_AVAILABLE;
+    }
 
     if (rstat) {
         fillByHandleFileInformation(*rstat, buffer);
@@ -138,7 +332,7 @@ void fillFindDataWithRStat(const RStat &rstat, PFillFindData fill_find_data, PDO
 {
     WIN32_FIND_DATAW find_data;
 
-    find_data.dwFileAttributes = (rstat.qid.type & 0x80) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+    find_data.dwFileAttributes = (rstat.qid.type & constant::QTDIR) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
     copyUtf8StringToWcharArr(rstat.name, find_data.cFileName, MAX_PATH);
     storeTimestampIntoFiletime(rstat.mtime, &find_data.ftCreationTime);
     storeTimestampIntoFiletime(rstat.mtime, &find_data.ftLastWriteTime);
@@ -154,7 +348,18 @@ NTSTATUS DOKAN_CALLBACK ninepfs_findfiles(LPCWSTR FileName, PFillFindData FillFi
     spdlog::info(L"FindFiles: {}", FileName);
 
     Client *ninep_client = getContextClient(DokanFileInfo);
-    std::vector<RStat> rstats = ninep_client->getDirectoryContents(FileName);
+    OpenedFile *opened_file = getContextFile(DokanFileInfo);
+    std::vector<RStat> rstats;
+    try {
+        if (opened_file) {
+            rstats = ninep_client->getDirectoryContents(opened_file);
+        } else {
+            rstats = ninep_client->getDirectoryContents(convertWstringToUtf8(FileName));
+        }
+    }
+    catch (const RequestTimedOut &) {
+        return STATUS_IO_TIMEOUT;
+    }
     spdlog::debug(L"9P Client returned {} RStat entities as directory contents", rstats.size());
 
     for (const RStat &run_rstat : rstats) {
@@ -182,32 +387,64 @@ NTSTATUS DOKAN_CALLBACK ninepfs_setfiletime(LPCWSTR FileName, CONST FILETIME *Cr
 NTSTATUS DOKAN_CALLBACK ninepfs_deletefile(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"DeleteFile: {}", FileName);
-    return STATUS_SUCCESS;
+
+    // Removing files is not supported yet
+    return STATUS_ACCESS_DENIED;
 }
 
 NTSTATUS DOKAN_CALLBACK ninepfs_deletedirectory(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"DeleteDirectory: {}", FileName);
-    return STATUS_SUCCESS;
+
+    // Removing files is not supported yet
+    return STATUS_ACCESS_DENIED;
 }
 
 NTSTATUS DOKAN_CALLBACK ninepfs_movefile(LPCWSTR FileName, LPCWSTR NewFileName, BOOL ReplaceIfExisting,
                                          PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"MoveFile: {} to {}", FileName, NewFileName);
+
+    // Renaming files is not supported yet
+    return STATUS_ACCESS_DENIED;
+}
+
+NTSTATUS resizeFile(LPCWSTR FileName, LONGLONG size, bool only_shrink, PDOKAN_FILE_INFO DokanFileInfo)
+{
+    Client *ninep_client = getContextClient(DokanFileInfo);
+    OpenedFile *opened_file = getContextFile(DokanFileInfo);
+    if (!opened_file || DokanFileInfo->IsDirectory) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    try {
+        if (!only_shrink || static_cast<uint64_t>(size) < ninep_client->getFileInformation(opened_file).length) {
+            ninep_client->setFileSize(opened_file, size);
+        }
+    }
+    catch (const RequestTimedOut &) {
+        return STATUS_IO_TIMEOUT;
+    }
+    catch (const ClientException &e) {
+        spdlog::debug("Could not resize file: {}", e.what());
+        return STATUS_ACCESS_DENIED;
+    }
+
     return STATUS_SUCCESS;
 }
 
 NTSTATUS DOKAN_CALLBACK ninepfs_setendoffile(LPCWSTR FileName, LONGLONG ByteOffset, PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"SetEndOfFile: {} ByteOffset {}", FileName, ByteOffset);
-    return STATUS_SUCCESS;
+    return resizeFile(FileName, ByteOffset, false, DokanFileInfo);
 }
 
 NTSTATUS DOKAN_CALLBACK ninepfs_setallocationsize(LPCWSTR FileName, LONGLONG AllocSize, PDOKAN_FILE_INFO DokanFileInfo)
 {
     spdlog::info(L"SetAllocationSize: {} AllocSize {}", FileName, AllocSize);
-    return STATUS_SUCCESS;
+
+    // There is no allocation to grow on the server, so only a size smaller than that of the file has any effect
+    return resizeFile(FileName, AllocSize, true, DokanFileInfo);
 }
 
 NTSTATUS DOKAN_CALLBACK ninepfs_lockfile(LPCWSTR FileName, LONGLONG ByteOffset, LONGLONG Length,
@@ -45,14 +45,35 @@ const wchar_t *ALLOW_NETWORK_UNMOUNT_OPTION = L"/X";
 const wchar_t *MOUNT_POINT_OPTION = L"/MOUNT";
 const wchar_t *UNC_NAME_OPTION = L"/UNC";
 const wchar_t *SERVER_ADDR_OPTION = L"/S";
+const wchar_t *UNIX_SOCKET_ADDR_PREFIX = L"unix:";
+const wchar_t *SHARED_MEMORY_ADDR_PREFIX = L"shm:";
 const wchar_t *SERVER_PORT_OPTION = L"/P";
 const wchar_t *USER_NAME_OPTION = L"/U";
+const wchar_t *THREAD_COUNT_OPTION = L"/T";
+const wchar_t *SESSION_COUNT_OPTION = L"/POOL";
+const wchar_t *TX_FLUSH_DELAY_OPTION = L"/TXDELAY";
+const wchar_t *MSIZE_OPTION = L"/MSIZE";
+const wchar_t *REQUEST_TIMEOUT_OPTION = L"/RTIMEOUT";
+const wchar_t *ATTRIBUTE_CACHE_TTL_OPTION = L"/ATTRTTL";
+const wchar_t *MISSING_CACHE_TTL_OPTION = L"/NEGTTL";
+const wchar_t *FID_CACHE_TTL_OPTION = L"/FIDTTL";
+const wchar_t *BLOCK_CACHE_SIZE_OPTION = L"/BCACHE";
+const wchar_t *DISK_CACHE_PATH_OPTION = L"/DCACHE";
+const wchar_t *DISK_CACHE_SIZE_OPTION = L"/DCACHESIZE";
+const wchar_t *READ_AHEAD_OPTION = L"/RAHEAD";
+const wchar_t *WRITE_BACK_DELAY_OPTION = L"/WBDELAY";
+const wchar_t *WRITES_IN_FLIGHT_OPTION = L"/WINFLIGHT";
 
 bool doesOptionTakeArgument(const std::wstring &option_str)
 {
     return option_str == MOUNT_POINT_OPTION || option_str == UNC_NAME_OPTION || option_str == SERVER_ADDR_OPTION ||
-           option_str == SERVER_PORT_OPTION || option_str == USER_NAME_OPTION;
-    ;
+           option_str == SERVER_PORT_OPTION || option_str == USER_NAME_OPTION || option_str == THREAD_COUNT_OPTION ||
+           option_str == SESSION_COUNT_OPTION || option_str == TX_FLUSH_DELAY_OPTION || option_str == MSIZE_OPTION ||
+           option_str == REQUEST_TIMEOUT_OPTION || option_str == ATTRIBUTE_CACHE_TTL_OPTION ||
+           option_str == MISSING_CACHE_TTL_OPTION || option_str == FID_CACHE_TTL_OPTION ||
+           option_str == BLOCK_CACHE_SIZE_OPTION || option_str == DISK_CACHE_PATH_OPTION ||
+           option_str == DISK_CACHE_SIZE_OPTION || option_str == READ_AHEAD_OPTION ||
+           option_str == WRITE_BACK_DELAY_OPTION || option_str == WRITES_IN_FLIGHT_OPTION;
 }
 
 std::wstring buildSloganOptionNeedsArgument(const std::wstring &opt_str)
@@ -73,6 +94,49 @@ std::wstring buildSloganUnknownOption(const std::wstring &opt_str)
     return slogan;
 }
 
+std::wstring buildSloganInvalidNumericArgument(const std::wstring &opt_str, const std::wstring &arg_str)
+{
+    std::wstring slogan = L"Argument (";
+    slogan += arg_str;
+    slogan += L") of option (";
+    slogan += opt_str;
+    slogan += L") is not a valid number";
+
+    return slogan;
+}
+
+unsigned long parseNumericArgument(const std::wstring &opt_str, const std::wstring &arg_str, unsigned long min_value,
+                                   unsigned long max_value)
+{
+    wchar_t *end = nullptr;
+    unsigned long value = std::wcstoul(arg_str.c_str(), &end, 10);
+
+    if (arg_str.empty() || *end != L'\0' || value < min_value || value > max_value) {
+        std::wstring slogan = buildSloganInvalidNumericArgument(opt_str, arg_str);
+        throw CommandLineConfigException(slogan);
+    }
+
+    return value;
+}
+
+bool hasPrefix(const std::wstring &str, const std::wstring &prefix)
+{
+    return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+// The server address is either a host name / IP address, "unix:" followed by the path of a unix domain socket, or
+// "shm:" followed by the name of a shared mapping set up by a co-located server
+void evalServerAddress(const std::wstring &arg_str, Configuration *configuration)
+{
+    if (hasPrefix(arg_str, UNIX_SOCKET_ADDR_PREFIX)) {
+        configuration->server_unix_socket_path = arg_str.substr(wcslen(UNIX_SOCKET_ADDR_PREFIX));
+    } else if (hasPrefix(arg_str, SHARED_MEMORY_ADDR_PREFIX)) {
+        configuration->server_shared_memory_name = arg_str.substr(wcslen(SHARED_MEMORY_ADDR_PREFIX));
+    } else {
+        configuration->server_host = arg_str;
+    }
+}
+
 void evalCommandLineOption(unsigned long argc, wchar_t **argv, unsigned long *current_index,
                            Configuration *configuration)
 {
@@ -101,11 +165,39 @@ void evalCommandLineOption(unsigned long argc, wchar_t **argv, unsigned long *cu
         } else if (opt_str == UNC_NAME_OPTION) {
             configuration->unc_provider_name = arg_str;
         } else if (opt_str == SERVER_ADDR_OPTION) {
-            configuration->server_host = arg_str;
+            evalServerAddress(arg_str, configuration);
         } else if (opt_str == SERVER_PORT_OPTION) {
             configuration->server_port = arg_str;
         } else if (opt_str == USER_NAME_OPTION) {
             configuration->user_name = arg_str;
+        } else if (opt_str == THREAD_COUNT_OPTION) {
+            configuration->thread_count = static_cast<unsigned short>(parseNumericArgument(opt_str, arg_str, 1, 64));
+        } else if (opt_str == SESSION_COUNT_OPTION) {
+            configuration->session_count = parseNumericArgument(opt_str, arg_str, 1, 64);
+        } else if (opt_str == TX_FLUSH_DELAY_OPTION) {
+            configuration->tx_flush_delay_us = parseNumericArgument(opt_str, arg_str, 0, 100000);
+        } else if (opt_str == MSIZE_OPTION) {
+            configuration->msize = parseNumericArgument(opt_str, arg_str, 8 * 1024, 16 * 1024 * 1024);
+        } else if (opt_str == REQUEST_TIMEOUT_OPTION) {
+            configuration->request_timeout_ms = parseNumericArgument(opt_str, arg_str, 0, 600000);
+        } else if (opt_str == ATTRIBUTE_CACHE_TTL_OPTION) {
+            configuration->attribute_cache_ttl_ms = parseNumericArgument(opt_str, arg_str, 0, 3600000);
+        } else if (opt_str == MISSING_CACHE_TTL_OPTION) {
+            configuration->missing_cache_ttl_ms = parseNumericArgument(opt_str, arg_str, 0, 3600000);
+        } else if (opt_str == FID_CACHE_TTL_OPTION) {
+            configuration->fid_cache_ttl_ms = parseNumericArgument(opt_str, arg_str, 0, 3600000);
+        } else if (opt_str == BLOCK_CACHE_SIZE_OPTION) {
+            configuration->block_cache_size_mb = parseNumericArgument(opt_str, arg_str, 0, 65536);
+        } else if (opt_str == DISK_CACHE_PATH_OPTION) {
+            configuration->disk_cache_path = arg_str;
+        } else if (opt_str == DISK_CACHE_SIZE_OPTION) {
+            configuration->disk_cache_size_mb = parseNumericArgument(opt_str, arg_str, 1, 1024 * 1024);
+        } else if (opt_str == READ_AHEAD_OPTION) {
+            configuration->read_ahead_kb = parseNumericArgument(opt_str, arg_str, 0, 1024 * 1024);
+        } else if (opt_str == WRITE_BACK_DELAY_OPTION) {
+            configuration->write_back_delay_ms = parseNumericArgument(opt_str, arg_str, 0, 60000);
+        } else if (opt_str == WRITES_IN_FLIGHT_OPTION) {
+            configuration->writes_in_flight = parseNumericArgument(opt_str, arg_str, 1, 256);
         } else {
             assert(false);
         }
@@ -118,6 +210,18 @@ void evalCommandLineOption(unsigned long argc, wchar_t **argv, unsigned long *cu
 
 void validateConfiguration(const Configuration &configuration)
 {
+    if (!configuration.server_shared_memory_name.empty()) {
+        if (configuration.session_count > 1) {
+            throw CommandLineConfigException(L"Shared memory transport supports a single session only");
+        }
+
+        return;
+    }
+
+    if (!configuration.server_unix_socket_path.empty()) {
+        return;
+    }
+
     if (configuration.server_host.empty()) {
         throw CommandLineConfigException(L"Server host is mandatory.");
     }
@@ -142,7 +246,7 @@ wchar_t *dupWString(const std::wstring &str)
 
 unsigned long buildDokanOptionsFlags(const Configuration& configuration)
 {
-    unsigned long flags = DOKAN_OPTION_WRITE_PROTECT;
+    unsigned long flags = 0;
 
     if (configuration.debug) {
         flags |= DOKAN_OPTION_DEBUG | DOKAN_OPTION_STDERR;
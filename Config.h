@@ -33,12 +33,27 @@ struct Configuration
 
     std::wstring server_host;
     std::wstring server_port;
+    std::wstring server_unix_socket_path;
+    std::wstring server_shared_memory_name;
     std::wstring user_name;
+    std::wstring disk_cache_path;
 
     bool use_removable_drive = false;
     bool use_for_current_session = false;
     bool use_network_drive = false;
     unsigned short thread_count = 1;
+    unsigned int session_count = 1;
+    unsigned int tx_flush_delay_us = 0;
+    unsigned int msize = 512 * 1024;
+    unsigned int request_timeout_ms = 2000;
+    unsigned int attribute_cache_ttl_ms = 1000;
+    unsigned int missing_cache_ttl_ms = 500;
+    unsigned int fid_cache_ttl_ms = 10000;
+    unsigned int block_cache_size_mb = 64;
+    unsigned int disk_cache_size_mb = 4096;
+    unsigned int read_ahead_kb = 4096;
+    unsigned int write_back_delay_ms = 1000;
+    unsigned int writes_in_flight = 8;
     bool debug = false;
     int timeout_ms = 3000;
     bool allow_network_unmount = false;
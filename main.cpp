@@ -28,6 +28,7 @@
 #include "protocol/Client.h"
 #include "9pfs_operations.h"
 #include "Config.h"
+#include "utils/TextUtilities.h"
 
 int __cdecl wmain(unsigned long argc, wchar_t **argv)
 {
@@ -42,11 +43,41 @@ int __cdecl wmain(unsigned long argc, wchar_t **argv)
     assert(std::holds_alternative<Configuration>(scan_result));
 
     const Configuration configuration = std::get<Configuration>(scan_result);
-    ClientConfiguration client_configuration(configuration.server_host, configuration.server_port);
+    ClientConfiguration client_configuration(convertWstringToUtf8(configuration.server_host),
+                                             convertWstringToUtf8(configuration.server_port));
+    client_configuration.unix_socket_path = convertWstringToUtf8(configuration.server_unix_socket_path);
+    client_configuration.shared_memory_name = convertWstringToUtf8(configuration.server_shared_memory_name);
+    client_configuration.session_count = configuration.session_count;
+    client_configuration.tx_flush_delay_us = configuration.tx_flush_delay_us;
+    client_configuration.msize = configuration.msize;
+    client_configuration.request_timeout_ms = configuration.request_timeout_ms;
+    client_configuration.attribute_cache_ttl_ms = configuration.attribute_cache_ttl_ms;
+    client_configuration.missing_cache_ttl_ms = configuration.missing_cache_ttl_ms;
+    client_configuration.fid_cache_ttl_ms = configuration.fid_cache_ttl_ms;
+    client_configuration.block_cache_size = size_t(configuration.block_cache_size_mb) * 1024 * 1024;
+    client_configuration.disk_cache_path = convertWstringToUtf8(configuration.disk_cache_path);
+    client_configuration.disk_cache_size = uint64_t(configuration.disk_cache_size_mb) * 1024 * 1024;
+    client_configuration.read_ahead_max_size = uint64_t(configuration.read_ahead_kb) * 1024;
+    client_configuration.write_back_delay_ms = configuration.write_back_delay_ms;
+    client_configuration.max_writes_in_flight = configuration.writes_in_flight;
     std::unique_ptr<Client> client = std::make_unique<Client>(client_configuration);
     
     DokanOptionsUniquePtr dokan_options = buildDokanOptions(configuration);
     dokan_options->GlobalContext = reinterpret_cast<uint64_t>(client.get());
 
-     return DokanMain(dokan_options.get(), &ninepfs_operations);
+    int dokan_result = DokanMain(dokan_options.get(), &ninepfs_operations);
+
+    AttributeCacheStatistics attribute_cache_statistics = client->getAttributeCacheStatistics();
+    spdlog::info(L"Attribute cache: {} hits, {} misses; directory listings: {} hits, {} misses; {} missing path hits",
+                 attribute_cache_statistics.hits, attribute_cache_statistics.misses,
+                 attribute_cache_statistics.listing_hits, attribute_cache_statistics.listing_misses,
+                 attribute_cache_statistics.missing_hits);
+
+    BlockCacheStatistics block_cache_statistics = client->getBlockCacheStatistics();
+    spdlog::info(L"Block cache: {} hits, {} misses", block_cache_statistics.hits, block_cache_statistics.misses);
+
+    DiskCacheStatistics disk_cache_statistics = client->getDiskCacheStatistics();
+    spdlog::info(L"Disk cache: {} hits, {} misses", disk_cache_statistics.hits, disk_cache_statistics.misses);
+
+    return dokan_result;
 }
@@ -0,0 +1,307 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "AttributeCache.h"
+
+namespace {
+
+std::string makeChildPath(const std::string &path, const std::string &name)
+{
+    return path.empty() ? name : path + '/' + name;
+}
+
+std::string getParentPath(const std::string &path)
+{
+    size_t separator_pos = path.rfind('/');
+    return separator_pos == std::string::npos ? std::string() : path.substr(0, separator_pos);
+}
+
+} // namespace
+
+AttributeCache::AttributeCache(std::chrono::milliseconds time_to_live, size_t capacity, size_t listing_capacity,
+                               std::chrono::milliseconds missing_time_to_live, size_t missing_capacity)
+    : m_time_to_live(time_to_live), m_capacity(capacity), m_listing_capacity(listing_capacity),
+      m_missing_time_to_live(missing_time_to_live), m_missing_capacity(missing_capacity)
+{}
+
+std::optional<RStat> AttributeCache::find(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_attributes_by_path.find(path);
+    if (it == m_attributes_by_path.end()) {
+        m_misses++;
+        return std::nullopt;
+    }
+
+    if (Clock::now() >= it->second->expiry) {
+        erase(it->second);
+        m_misses++;
+        return std::nullopt;
+    }
+
+    m_attributes.splice(m_attributes.begin(), m_attributes, it->second);
+    m_hits++;
+    return it->second->rstat;
+}
+
+void AttributeCache::add(const std::string &path, const RStat &rstat)
+{
+    if (m_time_to_live.count() == 0) {
+        return;
+    }
+
+    Clock::time_point expiry = Clock::now() + m_time_to_live;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    addLocked(path, rstat, expiry);
+}
+
+std::optional<std::vector<RStat>> AttributeCache::findListing(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_listings_by_path.find(path);
+    if (it == m_listings_by_path.end()) {
+        m_listing_misses++;
+        return std::nullopt;
+    }
+
+    if (Clock::now() >= it->second->expiry) {
+        eraseListing(it->second);
+        m_listing_misses++;
+        return std::nullopt;
+    }
+
+    m_listings.splice(m_listings.begin(), m_listings, it->second);
+    m_listing_hits++;
+    return it->second->rstats;
+}
+
+void AttributeCache::addListing(const std::string &path, const Qid &qid, const std::vector<RStat> &rstats)
+{
+    if (m_time_to_live.count() == 0 || m_listing_capacity == 0) {
+        return;
+    }
+
+    Clock::time_point expiry = Clock::now() + m_time_to_live;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (const RStat &run_rstat : rstats) {
+        addLocked(makeChildPath(path, run_rstat.name), run_rstat, expiry);
+    }
+
+    auto [it, inserted] = m_listings_by_path.try_emplace(path);
+    if (!inserted) {
+        it->second->qid = qid;
+        it->second->rstats = rstats;
+        it->second->expiry = expiry;
+        m_listings.splice(m_listings.begin(), m_listings, it->second);
+        return;
+    }
+
+    m_listings.push_front(CachedListing{path, qid, rstats, expiry});
+    it->second = m_listings.begin();
+
+    if (m_listings.size() > m_listing_capacity) {
+        eraseListing(std::prev(m_listings.end()));
+    }
+}
+
+bool AttributeCache::isKnownMissing(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_missing_paths_by_path.find(path);
+    if (it == m_missing_paths_by_path.end()) {
+        return false;
+    }
+
+    if (Clock::now() >= it->second->expiry) {
+        eraseMissing(it->second);
+        return false;
+    }
+
+    m_missing_paths.splice(m_missing_paths.begin(), m_missing_paths, it->second);
+    m_missing_hits++;
+    return true;
+}
+
+void AttributeCache::addMissing(const std::string &path, std::optional<Qid> parent_qid)
+{
+    if (m_missing_time_to_live.count() == 0 || m_missing_capacity == 0) {
+        return;
+    }
+
+    Clock::time_point expiry = Clock::now() + m_missing_time_to_live;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // A file that is missing has no attributes either
+    auto attributes_it = m_attributes_by_path.find(path);
+    if (attributes_it != m_attributes_by_path.end()) {
+        erase(attributes_it->second);
+    }
+
+    auto it = m_missing_paths_by_path.find(path);
+    if (it != m_missing_paths_by_path.end()) {
+        eraseMissing(it->second);
+    }
+
+    std::string parent_path = getParentPath(path);
+    m_missing_paths.push_front(MissingPath{path, parent_path, parent_qid, expiry});
+    m_missing_paths_by_path.emplace(path, m_missing_paths.begin());
+    m_missing_paths_by_parent.emplace(std::move(parent_path), m_missing_paths.begin());
+
+    if (m_missing_paths.size() > m_missing_capacity) {
+        eraseMissing(std::prev(m_missing_paths.end()));
+    }
+}
+
+void AttributeCache::validate(const std::string &path, const Qid &qid)
+{
+    auto is_stale = [&qid](const Qid &cached_qid) {
+        return cached_qid.vers != qid.vers || cached_qid.path != qid.path;
+    };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_attributes_by_path.find(path);
+    if (it != m_attributes_by_path.end() && is_stale(it->second->rstat.qid)) {
+        erase(it->second);
+    }
+
+    auto listing_it = m_listings_by_path.find(path);
+    if (listing_it != m_listings_by_path.end() && is_stale(listing_it->second->qid)) {
+        eraseListing(listing_it->second);
+    }
+
+    eraseMissingIn(path, qid);
+}
+
+void AttributeCache::invalidate(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_attributes_by_path.find(path);
+    if (it != m_attributes_by_path.end()) {
+        erase(it->second);
+    }
+
+    auto missing_it = m_missing_paths_by_path.find(path);
+    if (missing_it != m_missing_paths_by_path.end()) {
+        eraseMissing(missing_it->second);
+    }
+
+    eraseListing(path);
+    eraseMissingIn(path, std::nullopt);
+    if (!path.empty()) {
+        std::string parent_path = getParentPath(path);
+        eraseListing(parent_path);
+        eraseMissingIn(parent_path, std::nullopt);
+    }
+}
+
+AttributeCacheStatistics AttributeCache::getStatistics() const
+{
+    return AttributeCacheStatistics{m_hits.load(), m_misses.load(), m_listing_hits.load(), m_listing_misses.load(),
+                                    m_missing_hits.load()};
+}
+
+void AttributeCache::addLocked(const std::string &path, const RStat &rstat, Clock::time_point expiry)
+{
+    // A file that has attributes is not missing any more
+    auto missing_it = m_missing_paths_by_path.find(path);
+    if (missing_it != m_missing_paths_by_path.end()) {
+        eraseMissing(missing_it->second);
+    }
+
+    if (m_capacity == 0) {
+        return;
+    }
+
+    auto [it, inserted] = m_attributes_by_path.try_emplace(path);
+    if (!inserted) {
+        it->second->rstat = rstat;
+        it->second->expiry = expiry;
+        m_attributes.splice(m_attributes.begin(), m_attributes, it->second);
+        return;
+    }
+
+    m_attributes.push_front(CachedAttributes{path, rstat, expiry});
+    it->second = m_attributes.begin();
+
+    if (m_attributes.size() > m_capacity) {
+        erase(std::prev(m_attributes.end()));
+    }
+}
+
+void AttributeCache::erase(AttributesList::iterator it)
+{
+    m_attributes_by_path.erase(it->path);
+    m_attributes.erase(it);
+}
+
+void AttributeCache::eraseListing(ListingList::iterator it)
+{
+    m_listings_by_path.erase(it->path);
+    m_listings.erase(it);
+}
+
+void AttributeCache::eraseListing(const std::string &path)
+{
+    auto it = m_listings_by_path.find(path);
+    if (it != m_listings_by_path.end()) {
+        eraseListing(it->second);
+    }
+}
+
+void AttributeCache::eraseMissing(MissingPathList::iterator it)
+{
+    auto [parent_begin, parent_end] = m_missing_paths_by_parent.equal_range(it->parent_path);
+    for (auto parent_it = parent_begin; parent_it != parent_end; ++parent_it) {
+        if (parent_it->second == it) {
+            m_missing_paths_by_parent.erase(parent_it);
+            break;
+        }
+    }
+
+    m_missing_paths_by_path.erase(it->path);
+    m_missing_paths.erase(it);
+}
+
+// Erases the missing paths in the directory, other than those found missing while it had the given qid
+void AttributeCache::eraseMissingIn(const std::string &parent_path, const std::optional<Qid> &parent_qid)
+{
+    std::vector<MissingPathList::iterator> stale_missing_paths;
+
+    auto [parent_begin, parent_end] = m_missing_paths_by_parent.equal_range(parent_path);
+    for (auto parent_it = parent_begin; parent_it != parent_end; ++parent_it) {
+        const std::optional<Qid> &missing_parent_qid = parent_it->second->parent_qid;
+        bool is_current = parent_qid && missing_parent_qid && missing_parent_qid->vers == parent_qid->vers &&
+                          missing_parent_qid->path == parent_qid->path;
+        if (!is_current) {
+            stale_missing_paths.push_back(parent_it->second);
+        }
+    }
+
+    for (MissingPathList::iterator run_it : stale_missing_paths) {
+        eraseMissing(run_it);
+    }
+}
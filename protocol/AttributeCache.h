@@ -0,0 +1,145 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DataTypes.h"
+
+struct AttributeCacheStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t listing_hits;
+    uint64_t listing_misses;
+    uint64_t missing_hits;
+};
+
+// Bounded cache of the attributes of files by path (keyed as in FidTracker), for answering repeated queries for them
+// without a round trip to the server. Cached attributes expire after the configured time to live, and are dropped as
+// soon as a response from the server shows the file to have changed (i.e. its qid to have a different version or path)
+// or the file is changed locally. A time to live of zero disables the cache.
+//
+// The contents of directories are cached too, under the same rules, with the qid of the directory as of when it was
+// read standing for the version of the listing. Caching a listing also caches the attributes of every file in it, as
+// the attributes of the files of a directory are usually queried right after listing it.
+//
+// Paths found not to exist are remembered as well, for a (usually shorter) time to live of their own, as Windows keeps
+// probing for files that are not there. They are forgotten as soon as their parent directory is seen to have changed,
+// or a file is created locally at or below the parent directory.
+class AttributeCache
+{
+public:
+    AttributeCache(std::chrono::milliseconds time_to_live, size_t capacity, size_t listing_capacity,
+                   std::chrono::milliseconds missing_time_to_live, size_t missing_capacity);
+
+    AttributeCache(const AttributeCache &) = delete;
+    AttributeCache &operator=(const AttributeCache &) = delete;
+
+    std::optional<RStat> find(const std::string &path);
+    void add(const std::string &path, const RStat &rstat);
+
+    std::optional<std::vector<RStat>> findListing(const std::string &path);
+    void addListing(const std::string &path, const Qid &qid, const std::vector<RStat> &rstats);
+
+    // The qid of the parent directory as of when the path was found missing may be unknown, in which case the path is
+    // forgotten the next time that any qid of the parent directory is seen
+    bool isKnownMissing(const std::string &path);
+    void addMissing(const std::string &path, std::optional<Qid> parent_qid);
+
+    // Drops the attributes and the listing cached for the path if they are not of the file with the given qid, along
+    // with the missing paths in it if it is a directory that has changed since they were found missing
+    void validate(const std::string &path, const Qid &qid);
+
+    // Drops everything cached for the path, along with the listing of its parent directory and the missing paths in
+    // either of them
+    void invalidate(const std::string &path);
+
+    AttributeCacheStatistics getStatistics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct CachedAttributes
+    {
+        std::string path;
+        RStat rstat;
+        Clock::time_point expiry;
+    };
+
+    struct CachedListing
+    {
+        std::string path;
+        Qid qid;
+        std::vector<RStat> rstats;
+        Clock::time_point expiry;
+    };
+
+    struct MissingPath
+    {
+        std::string path;
+        std::string parent_path;
+        std::optional<Qid> parent_qid;
+        Clock::time_point expiry;
+    };
+
+    using AttributesList = std::list<CachedAttributes>;
+    using ListingList = std::list<CachedListing>;
+    using MissingPathList = std::list<MissingPath>;
+
+    void addLocked(const std::string &path, const RStat &rstat, Clock::time_point expiry);
+    void erase(AttributesList::iterator it);
+    void eraseListing(ListingList::iterator it);
+    void eraseListing(const std::string &path);
+    void eraseMissing(MissingPathList::iterator it);
+    void eraseMissingIn(const std::string &parent_path, const std::optional<Qid> &parent_qid);
+
+    std::chrono::milliseconds m_time_to_live;
+    size_t m_capacity;
+    size_t m_listing_capacity;
+    std::chrono::milliseconds m_missing_time_to_live;
+    size_t m_missing_capacity;
+
+    std::mutex m_mutex;
+
+    // Most recently used first
+    AttributesList m_attributes;
+    std::unordered_map<std::string, AttributesList::iterator> m_attributes_by_path;
+    ListingList m_listings;
+    std::unordered_map<std::string, ListingList::iterator> m_listings_by_path;
+    MissingPathList m_missing_paths;
+    std::unordered_map<std::string, MissingPathList::iterator> m_missing_paths_by_path;
+    std::unordered_multimap<std::string, MissingPathList::iterator> m_missing_paths_by_parent;
+
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+    std::atomic<uint64_t> m_listing_hits = 0;
+    std::atomic<uint64_t> m_listing_misses = 0;
+    std::atomic<uint64_t> m_missing_hits = 0;
+};
@@ -0,0 +1,248 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "BlockCache.h"
+
+#include <algorithm>
+#include <cassert>
+
+size_t BlockCache::BlockKeyHash::operator()(const BlockKey &key) const
+{
+    return std::hash<uint64_t>()(key.qid_path) ^ (std::hash<uint64_t>()(key.block_index) * 0x9e3779b97f4a7c15ULL);
+}
+
+BlockCache::BlockCache(size_t block_size, size_t memory_budget)
+    : m_block_size(block_size), m_capacity(block_size ? memory_budget / block_size : 0)
+{}
+
+bool BlockCache::isEnabled() const
+{
+    return m_capacity > 0;
+}
+
+size_t BlockCache::getBlockSize() const
+{
+    return m_block_size;
+}
+
+BlockPtr BlockCache::find(uint64_t qid_path, uint64_t block_index, FileVersion version, uint64_t stream_id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_blocks.find(BlockKey{qid_path, block_index});
+    if (it == m_blocks.end() || !it->second.block) {
+        m_misses++;
+        return nullptr;
+    }
+
+    if (it->second.version != version) {
+        erase(it);
+        m_misses++;
+        return nullptr;
+    }
+
+    // A block read more than once moves to (or to the front of) the frequent list. The first read of a prefetched
+    // block is its first use, and further reads by the stream that used it last are part of the same use, so such
+    // blocks stay in the list they are in.
+    bool is_same_use = stream_id != 0 && it->second.last_stream_id == stream_id;
+    it->second.last_stream_id = stream_id;
+    if (it->second.referenced && !is_same_use) {
+        moveToList(it, ListId::Frequent);
+    } else {
+        it->second.referenced = true;
+        moveToList(it, it->second.list_id);
+    }
+
+    m_hits++;
+    return it->second.block;
+}
+
+bool BlockCache::contains(uint64_t qid_path, uint64_t block_index, FileVersion version)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_blocks.find(BlockKey{qid_path, block_index});
+    return it != m_blocks.end() && it->second.block && it->second.version == version;
+}
+
+void BlockCache::add(uint64_t qid_path, uint64_t block_index, FileVersion version, BlockPtr block, bool prefetched,
+                     uint64_t stream_id)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    BlockKey key{qid_path, block_index};
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_blocks.find(key);
+    if (it != m_blocks.end() && it->second.block) {
+        // Read concurrently by another reader, or read anew for a different version
+        it->second.version = version;
+        if (!prefetched) {
+            it->second.referenced = true;
+            it->second.last_stream_id = stream_id;
+        }
+
+        it->second.block = std::move(block);
+        return;
+    }
+
+    // Reading a block ahead is no sign that it is wanted again, so its ghost is dropped and it is added anew
+    if (it != m_blocks.end() && prefetched) {
+        erase(it);
+        it = m_blocks.end();
+    }
+
+    if (it != m_blocks.end()) {
+        // A ghost hit shows that the list the block was evicted from deserves a larger share of the cache
+        if (it->second.list_id == ListId::RecentGhost) {
+            size_t delta = (std::max<size_t>)(m_frequent_ghosts.size() / m_recent_ghosts.size(), 1);
+            m_recent_target = (std::min)(m_recent_target + delta, m_capacity);
+            replace(false);
+        } else {
+            size_t delta = (std::max<size_t>)(m_recent_ghosts.size() / m_frequent_ghosts.size(), 1);
+            m_recent_target = m_recent_target > delta ? m_recent_target - delta : 0;
+            replace(true);
+        }
+
+        it->second.version = version;
+        it->second.referenced = true;
+        it->second.last_stream_id = stream_id;
+        it->second.block = std::move(block);
+        moveToList(it, ListId::Frequent);
+        return;
+    }
+
+    size_t recent_size = m_recent.size() + m_recent_ghosts.size();
+    size_t total_size = recent_size + m_frequent.size() + m_frequent_ghosts.size();
+    if (recent_size == m_capacity) {
+        if (m_recent.size() < m_capacity) {
+            dropLeastRecentlyUsed(ListId::RecentGhost);
+            replace(false);
+        } else {
+            dropLeastRecentlyUsed(ListId::Recent);
+        }
+    } else if (total_size >= m_capacity) {
+        if (total_size == 2 * m_capacity) {
+            dropLeastRecentlyUsed(ListId::FrequentGhost);
+        }
+
+        replace(false);
+    }
+
+    m_recent.push_front(key);
+    CachedBlock cached_block{ListId::Recent, m_recent.begin(), version, !prefetched, prefetched ? 0 : stream_id,
+                             std::move(block)};
+    m_blocks.emplace(key, std::move(cached_block));
+}
+
+void BlockCache::erase(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Large ranges are matched against the cached blocks rather than looked up block by block
+    if (end_block_index - block_index > m_blocks.size()) {
+        for (auto it = m_blocks.begin(); it != m_blocks.end();) {
+            const BlockKey &key = it->first;
+            bool in_range = key.qid_path == qid_path && key.block_index >= block_index &&
+                            key.block_index < end_block_index;
+            if (in_range && it->second.block) {
+                getList(it->second.list_id).erase(it->second.position);
+                it = m_blocks.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        return;
+    }
+
+    for (uint64_t i = block_index; i < end_block_index; i++) {
+        auto it = m_blocks.find(BlockKey{qid_path, i});
+        if (it != m_blocks.end() && it->second.block) {
+            erase(it);
+        }
+    }
+}
+
+BlockCacheStatistics BlockCache::getStatistics() const
+{
+    return BlockCacheStatistics{m_hits.load(), m_misses.load()};
+}
+
+BlockCache::KeyList &BlockCache::getList(ListId list_id)
+{
+    switch (list_id) {
+    case ListId::Recent:
+        return m_recent;
+    case ListId::Frequent:
+        return m_frequent;
+    case ListId::RecentGhost:
+        return m_recent_ghosts;
+    default:
+        return m_frequent_ghosts;
+    }
+}
+
+void BlockCache::moveToList(BlockMap::iterator it, ListId list_id)
+{
+    KeyList &source_list = getList(it->second.list_id);
+    KeyList &target_list = getList(list_id);
+
+    target_list.splice(target_list.begin(), source_list, it->second.position);
+    it->second.list_id = list_id;
+    it->second.position = target_list.begin();
+}
+
+// Evicts the data of a block to make room for another one, from the recent list if it has outgrown its target share
+// and from the frequent list otherwise. The key of the evicted block is kept as a ghost.
+void BlockCache::replace(bool in_frequent_ghost)
+{
+    bool from_recent = !m_recent.empty() && (m_recent.size() > m_recent_target ||
+                                             (in_frequent_ghost && m_recent.size() == m_recent_target));
+    if (!from_recent && m_frequent.empty()) {
+        from_recent = !m_recent.empty();
+    }
+
+    if (from_recent) {
+        auto it = m_blocks.find(m_recent.back());
+        it->second.block.reset();
+        moveToList(it, ListId::RecentGhost);
+    } else if (!m_frequent.empty()) {
+        auto it = m_blocks.find(m_frequent.back());
+        it->second.block.reset();
+        moveToList(it, ListId::FrequentGhost);
+    }
+}
+
+void BlockCache::dropLeastRecentlyUsed(ListId list_id)
+{
+    KeyList &list = getList(list_id);
+    if (!list.empty()) {
+        erase(m_blocks.find(list.back()));
+    }
+}
+
+void BlockCache::erase(BlockMap::iterator it)
+{
+    getList(it->second.list_id).erase(it->second.position);
+    m_blocks.erase(it);
+}
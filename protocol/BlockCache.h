@@ -0,0 +1,156 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct BlockCacheStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Version of a file that cached data was read from, as told by its qid, modification time and length. Many servers
+// leave qid.vers at zero and the modification time only has a resolution of a second, so the length catches some of
+// the changes that neither of them reflects.
+struct FileVersion
+{
+    uint32_t vers;
+    uint32_t mtime;
+    uint64_t length;
+
+    bool operator==(const FileVersion &other) const = default;
+};
+
+// Data of a file cached in fixed size blocks, keyed by the qid path of the file and the index of the block in it.
+// Every block but the last one of a file is full; a shorter block marks the end of the file.
+using Block = std::vector<char>;
+using BlockPtr = std::shared_ptr<const Block>;
+
+// Cache of file data within a memory budget, with blocks replaced through Adaptive Replacement (ARC). Blocks read just
+// once are kept apart from those read repeatedly, and the share of the cache given to each adapts to the workload by
+// tracking the keys of recently evicted blocks of either kind. A single scan through a large file thus displaces the
+// blocks that have been read once, rather than the working set that keeps being read. Blocks read ahead of the reads
+// have not been read at all yet, so the first read of one only counts as its first use, and the reads of a block by a
+// single sequential stream (e.g. reads smaller than a block) count as one use too. A block is only returned for the
+// version of the file it was read from; blocks of other versions are dropped when looked up.
+class BlockCache
+{
+public:
+    BlockCache(size_t block_size, size_t memory_budget);
+
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    bool isEnabled() const;
+    size_t getBlockSize() const;
+
+    // Reads by the same stream (any id but zero) count as a single use of the block
+    BlockPtr find(uint64_t qid_path, uint64_t block_index, FileVersion version, uint64_t stream_id = 0);
+
+    // Tells whether the block is cached, without counting as a use of it
+    bool contains(uint64_t qid_path, uint64_t block_index, FileVersion version);
+
+    // Blocks read ahead of the reads are added as prefetched, which does not count as a use of them; others are added
+    // as used by the given stream
+    void add(uint64_t qid_path, uint64_t block_index, FileVersion version, BlockPtr block, bool prefetched = false,
+             uint64_t stream_id = 0);
+
+    // Drops the blocks of the file in [block_index, end_block_index), e.g. after they have been written to
+    void erase(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index);
+
+    BlockCacheStatistics getStatistics() const;
+
+private:
+    struct BlockKey
+    {
+        uint64_t qid_path;
+        uint64_t block_index;
+
+        bool operator==(const BlockKey &other) const = default;
+    };
+
+    struct BlockKeyHash
+    {
+        size_t operator()(const BlockKey &key) const;
+    };
+
+    // Recently read once, recently read more than once, and the ghosts (keys only) of the blocks evicted from either
+    enum class ListId
+    {
+        Recent,
+        Frequent,
+        RecentGhost,
+        FrequentGhost
+    };
+
+    using KeyList = std::list<BlockKey>;
+
+    struct CachedBlock
+    {
+        ListId list_id;
+        KeyList::iterator position;
+        FileVersion version;
+
+        // Whether the block has been used since it was added, which prefetched blocks have not
+        bool referenced;
+
+        // Stream that used the block last, if any
+        uint64_t last_stream_id;
+
+        // Null for ghosts
+        BlockPtr block;
+    };
+
+    using BlockMap = std::unordered_map<BlockKey, CachedBlock, BlockKeyHash>;
+
+    KeyList &getList(ListId list_id);
+    void moveToList(BlockMap::iterator it, ListId list_id);
+    void replace(bool in_frequent_ghost);
+    void dropLeastRecentlyUsed(ListId list_id);
+    void erase(BlockMap::iterator it);
+
+    size_t m_block_size;
+
+    // Number of blocks that fit in the memory budget, which bounds the blocks with data as well as the ghosts
+    size_t m_capacity;
+
+    // Target number of blocks in the recent list, adapted as ghosts are hit
+    size_t m_recent_target = 0;
+
+    std::mutex m_mutex;
+
+    // Most recently used first
+    KeyList m_recent;
+    KeyList m_frequent;
+    KeyList m_recent_ghosts;
+    KeyList m_frequent_ghosts;
+    BlockMap m_blocks;
+
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+};
@@ -20,200 +20,386 @@
  */
 #include "Client.h"
 
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-#include <WinSock2.h>
-#include <Ws2ipdef.h>
-#include <MSWSock.h>
-#include <winternl.h>
-#include <ip2string.h>
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 #include "ConstantValues.h"
-#include "FidTracker.h"
-#include "FileMode.h"
-#include "TxMessage.h"
-#include "TxMessageBuilder.h"
+#include "Executor.h"
 #include "MessageReader.h"
+#include "Session.h"
+#include "utils/TextUtilities.h"
 
 #include "gsl/gsl_util"
-#include "utils/TextUtilities.h"
 #include "spdlog/spdlog.h"
 
-#pragma comment(lib, "Ws2_32.lib")
-#pragma comment(lib, "Ntdll.lib")
+// Access pattern of the reads made through a handle, for reading ahead of them while they are sequential (see
+// Client::Impl::readAhead())
+struct ReadAheadState
+{
+    std::mutex mutex;
 
-namespace {
+    // Where the next read starts if the reads are sequential
+    uint64_t next_offset = 0;
 
-constexpr int MAX_MSG_SIZE = 16 * 1024;
-constexpr std::string_view PROTOCOL_VERSION = "9P2000";
+    // Identifies the run of sequential reads in progress to the block cache, whose reads of a block are one use of it
+    uint64_t stream_id = 0;
 
-class WinsockInitializer
-{
-public:
-    WinsockInitializer();
-    ~WinsockInitializer();
+    // How far ahead of the reads to read, and up to where it has been read ahead already
+    uint64_t window = 0;
+    uint64_t end_offset = 0;
 };
 
-WinsockInitializer::WinsockInitializer()
+// Data written through a handle that has not been sent to the server yet (see Client::Impl::writeFile())
+struct WriteBack
 {
-    WSADATA wsaData;
-    int res = WSAStartup(MAKEWORD(2, 2), &wsaData);
-    if (res) {
-        spdlog::error(L"Winsock initialization failed");
-        throw WinsockInitializationFailed();
-    }
-}
+    WriteBack(Session *session, FidHandle entry) : session(session), entry(std::move(entry))
+    {}
 
-WinsockInitializer::~WinsockInitializer()
-{
-    spdlog::trace(L"Shutting down Winsock");
-    WSACleanup();
-}
+    // Held while sending data written through the handle, which keeps the writes in order, and (briefly) while
+    // accessing the buffer. The buffer is taken out to be sent, so that it is never locked while waiting for the
+    // server.
+    std::mutex send_mutex;
+    std::mutex mutex;
 
-template <class T>
-class IntegerIssuer
+    Session *session;
+    FidHandle entry;
+
+    // Data buffered to be written from offset onwards
+    uint64_t offset = 0;
+    std::vector<char> data;
+
+    // Error that sending buffered data ran into, reported by the next flush rather than by the write that happened to
+    // send the data
+    std::exception_ptr error;
+};
+
+// State kept for a file between Client::openFile() and Client::closeFile(). Holding on to the cached entry keeps its
+// fids valid for as long as the handle is open, even if the entry is evicted from the cache in the meantime (in which
+// case the fids are clunked once the last handle to them is closed).
+struct OpenedFile
 {
-public:
-    T issue();
+    Session *session;
+    FidHandle entry;
+    bool is_directory;
 
-private:
-    T m_value = 0;
+    // Unset for directories, and for files that could not be opened for reading
+    std::optional<OpenedFid> read_fid;
+
+    std::unique_ptr<ReadAheadState> read_ahead;
+
+    // Null for directories. Shared with the thread sending buffers that have been held for too long.
+    std::shared_ptr<WriteBack> write_back;
 };
 
-template <class T>
-T IntegerIssuer<T>::issue()
+namespace {
+
+// Reads that miss the block cache are read from the server straight into the buffer of the reader when the blocks to
+// be fetched lie within it. Otherwise the blocks are fetched into a buffer of their own and copied out of it, unless
+// there are more of them than this, in which case the read bypasses the cache rather than copying all of it.
+constexpr uint64_t MAX_STAGED_FETCH_BLOCKS = 4;
+
+void readRStatsFromData(const ParsedRRead &rread, std::vector<RStat> *rstats)
 {
-    static_assert(std::is_integral_v<T>, "Integer Issuer can issue only integers");
+    std::string_view buffer = rread.data;
 
-    return ++m_value;
+    while (buffer.size()) {
+        rstats->push_back(parseRawRStat(buffer));
+    }
 }
 
-using TagIssuer = IntegerIssuer<Tag>;
-using FidIssuer = IntegerIssuer<Fid>;
+struct ReadChunk
+{
+    uint64_t buffer_offset;
+    uint32_t count;
+    Response response;
+};
 
-SOCKET createSocket()
+// Reads the missing tail of a chunk that came back short, returning the number of bytes read (less than count only at
+// the end of file)
+Task<uint32_t> completeShortRead(Session &session, Fid fid, uint64_t offset, char *buffer, uint32_t count)
 {
-    SOCKET s = socket(AF_INET6, SOCK_STREAM, 0);
-    if (s == INVALID_SOCKET) {
-        spdlog::error(L"Socket could not be created. Error status: {}", WSAGetLastError());
-        throw ClientInitializationError();
+    uint32_t read_size = 0;
+    while (read_size < count) {
+        uint32_t run_read_size =
+            co_await session.readInto(fid, offset + read_size, count - read_size, buffer + read_size);
+        if (run_read_size == 0) {
+            break;
+        }
+
+        read_size += run_read_size;
     }
 
-    return s;
+    co_return read_size;
 }
 
-void unsetIPv6OnlySocketOption(SOCKET s)
+// Splits the read into chunks that fit into a single message each and sends them all at once, with the data of each
+// chunk received straight into its place in the buffer. Chunks are collected in order; a chunk that comes back short
+// is completed before moving on to the next one, until one hits the end of file. Every chunk that was sent is waited
+// for before returning (even on error), as its data may otherwise land in the buffer after it has been released.
+Task<uint64_t> readChunks(Session &session, Fid fid, uint64_t offset, char *buffer, uint64_t buffer_length,
+                          uint32_t max_read_size)
 {
-    int ipv6_only = 0;
-    int res = setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&ipv6_only, sizeof(ipv6_only));
-    if (res == SOCKET_ERROR) {
-        spdlog::error(L"Disable 'IPv6 Only' socket option failed. Error status: {}", WSAGetLastError());
-        throw ClientInitializationError();
+    std::vector<ReadChunk> chunks;
+    std::exception_ptr error;
+
+    try {
+        for (uint64_t buffer_offset = 0; buffer_offset < buffer_length; buffer_offset += max_read_size) {
+            uint32_t count = static_cast<uint32_t>((std::min<uint64_t>)(buffer_length - buffer_offset, max_read_size));
+            Response response =
+                co_await session.startReadInto(fid, offset + buffer_offset, count, buffer + buffer_offset);
+            chunks.push_back(ReadChunk{buffer_offset, count, std::move(response)});
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    uint64_t total_read_size = 0;
+    bool end_of_file = false;
+    for (ReadChunk &run_chunk : chunks) {
+        try {
+            char *chunk_buffer = buffer + run_chunk.buffer_offset;
+            ParsedRMessage incoming_msg = co_await run_chunk.response;
+            uint32_t read_size = session.completeReadInto(incoming_msg, run_chunk.count, chunk_buffer);
+            if (error || end_of_file) {
+                continue;
+            }
+
+            if (read_size < run_chunk.count) {
+                read_size += co_await completeShortRead(session, fid, offset + run_chunk.buffer_offset + read_size,
+                                                        chunk_buffer + read_size, run_chunk.count - read_size);
+            }
+
+            total_read_size += read_size;
+            end_of_file = read_size < run_chunk.count;
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
     }
 
-    spdlog::trace(L"Socket option 'IPv6 Only' successfully disabled");
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    co_return total_read_size;
 }
 
-void updateConnectContextSocketOption(SOCKET s)
+struct DirectoryListing
+{
+    // Qid of the directory as of when it was opened for reading
+    Qid qid;
+    std::vector<RStat> rstats;
+};
+
+Task<DirectoryListing> readDirectory(Session &session, Fid fid)
 {
-    int res = setsockopt(s, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0);
-    if (res == SOCKET_ERROR) {
-        spdlog::warn(L"Update connect context failed. Error stats: {}", WSAGetLastError());
-        throw ConnectionFailed();
+    FileMode file_mode(FileMode::Access::Read);
+    ParsedROpen parsed_ropen = co_await session.open(fid, file_mode);
+
+    uint32_t max_read_size = session.getMaxIoSize(parsed_ropen.iounit);
+
+    std::vector<RStat> rstats;
+    uint64_t offset = 0;
+    for (;;) {
+        ParsedRRead rread = co_await session.read(fid, offset, max_read_size);
+        if (rread.data.empty()) {
+            break;
+        }
+
+        readRStatsFromData(rread, &rstats);
+
+        offset += rread.data.size();
     }
 
-    spdlog::trace(L"Connect context successfully updated");
+    co_return DirectoryListing{parsed_ropen.qid, std::move(rstats)};
 }
 
-std::wstring printSockAddrIn(const SOCKADDR_IN &sockaddr_in)
+Task<std::optional<RStat>> statFile(Session &session, Fid fid)
 {
-    const IN_ADDR *in_addr = &sockaddr_in.sin_addr;
-    USHORT port = sockaddr_in.sin_port;
+    ParsedRStat parsed_rstat = co_await session.stat(fid);
+    co_return parsed_rstat.stat;
+}
 
-    wchar_t buffer[INET_ADDRSTRLEN] = {0};
-    ULONG addr_str_len = 0;
+Task<int64_t> readOpenedFid(Session &session, OpenedFid read_fid, uint64_t offset, char *buffer,
+                            uint64_t buffer_length)
+{
+    uint32_t max_read_size = session.getMaxIoSize(read_fid.iounit);
+    uint64_t total_read_size =
+        co_await readChunks(session, read_fid.fid, offset, buffer, buffer_length, max_read_size);
 
-    NTSTATUS res = RtlIpv4AddressToStringExW(in_addr, port, buffer, &addr_str_len);
+    co_return gsl::narrow<int64_t>(total_read_size);
+}
 
-    if (res == 0) {
-        return std::wstring(buffer);
-    } else {
-        spdlog::warn("Conversion of IPv4 address/port to string failed");
-        return std::wstring(L"<conversion failed>");
-    }
+Task<int64_t> readFileData(Session &session, FidHandle entry, uint64_t offset, char *buffer, uint64_t buffer_length)
+{
+    OpenedFid read_fid = co_await session.getReadFid(entry);
+    co_return co_await readOpenedFid(session, read_fid, offset, buffer, buffer_length);
 }
 
-std::wstring printSockAddrIn6(const SOCKADDR_IN6 &sockaddr_in)
+// Runs the operation, and then calls cleanup whether the operation succeeded or not
+template <typename T, typename Cleanup>
+Task<T> runWithCleanup(Task<T> operation, Cleanup cleanup)
 {
-    const IN6_ADDR *in_addr = &sockaddr_in.sin6_addr;
-    ULONG scope_id = sockaddr_in.sin6_scope_id;
-    USHORT port = sockaddr_in.sin6_port;
+    std::optional<T> result;
+    std::exception_ptr error;
 
-    wchar_t buffer[INET6_ADDRSTRLEN] = {0};
-    ULONG addr_str_len = 0;
+    try {
+        T value = co_await operation;
+        result.emplace(std::move(value));
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
 
-    NTSTATUS res = RtlIpv6AddressToStringExW(in_addr, scope_id, port, buffer, &addr_str_len);
+    cleanup(error != nullptr);
 
-    if (res == 0) {
-        return std::wstring(buffer);
-    } else {
-        spdlog::warn("Conversion of IPv6 address/port to string failed");
-        return std::wstring(L"<conversion failed>");
+    if (error) {
+        std::rethrow_exception(error);
     }
+
+    co_return std::move(*result);
 }
 
-std::wstring printAddr(const SOCKADDR_STORAGE &sock_addr_storage)
+// Directories are read through a clone of the cached fid, as reading a directory depends on the offsets of the reads
+// made through the same fid before
+Task<DirectoryListing> listDirectory(Session &session, Fid fid)
 {
-    const SOCKADDR &sock_addr = reinterpret_cast<const SOCKADDR &>(sock_addr_storage);
-    ADDRESS_FAMILY sa_family = sock_addr.sa_family;
-    if (sa_family == AF_INET) {
-        const SOCKADDR_IN &sockaddr_in = reinterpret_cast<const SOCKADDR_IN &>(sock_addr);
-        return printSockAddrIn(sockaddr_in);
-    } else if (sa_family == AF_INET6) {
-        const SOCKADDR_IN6 &sockaddr_in6 = reinterpret_cast<const SOCKADDR_IN6 &>(sock_addr);
-        return printSockAddrIn6(sockaddr_in6);
-    } else {
-        spdlog::warn("Cannot print address, unsupported address family ({})", sa_family);
-        return L"<Unsupported address family>";
-    }
+    WalkedFid cloned_fid = co_await session.walkFrom(fid, {});
+
+    auto clunk_clone = [&session, clone = cloned_fid.fid](bool) { session.clunkInBackground(clone); };
+    co_return co_await runWithCleanup(readDirectory(session, cloned_fid.fid), clunk_clone);
 }
 
-void validateRecvResult(int res)
+// A failed operation may be due to the cached fid no longer being usable, so the fid is not reused after that
+template <typename T>
+Task<T> forgetFidOnError(Session &session, FidHandle entry, Task<T> operation)
 {
-    if (res == 0) {
-        spdlog::error("Server closed connection");
-        throw ConnectionClosed();
-    } else if (res == SOCKET_ERROR) {
-        spdlog::error(L"Reading from socket failed. Error status: {}", WSAGetLastError());
-        throw RecvFailed();
-    }
+    auto forget_on_error = [&session, entry](bool failed) {
+        if (failed) {
+            session.forgetFid(entry);
+        }
+    };
+
+    co_return co_await runWithCleanup(std::move(operation), forget_on_error);
 }
 
-MsgLength peekForMessageLength(SOCKET socket)
+struct WriteChunk
 {
-    char read_buf[4];
+    uint64_t data_offset;
+    uint32_t count;
+    Response response;
+};
 
-    int res = recv(socket, read_buf, 4, MSG_PEEK);
-    validateRecvResult(res);
+// Splits the write into chunks that fit into a single message each, and keeps up to max_in_flight of them in flight at
+// once. Chunks are collected in order; the rest of a chunk that the server wrote only partly is sent anew before
+// moving on to the next one. Once a chunk has failed no more chunks are sent, but every chunk that was sent is still
+// waited for before returning, as the data is sent straight from the caller's buffer. The error reported is that of
+// the first chunk (by offset) that failed, logged along with the offset up to which the data is known to have been
+// written.
+Task<void> writeChunks(Session &session, Fid fid, uint64_t offset, const char *data, uint64_t length,
+                       uint32_t max_write_size, size_t max_in_flight)
+{
+    std::deque<WriteChunk> chunks;
+    std::exception_ptr error;
+    uint64_t error_offset = 0;
+    uint64_t next_data_offset = 0;
+
+    for (;;) {
+        try {
+            while (!error && next_data_offset < length && chunks.size() < max_in_flight) {
+                uint32_t count =
+                    static_cast<uint32_t>((std::min<uint64_t>)(length - next_data_offset, max_write_size));
+                std::string_view chunk_data(data + next_data_offset, count);
+                Response response = co_await session.startWrite(fid, offset + next_data_offset, chunk_data);
+                chunks.push_back(WriteChunk{next_data_offset, count, std::move(response)});
+                next_data_offset += count;
+            }
+        }
+        catch (...) {
+            error = std::current_exception();
+            error_offset = offset + next_data_offset;
+        }
+
+        if (chunks.empty()) {
+            break;
+        }
+
+        WriteChunk chunk = std::move(chunks.front());
+        chunks.pop_front();
+
+        uint32_t written_size = 0;
+        try {
+            ParsedRMessage incoming_msg = co_await chunk.response;
+            written_size = session.completeWrite(incoming_msg);
+            if (error) {
+                continue;
+            }
+
+            while (written_size < chunk.count) {
+                uint64_t data_offset = chunk.data_offset + written_size;
+                std::string_view remaining_data(data + data_offset, chunk.count - written_size);
+                uint32_t run_written_size = co_await session.write(fid, offset + data_offset, remaining_data);
+                if (run_written_size == 0) {
+                    throw WriteFailed();
+                }
+
+                written_size += run_written_size;
+            }
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+                error_offset = offset + chunk.data_offset + written_size;
+            }
+        }
+    }
 
-    assert(res > 0);
-    return parseMessageLength(read_buf);
+    if (error) {
+        spdlog::error("Writing failed at offset {} (of {} bytes from offset {})", error_offset, length, offset);
+        std::rethrow_exception(error);
+    }
 }
 
-void readRStatsFromData(const ParsedRRead &rread, std::vector<RStat> *rstats)
+// Identifies the server and export that the client is attached to, for cached data to be told apart from that of
+// another one
+std::string describeServer(const ClientConfiguration &config)
 {
-    std::string_view buffer = rread.data;
-
-    while (buffer.size()) {
-        rstats->push_back(parseRawRStat(buffer));
+    std::string address;
+    if (!config.shared_memory_name.empty()) {
+        address = "shm:" + config.shared_memory_name;
+    } else if (!config.unix_socket_path.empty()) {
+        address = "unix:" + config.unix_socket_path;
+    } else {
+        address = "tcp:" + config.host + ":" + config.service;
     }
+
+    return address + "/" + config.aname;
 }
 
-void logErrorReceivedFor(const ParsedRMessagePayload &response_payload, const wchar_t *msg_sent)
+// Stat for a TWstat that changes the length of a file, with every other field set to "don't touch"
+TStat makeResizingStat(uint64_t length)
 {
-    const ParsedRError &rerror = std::get<ParsedRError>(response_payload);
-    std::wstring w_ename = convertUtf8ToWstring(rerror.ename);
-    spdlog::error(L"Server responded with RError to {} sent, with ename: {}", msg_sent, w_ename);
+    TStat stat;
+    stat.type = static_cast<uint16_t>(~0);
+    stat.dev = static_cast<uint32_t>(~0);
+    stat.qid = Qid(static_cast<uint8_t>(~0), static_cast<uint32_t>(~0), static_cast<uint64_t>(~0));
+    stat.mode = static_cast<uint32_t>(~0);
+    stat.atime = static_cast<uint32_t>(~0);
+    stat.mtime = static_cast<uint32_t>(~0);
+    stat.length = length;
+
+    return stat;
 }
 
 } // namespace
@@ -224,415 +410,1059 @@ public:
     explicit Impl(const ClientConfiguration &config);
     ~Impl();
 
-    void connectToServer();
-    void doVersionHandshake();
-    void doAuthentication();
-    void doAttachment();
-    void sendAttachMessage(Fid fid);
+    Task<std::vector<RStat>> getDirectoryContents(std::string path);
+    Task<std::optional<RStat>> getFileInformation(std::string path);
+    Task<int64_t> readFile(std::string path, uint64_t offset, void *buffer, uint64_t buffer_length);
+
+    Task<std::unique_ptr<OpenedFile>> openFile(std::string path);
+    Task<std::unique_ptr<OpenedFile>> createFile(std::string path, bool is_directory);
+    Task<std::unique_ptr<OpenedFile>> makeOpenedFile(Session &session, FidHandle entry);
+    Task<std::vector<RStat>> getDirectoryContents(const OpenedFile *file);
+    Task<int64_t> readFile(const OpenedFile *file, uint64_t offset, void *buffer, uint64_t buffer_length);
+
+    Task<int64_t> readThroughBlockCache(Session &session, FidHandle entry, std::optional<OpenedFid> read_fid,
+                                        uint64_t offset, char *buffer, uint64_t buffer_length,
+                                        std::optional<RStat> *rstat = nullptr, uint64_t stream_id = 0);
+    void readAhead(const OpenedFile *file, bool is_sequential, const RStat &rstat);
+    Task<void> prefetchBlocks(Session &session, FidHandle entry, OpenedFid read_fid, uint64_t qid_path,
+                              FileVersion version, uint64_t block_index, uint64_t end_block_index);
+    struct FetchedBlocks;
+    void addFetchedBlocks(FetchedBlocks fetched);
+    void addQueuedBlocks();
+    uint64_t startPrefetching(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index);
+    void finishPrefetching(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index);
+    Task<bool> waitForPrefetch(Session &session, uint64_t qid_path, uint64_t block_index);
+    bool isBlockCached(uint64_t qid_path, uint64_t block_index, FileVersion version);
+    std::optional<size_t> copyCachedBlock(uint64_t qid_path, uint64_t block_index, FileVersion version,
+                                          size_t block_offset, char *buffer, size_t length, uint64_t stream_id);
+    Task<RStat> getAttributes(Session &session, FidHandle entry);
+    Task<RStat> fetchAttributes(Session &session, FidHandle entry);
+    Task<std::vector<RStat>> fetchDirectoryContents(Session &session, FidHandle entry);
+    void invalidatePath(const std::string &path);
+
+    void writeFile(const OpenedFile *file, uint64_t offset, const char *buffer, uint64_t length);
+    int64_t readThroughWriteBack(const OpenedFile *file, uint64_t offset, char *buffer, uint64_t buffer_length);
+    void flushFile(const OpenedFile *file);
+    void setFileSize(const OpenedFile *file, uint64_t size);
+    void closeFile(OpenedFile *file);
+    uint64_t getBufferedEnd(const OpenedFile *file);
+
+    std::vector<char> takeWriteBack(WriteBack *write_back);
+    void sendWriteBack(WriteBack *write_back, uint64_t offset, const std::vector<char> &data);
+    void sendData(Session &session, const FidHandle &entry, uint64_t offset, const char *data, uint64_t length);
+    void invalidateWritten(const FidHandle &entry, uint64_t offset, uint64_t length);
+    void markDirty(const std::shared_ptr<WriteBack> &write_back);
+    void markClean(WriteBack *write_back);
+    void sendExpiredWriteBacks();
+
+    Session &pickSession();
+
+    uint64_t m_read_ahead_max_size;
+    std::atomic<uint64_t> m_next_stream_id = 1;
+    std::chrono::milliseconds m_write_back_delay;
+    uint64_t m_write_back_limit;
+    size_t m_max_writes_in_flight;
+
+    // Data buffered by all the handles
+    std::atomic<uint64_t> m_write_back_size = 0;
+
+    // Outlives the sessions, which refer to it
+    AttributeCache m_attribute_cache;
+    BlockCache m_block_cache;
+    DiskCache m_disk_cache;
+
+    // Data read from the server, which a thread of its own adds to the caches, as copying it into blocks and writing
+    // it to disk would hold up the event loop that the reads complete on. The thread is stopped (once it has added
+    // what is queued) on destruction; the queue outlives the sessions, whose coroutines may still add to it.
+    struct FetchedBlocks
+    {
+        uint64_t qid_path;
+        FileVersion version;
+        uint64_t block_index;
+
+        // Either the data_size bytes of data read, still to be split into blocks, or the blocks split off already
+        std::vector<char> data;
+        uint64_t data_size;
+        std::vector<BlockPtr> blocks;
+
+        bool prefetched;
+        uint64_t stream_id;
+    };
+
+    // Blocks being read ahead, keyed by qid path and block index, along with the coroutines of the reads that wait for
+    // them rather than reading them again. A block stays in flight until it has been added to the caches, or reading
+    // it ahead has failed.
+    struct PrefetchWaiter
+    {
+        std::coroutine_handle<> handle;
+        Executor *executor;
+    };
+
+    class PrefetchAwaiter;
+
+    std::mutex m_prefetch_mutex;
+    std::map<std::pair<uint64_t, uint64_t>, std::vector<PrefetchWaiter>> m_prefetching_blocks;
+
+    std::mutex m_fetched_mutex;
+    std::condition_variable m_fetched_cv;
+    std::deque<FetchedBlocks> m_fetched_blocks;
+    bool m_stopping_cache_fill = false;
+    std::thread m_cache_fill_thread;
+
+    std::vector<std::unique_ptr<Session>> m_sessions;
+
+    // Handles with buffered data, along with when their buffer became non-empty, which are sent by a thread of their
+    // own once they have been held for longer than the write back delay. The thread is stopped (and the buffers sent)
+    // on destruction, before the sessions are destroyed.
+    struct DirtyWriteBack
+    {
+        std::shared_ptr<WriteBack> write_back;
+        std::chrono::steady_clock::time_point dirty_since;
+    };
+
+    std::mutex m_dirty_mutex;
+    std::condition_variable m_dirty_cv;
+    std::unordered_map<WriteBack *, DirtyWriteBack> m_dirty_write_backs;
+    bool m_stopping_write_back = false;
+    std::thread m_write_back_thread;
+};
+
+Client::Impl::Impl(const ClientConfiguration &config)
+    : m_read_ahead_max_size(config.read_ahead_max_size), m_write_back_delay(config.write_back_delay_ms),
+      m_write_back_limit(config.write_back_limit),
+      m_max_writes_in_flight((std::max)(config.max_writes_in_flight, 1U)),
+      m_attribute_cache(std::chrono::milliseconds(config.attribute_cache_ttl_ms), config.attribute_cache_size,
+                        config.directory_cache_size, std::chrono::milliseconds(config.missing_cache_ttl_ms),
+                        config.missing_cache_size),
+      m_block_cache(config.block_cache_block_size, config.block_cache_size),
+      m_disk_cache(config.disk_cache_path, describeServer(config), config.block_cache_block_size,
+                   config.disk_cache_size)
+{
+    unsigned int session_count = config.session_count ? config.session_count : 1;
+    for (unsigned int i = 0; i < session_count; i++) {
+        m_sessions.push_back(std::make_unique<Session>(config, &m_attribute_cache));
+    }
 
-    void sendAuthMessage();
+    spdlog::debug("Established {} session(s) with server", m_sessions.size());
 
-    std::vector<RStat> getDirectoryContents(const std::wstring &wpath);
-    std::optional<RStat> getFileInformation(const std::wstring &wpath);
-    int64_t readFile(const std::wstring &wpath, uint64_t offset, void *buffer, uint64_t buffer_length);
+    if (m_write_back_delay.count()) {
+        m_write_back_thread = std::thread(&Client::Impl::sendExpiredWriteBacks, this);
+    }
 
-    Fid doWalk(const std::wstring &wpath);
-    Fid sendWalkMessage(const std::vector<std::string> &path_components);
+    if (m_block_cache.isEnabled() || m_disk_cache.isEnabled()) {
+        m_cache_fill_thread = std::thread(&Client::Impl::addQueuedBlocks, this);
+    }
+}
 
-    ParsedROpen doOpen(Fid fid, FileMode file_mode);
-    void sendOpenMessage(Fid fid, FileMode file_mode);
+Client::Impl::~Impl()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_dirty_mutex);
+        m_stopping_write_back = true;
+    }
 
-    ParsedRStat doStat(Fid fid);
-    void sendStatMessage(Fid fid);
+    m_dirty_cv.notify_one();
 
-    ParsedRRead doRead(Fid fid, uint64_t offset, uint32_t count);
-    void sendReadMessage(Fid fid, uint64_t offset, uint32_t count);
+    if (m_write_back_thread.joinable()) {
+        m_write_back_thread.join();
+    }
 
-    ParsedRClunk doClunk(Fid fid);
-    void sendClunkMessage(Fid fid);
+    {
+        std::lock_guard<std::mutex> lock(m_fetched_mutex);
+        m_stopping_cache_fill = true;
+    }
 
-    void sendMessageInTxBuffer();
-    std::string readIncomingMessage();
-    ParsedRMessage readParseIncomingMessage();
-    std::string readData(MsgLength message_length);
+    m_fetched_cv.notify_one();
 
-    ClientConfiguration m_config;
+    if (m_cache_fill_thread.joinable()) {
+        m_cache_fill_thread.join();
+    }
+}
 
-    WinsockInitializer m_winsock_initializer;
-    SOCKET m_socket = INVALID_SOCKET;
-    TxMessage m_tx_message;
-    TxMessageBuilder m_tx_msg_builder;
-    uint32_t m_max_message_size;
+// Chooses the session with the fewest requests in flight. A whole operation (walk / open / read / clunk etc.) must be
+// carried out within the chosen session, as fids are only meaningful within the session that issued them.
+Session &Client::Impl::pickSession()
+{
+    auto cmp = [](const std::unique_ptr<Session> &lhs, const std::unique_ptr<Session> &rhs) {
+        return lhs->getOutstandingRequestCount() < rhs->getOutstandingRequestCount();
+    };
 
-    TagIssuer m_tag_issuer;
-    FidIssuer m_fid_issuer;
+    auto it = std::min_element(m_sessions.begin(), m_sessions.end(), cmp);
+    assert(it != m_sessions.end());
 
-    FidTracker m_fid_tracker;
-};
+    return **it;
+}
 
-Client::Impl::Impl(const ClientConfiguration &config)
-    : m_config(config), m_socket(createSocket()), m_tx_message(16 * 1024), m_tx_msg_builder(&m_tx_message),
-      m_max_message_size(MAX_MSG_SIZE)
+// Cached listings are looked up before walking to the directory, as with attributes
+Task<std::vector<RStat>> Client::Impl::getDirectoryContents(std::string path)
 {
-    connectToServer();
-    doVersionHandshake();
-    doAuthentication();
-    doAttachment();
+    std::optional<std::vector<RStat>> cached_rstats =
+        m_attribute_cache.findListing(FidTracker::makePathKey(splitToPathComponents(path)));
+    if (cached_rstats) {
+        co_return std::move(*cached_rstats);
+    }
+
+    Session &session = pickSession();
+
+    FidHandle entry = co_await session.acquireFid(std::move(path));
+    co_return co_await fetchDirectoryContents(session, entry);
 }
 
-Client::Impl::~Impl()
+// Cached attributes are looked up before walking to the file, so that a hit costs no round trip at all
+Task<std::optional<RStat>> Client::Impl::getFileInformation(std::string path)
 {
-    if (m_socket != INVALID_SOCKET) {
-        closesocket(m_socket);
+    std::optional<RStat> cached_rstat = m_attribute_cache.find(FidTracker::makePathKey(splitToPathComponents(path)));
+    if (cached_rstat) {
+        co_return cached_rstat;
     }
+
+    Session &session = pickSession();
+
+    FidHandle entry = co_await session.acquireFid(std::move(path));
+    co_return co_await fetchAttributes(session, entry);
 }
 
-void Client::Impl::connectToServer()
+Task<int64_t> Client::Impl::readFile(std::string path, uint64_t offset, void *buffer, uint64_t buffer_length)
 {
-    unsetIPv6OnlySocketOption(m_socket);
+    Session &session = pickSession();
 
-    SOCKADDR_STORAGE local_addr = {0};
-    DWORD local_addr_len = sizeof(local_addr);
+    FidHandle entry = co_await session.acquireFid(std::move(path));
+    co_return co_await forgetFidOnError(session, entry,
+                                        readThroughBlockCache(session, entry, std::nullopt, offset,
+                                                              static_cast<char *>(buffer), buffer_length));
+}
 
-    SOCKADDR_STORAGE remote_addr = {0};
-    DWORD remote_addr_len = sizeof(remote_addr);
+// Files that are not there are reported without throwing, as Windows probes for them all the time
+Task<std::unique_ptr<OpenedFile>> Client::Impl::openFile(std::string path)
+{
+    if (m_attribute_cache.isKnownMissing(FidTracker::makePathKey(splitToPathComponents(path)))) {
+        co_return nullptr;
+    }
 
-    wchar_t *host = m_config.host.data();
-    wchar_t *service = m_config.service.data();
-    bool res = WSAConnectByNameW(m_socket, host, service, &local_addr_len, (SOCKADDR *)&local_addr, &remote_addr_len,
-                                 (SOCKADDR *)&remote_addr, NULL, NULL);
+    Session &session = pickSession();
 
-    if (!res) {
-        spdlog::warn(L"Connection could not be established. Error status: {}", WSAGetLastError());
-        throw ConnectionFailed();
+    FidHandle entry;
+    try {
+        entry = co_await session.acquireFid(std::move(path));
+    }
+    catch (const FileNotFound &) {
     }
 
-    spdlog::debug(L"Successfully connected to port {}", printAddr(remote_addr));
+    if (!entry) {
+        co_return nullptr;
+    }
 
-    updateConnectContextSocketOption(m_socket);
+    co_return co_await makeOpenedFile(session, entry);
 }
 
-void Client::Impl::doVersionHandshake()
+// Creates the file (or directory) in its parent directory, and opens it on the same session. The fid that a file is
+// created through is left open for writing, so it is kept as the write fid of the entry of the new file.
+Task<std::unique_ptr<OpenedFile>> Client::Impl::createFile(std::string path, bool is_directory)
 {
-    m_tx_msg_builder.buildTVersion(m_max_message_size, PROTOCOL_VERSION);
-    sendMessageInTxBuffer();
+    size_t separator_pos = path.find_last_of('\\');
+    std::string parent_path = separator_pos == std::string::npos ? std::string() : path.substr(0, separator_pos);
+    std::string name = path.substr(separator_pos + 1);
+    if (name.empty()) {
+        throw ErrorMessageReceived();
+    }
 
-    ParsedRMessage response = readParseIncomingMessage();
+    Session &session = pickSession();
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedRVersion>(response_payload)) {
-        const ParsedRVersion &rversion = std::get<ParsedRVersion>(response_payload);
+    FidHandle parent_entry = co_await session.acquireFid(std::move(parent_path));
+    WalkedFid cloned_fid = co_await session.walkFrom(parent_entry->fid, {});
 
-        spdlog::debug(L"Received RVersion with msize: {} and version: {}", rversion.msize,
-                      convertUtf8ToWstring(rversion.version));
+    uint32_t perm = is_directory ? (constant::DMDIR | 0777) : 0666;
+    FileMode file_mode(is_directory ? FileMode::Access::Read : FileMode::Access::Write);
 
-        m_max_message_size = min(m_max_message_size, rversion.msize);
-    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
-        logErrorReceivedFor(response_payload, L"TVersion");
-        throw VersionHandshakeError();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TVersion");
-        throw UnexpectedMessageReceived();
+    std::optional<ParsedRCreate> parsed_rcreate;
+    try {
+        parsed_rcreate = co_await session.create(cloned_fid.fid, name, perm, file_mode);
+    }
+    catch (...) {
+        session.clunkInBackground(cloned_fid.fid);
+        throw;
+    }
+
+    // The path is no longer missing, and the listing of its parent is out of date
+    invalidatePath(FidTracker::makePathKey(splitToPathComponents(path)));
+
+    FidHandle entry;
+    try {
+        entry = co_await session.acquireFid(std::move(path));
+    }
+    catch (...) {
+        session.clunkInBackground(cloned_fid.fid);
+        throw;
+    }
+
+    OpenedFid created_fid{cloned_fid.fid, parsed_rcreate->iounit};
+    if (is_directory || entry->setWriteFid(created_fid)) {
+        session.clunkInBackground(created_fid.fid);
     }
+
+    co_return co_await makeOpenedFile(session, entry);
 }
 
-void Client::Impl::doAuthentication()
+Task<std::unique_ptr<OpenedFile>> Client::Impl::makeOpenedFile(Session &session, FidHandle entry)
 {
-    sendAuthMessage();
+    RStat rstat = co_await getAttributes(session, entry);
+    bool is_directory = rstat.qid.type & constant::QTDIR;
+
+    auto file = std::make_unique<OpenedFile>(
+        OpenedFile{&session, entry, is_directory, std::nullopt, std::make_unique<ReadAheadState>(), nullptr});
+    if (!is_directory) {
+        file->write_back = std::make_shared<WriteBack>(&session, entry);
+
+        // A file may well be opened just for querying its attributes, so one that cannot be read is not an error yet
+        try {
+            file->read_fid = co_await session.getReadFid(entry);
+        }
+        catch (const ErrorMessageReceived &) {
+            spdlog::debug("File '{}' could not be opened for reading", entry->path);
+        }
+    }
 
-    ParsedRMessage response = readParseIncomingMessage();
+    co_return file;
+}
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedRError>(response_payload)) {
-        spdlog::info(L"Server doesn't support authentication");
-    } else if (std::holds_alternative<ParsedRAuth>(response_payload)) {
-        spdlog::error(L"Server sent unsupported authentication details");
-        throw ServerRequestedAuthentication();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TVersion");
-        throw UnexpectedMessageReceived();
+Task<std::vector<RStat>> Client::Impl::getDirectoryContents(const OpenedFile *file)
+{
+    std::optional<std::vector<RStat>> cached_rstats = m_attribute_cache.findListing(file->entry->path);
+    if (cached_rstats) {
+        co_return std::move(*cached_rstats);
     }
+
+    co_return co_await fetchDirectoryContents(*file->session, file->entry);
 }
 
-void Client::Impl::doAttachment()
+Task<int64_t> Client::Impl::readFile(const OpenedFile *file, uint64_t offset, void *buffer, uint64_t buffer_length)
 {
-    Fid fid = m_fid_issuer.issue();
+    Session &session = *file->session;
+    ReadAheadState &state = *file->read_ahead;
+
+    // A read that does not carry on from the previous one starts a new stream
+    bool is_sequential = false;
+    uint64_t stream_id = 0;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        is_sequential = offset == state.next_offset;
+        if (!is_sequential || state.stream_id == 0) {
+            state.stream_id = m_next_stream_id++;
+        }
+
+        stream_id = state.stream_id;
+    }
+
+    std::optional<RStat> rstat;
+    int64_t read_size = co_await forgetFidOnError(session, file->entry,
+                                                  readThroughBlockCache(session, file->entry, file->read_fid, offset,
+                                                                        static_cast<char *>(buffer), buffer_length,
+                                                                        &rstat, stream_id));
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.next_offset = offset + read_size;
+    }
 
-    sendAttachMessage(fid);
+    if (rstat) {
+        readAhead(file, is_sequential, *rstat);
+    }
 
-    ParsedRMessage response = readParseIncomingMessage();
+    co_return read_size;
+}
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedRAttach>(response_payload)) {
-        spdlog::debug(L"Server responded to TAttach with RAttach");
-        const ParsedRAttach &parsed_rattach = std::get<ParsedRAttach>(response_payload);
-        m_fid_tracker.setRoot(fid, parsed_rattach.qid);
-    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
-        const ParsedRError &rerror = std::get<ParsedRError>(response_payload);
-        std::wstring w_ename = convertUtf8ToWstring(rerror.ename);
-        spdlog::error(L"Server responded with RError to TAttach sent, with ename: {}", w_ename);
-        throw UnexpectedMessageReceived();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TAttach");
-        throw UnexpectedMessageReceived();
+// Reads ahead of the reads made through the handle into the block caches while they are sequential, so that the
+// following reads are served without waiting for the server. The window read ahead starts at two blocks and doubles
+// with every sequential read up to the configured maximum, and is halved by every read that is not sequential; the
+// reads ahead run in the background, each covering the part of the window past what has been read ahead already.
+void Client::Impl::readAhead(const OpenedFile *file, bool is_sequential, const RStat &rstat)
+{
+    if (!file->read_fid || !m_read_ahead_max_size) {
+        return;
     }
+
+    uint64_t block_size = m_block_cache.getBlockSize();
+    uint64_t start_offset = 0;
+    uint64_t end_offset = 0;
+    {
+        ReadAheadState &state = *file->read_ahead;
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        if (!is_sequential) {
+            state.window = state.window / 2 >= block_size ? state.window / 2 : 0;
+            state.end_offset = 0;
+            return;
+        }
+
+        state.window = (std::min)(state.window ? state.window * 2 : 2 * block_size, m_read_ahead_max_size);
+        start_offset = (std::max)(state.next_offset, state.end_offset);
+        end_offset = (std::min)(state.next_offset + state.window, rstat.length);
+        if (start_offset >= end_offset) {
+            return;
+        }
+
+        state.end_offset = end_offset;
+    }
+
+    FileVersion version{rstat.qid.vers, rstat.mtime, rstat.length};
+    startDetached(prefetchBlocks(*file->session, file->entry, *file->read_fid, rstat.qid.path, version,
+                                 start_offset / block_size, (end_offset + block_size - 1) / block_size));
 }
 
-void Client::Impl::sendAuthMessage()
+// Reads the given blocks into the caches, apart from those at the start that are cached already. Runs in the
+// background, so errors are only logged; the read that needs the data will run into them again.
+Task<void> Client::Impl::prefetchBlocks(Session &session, FidHandle entry, OpenedFid read_fid, uint64_t qid_path,
+                                        FileVersion version, uint64_t block_index, uint64_t end_block_index)
 {
-    Tag tag = m_tag_issuer.issue();
-    Fid afid = constant::NOFID;
+    while (block_index < end_block_index && isBlockCached(qid_path, block_index, version)) {
+        block_index++;
+    }
+
+    end_block_index = startPrefetching(qid_path, block_index, end_block_index);
+    if (block_index == end_block_index) {
+        co_return;
+    }
+
+    uint64_t block_size = m_block_cache.getBlockSize();
+    std::vector<char> fetched_data((end_block_index - block_index) * block_size);
+    uint32_t max_read_size = session.getMaxIoSize(read_fid.iounit);
+
+    uint64_t fetched_size = 0;
+    try {
+        fetched_size = co_await readChunks(session, read_fid.fid, block_index * block_size, fetched_data.data(),
+                                           fetched_data.size(), max_read_size);
+    }
+    catch (const std::exception &e) {
+        spdlog::debug("Reading ahead in '{}' failed: {}", entry->path, e.what());
+        finishPrefetching(qid_path, block_index, end_block_index);
+        co_return;
+    }
 
-    std::string uname_utf8 = convertWstringToUtf8(m_config.uname);
-    std::string aname_utf8 = convertWstringToUtf8(m_config.aname);
+    // The blocks past the end of the file are not added to the caches
+    uint64_t fetched_end_block_index = block_index + (fetched_size + block_size - 1) / block_size;
+    finishPrefetching(qid_path, fetched_end_block_index, end_block_index);
 
-    m_tx_msg_builder.buildTAuth(tag, afid, uname_utf8, aname_utf8);
-    sendMessageInTxBuffer();
+    addFetchedBlocks(
+        FetchedBlocks{qid_path, version, block_index, std::move(fetched_data), fetched_size, {}, true, 0});
 }
 
-void Client::Impl::sendAttachMessage(Fid fid)
+// Serves the read from the cached blocks of the file (in memory, or else on disk), for the version of the file told by
+// its (cached) attributes. From the first block that is missing onwards, all the blocks spanned by the read are read
+// from the server at once (through the given opened fid, or the shared read fid of the entry) and cached in both
+// tiers. They are read straight into the buffer if they lie within it, and are otherwise staged in a buffer of their
+// own (see MAX_STAGED_FETCH_BLOCKS). The blocks are used on behalf of the given stream of reads, if any.
+Task<int64_t> Client::Impl::readThroughBlockCache(Session &session, FidHandle entry, std::optional<OpenedFid> read_fid,
+                                                  uint64_t offset, char *buffer, uint64_t buffer_length,
+                                                  std::optional<RStat> *rstat_used, uint64_t stream_id)
 {
-    Tag tag = m_tag_issuer.issue();
-    Fid afid = static_cast<Fid>(-1);
+    if ((!m_block_cache.isEnabled() && !m_disk_cache.isEnabled()) || buffer_length == 0) {
+        if (read_fid) {
+            co_return co_await readOpenedFid(session, *read_fid, offset, buffer, buffer_length);
+        }
+
+        co_return co_await readFileData(session, entry, offset, buffer, buffer_length);
+    }
+
+    RStat rstat = co_await getAttributes(session, entry);
+    FileVersion version{rstat.qid.vers, rstat.mtime, rstat.length};
+    if (rstat_used) {
+        *rstat_used = rstat;
+    }
+
+    uint64_t block_size = m_block_cache.getBlockSize();
+    uint64_t end_offset = offset + buffer_length;
+    uint64_t block_index = offset / block_size;
+    uint64_t end_block_index = (end_offset + block_size - 1) / block_size;
+
+    uint64_t copied_size = 0;
+    for (; block_index < end_block_index; block_index++) {
+        uint64_t block_offset = block_index * block_size;
+        uint64_t copy_start = (std::max)(offset, block_offset);
+        uint64_t copy_end = (std::min)(end_offset, block_offset + block_size);
+
+        std::optional<size_t> cached_size = copyCachedBlock(rstat.qid.path, block_index, version,
+                                                            copy_start - block_offset, buffer + copied_size,
+                                                            copy_end - copy_start, stream_id);
+        if (!cached_size && co_await waitForPrefetch(session, rstat.qid.path, block_index)) {
+            cached_size = copyCachedBlock(rstat.qid.path, block_index, version, copy_start - block_offset,
+                                          buffer + copied_size, copy_end - copy_start, stream_id);
+        }
+
+        if (!cached_size) {
+            break;
+        }
+
+        copy_end = (std::min)(copy_end, block_offset + *cached_size);
+        if (copy_start < copy_end) {
+            copied_size += copy_end - copy_start;
+        }
+
+        // A short block is the last one of the file
+        if (*cached_size < block_size) {
+            co_return gsl::narrow<int64_t>(copied_size);
+        }
+    }
+
+    if (block_index == end_block_index) {
+        co_return gsl::narrow<int64_t>(copied_size);
+    }
+
+    if (!read_fid) {
+        read_fid = co_await session.getReadFid(entry);
+    }
+
+    uint32_t max_read_size = session.getMaxIoSize(read_fid->iounit);
+    uint64_t fetch_offset = block_index * block_size;
+    uint64_t fetch_end = end_block_index * block_size;
+
+    // The blocks lie within the buffer if they start at a block boundary, and either end at one as well or run past
+    // the end of the file, whose last block is short anyway
+    if (fetch_offset >= offset && (fetch_end <= end_offset || end_offset >= rstat.length)) {
+        uint64_t fetch_length = (std::min)(fetch_end, end_offset) - fetch_offset;
+        uint64_t fetched_size = co_await readChunks(session, read_fid->fid, fetch_offset, buffer + copied_size,
+                                                    fetch_length, max_read_size);
+
+        // A short block marks the end of the file, so a block cut short by the end of the buffer is only cached if the
+        // file ends there as well
+        uint64_t cached_size = fetched_size;
+        if (fetched_size == fetch_length && fetch_offset + fetched_size != rstat.length) {
+            cached_size -= fetched_size % block_size;
+        }
+
+        std::vector<BlockPtr> blocks;
+        for (uint64_t block_offset = 0; block_offset < cached_size; block_offset += block_size) {
+            const char *block_data = buffer + copied_size + block_offset;
+            blocks.push_back(std::make_shared<const Block>(
+                block_data, block_data + (std::min)(block_size, cached_size - block_offset)));
+        }
+
+        addFetchedBlocks(FetchedBlocks{rstat.qid.path, version, block_index, {}, 0, std::move(blocks), false,
+                                       stream_id});
+        co_return gsl::narrow<int64_t>(copied_size + fetched_size);
+    }
+
+    if (end_block_index - block_index > MAX_STAGED_FETCH_BLOCKS) {
+        uint64_t read_size = co_await readChunks(session, read_fid->fid, offset + copied_size, buffer + copied_size,
+                                                 buffer_length - copied_size, max_read_size);
+        co_return gsl::narrow<int64_t>(copied_size + read_size);
+    }
 
-    std::string uname_utf8 = convertWstringToUtf8(m_config.uname);
-    std::string aname_utf8 = convertWstringToUtf8(m_config.aname);
+    std::vector<char> fetched_data(fetch_end - fetch_offset);
+    uint64_t fetched_size = co_await readChunks(session, read_fid->fid, fetch_offset, fetched_data.data(),
+                                                fetched_data.size(), max_read_size);
 
-    m_tx_msg_builder.buildTAttach(tag, fid, afid, uname_utf8, aname_utf8);
-    sendMessageInTxBuffer();
+    uint64_t copy_start = (std::max)(offset, fetch_offset);
+    uint64_t copy_end = (std::min)(end_offset, fetch_offset + fetched_size);
+    if (copy_start < copy_end) {
+        std::copy_n(fetched_data.data() + (copy_start - fetch_offset), copy_end - copy_start, buffer + copied_size);
+        copied_size += copy_end - copy_start;
+    }
+
+    addFetchedBlocks(FetchedBlocks{rstat.qid.path, version, block_index, std::move(fetched_data), fetched_size, {},
+                                   false, stream_id});
+
+    co_return gsl::narrow<int64_t>(copied_size);
 }
 
-void Client::Impl::sendMessageInTxBuffer()
+// Queues the blocks of data read from the server to be added to both tiers of the cache, as read ahead of the reads if
+// prefetched, or else as used by the given stream
+void Client::Impl::addFetchedBlocks(FetchedBlocks fetched)
 {
-    std::string_view buffer = m_tx_message.getData();
+    {
+        std::lock_guard<std::mutex> lock(m_fetched_mutex);
+        if (!m_stopping_cache_fill) {
+            m_fetched_blocks.push_back(std::move(fetched));
+            m_fetched_cv.notify_one();
+            return;
+        }
+    }
 
-    int res = send(m_socket, buffer.data(), (int)buffer.size(), 0);
-    if (res == SOCKET_ERROR) {
-        spdlog::error(L"Send failed. Error status: {}", WSAGetLastError());
-        throw SendFailed();
+    if (fetched.prefetched) {
+        uint64_t block_size = m_block_cache.getBlockSize();
+        finishPrefetching(fetched.qid_path, fetched.block_index,
+                          fetched.block_index + (fetched.data_size + block_size - 1) / block_size);
     }
 }
 
-std::string Client::Impl::readIncomingMessage()
+// Adds the queued blocks to the caches, in the order they were read, until stopping
+void Client::Impl::addQueuedBlocks()
 {
-    MsgLength message_length = peekForMessageLength(m_socket);
-    return readData(message_length);
+    std::unique_lock<std::mutex> lock(m_fetched_mutex);
+    uint64_t block_size = m_block_cache.getBlockSize();
+
+    for (;;) {
+        m_fetched_cv.wait(lock, [&] { return m_stopping_cache_fill || !m_fetched_blocks.empty(); });
+        if (m_fetched_blocks.empty()) {
+            return;
+        }
+
+        FetchedBlocks fetched = std::move(m_fetched_blocks.front());
+        m_fetched_blocks.pop_front();
+
+        lock.unlock();
+
+        for (uint64_t block_offset = 0; block_offset < fetched.data_size; block_offset += block_size) {
+            uint64_t run_block_index = fetched.block_index + block_offset / block_size;
+            uint64_t run_block_size = (std::min)(block_size, fetched.data_size - block_offset);
+            const char *run_block_data = fetched.data.data() + block_offset;
+
+            m_disk_cache.add(fetched.qid_path, run_block_index, fetched.version, run_block_data, run_block_size);
+            if (m_block_cache.isEnabled()) {
+                auto block = std::make_shared<const Block>(run_block_data, run_block_data + run_block_size);
+                m_block_cache.add(fetched.qid_path, run_block_index, fetched.version, std::move(block),
+                                  fetched.prefetched, fetched.stream_id);
+            }
+        }
+
+        for (size_t i = 0; i < fetched.blocks.size(); i++) {
+            BlockPtr &block = fetched.blocks[i];
+            m_disk_cache.add(fetched.qid_path, fetched.block_index + i, fetched.version, block->data(), block->size());
+            if (m_block_cache.isEnabled()) {
+                m_block_cache.add(fetched.qid_path, fetched.block_index + i, fetched.version, std::move(block),
+                                  fetched.prefetched, fetched.stream_id);
+            }
+        }
+
+        if (fetched.prefetched) {
+            finishPrefetching(fetched.qid_path, fetched.block_index,
+                              fetched.block_index + (fetched.data_size + block_size - 1) / block_size);
+        }
+
+        lock.lock();
+    }
 }
 
-ParsedRMessage Client::Impl::readParseIncomingMessage()
+// Marks the blocks as being read ahead, up to the first one that is being read ahead already, returning the end of the
+// blocks marked
+uint64_t Client::Impl::startPrefetching(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index)
 {
-    std::string incoming_msg = readIncomingMessage();
-    std::string_view incoming_msg_view(incoming_msg.data(), incoming_msg.size());
-    return parseMessage(incoming_msg_view);
+    std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+
+    for (uint64_t i = block_index; i < end_block_index; i++) {
+        if (!m_prefetching_blocks.try_emplace(std::make_pair(qid_path, i)).second) {
+            return i;
+        }
+    }
+
+    return end_block_index;
 }
 
-std::string Client::Impl::readData(MsgLength msg_length)
+// Resumes the reads waiting for the blocks, which find them in the caches by then unless reading them ahead failed
+void Client::Impl::finishPrefetching(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index)
 {
-    std::string incoming_buf(msg_length, '\0');
-    int res = recv(m_socket, incoming_buf.data(), msg_length, 0);
-    validateRecvResult(res);
+    std::vector<PrefetchWaiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+
+        for (uint64_t i = block_index; i < end_block_index; i++) {
+            auto it = m_prefetching_blocks.find(std::make_pair(qid_path, i));
+            if (it != m_prefetching_blocks.end()) {
+                waiters.insert(waiters.end(), it->second.begin(), it->second.end());
+                m_prefetching_blocks.erase(it);
+            }
+        }
+    }
 
-    return incoming_buf;
+    for (const PrefetchWaiter &run_waiter : waiters) {
+        run_waiter.executor->post(run_waiter.handle);
+    }
 }
 
-std::vector<RStat> Client::Impl::getDirectoryContents(const std::wstring &wpath)
+// Suspends the awaiting coroutine until the block is no longer being read ahead. It is resumed by the current
+// executor, or else on the given event loop.
+class Client::Impl::PrefetchAwaiter
 {
-    Fid new_fid = doWalk(wpath);
+public:
+    PrefetchAwaiter(Impl *impl, std::pair<uint64_t, uint64_t> key, EventLoop *event_loop)
+        : m_impl(impl), m_key(key), m_event_loop(event_loop)
+    {}
 
-    FileMode file_mode(FileMode::Access::Read);
-    doOpen(new_fid, file_mode);
+    bool await_ready()
+    {
+        return false;
+    }
 
-    auto readData = [&](uint64_t offset) { return doRead(new_fid, offset, 65535); };
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->m_prefetch_mutex);
 
-    std::vector<RStat> rstats;
-    uint64_t offset = 0;
-    for (ParsedRRead rread = readData(0); rread.data.size() > 0; rread = readData(offset)) {
-        readRStatsFromData(rread, &rstats);
+        auto it = m_impl->m_prefetching_blocks.find(m_key);
+        if (it == m_impl->m_prefetching_blocks.end()) {
+            return false;
+        }
 
-        offset += rread.data.size();
+        it->second.push_back(PrefetchWaiter{awaiting, Executor::currentOr(m_event_loop)});
+        return true;
     }
 
-    doClunk(new_fid);
+    void await_resume()
+    {}
+
+private:
+    Impl *m_impl;
+    std::pair<uint64_t, uint64_t> m_key;
+    EventLoop *m_event_loop;
+};
+
+// Returns true if the block was being read ahead, once that has completed
+Task<bool> Client::Impl::waitForPrefetch(Session &session, uint64_t qid_path, uint64_t block_index)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        if (!m_prefetching_blocks.count(std::make_pair(qid_path, block_index))) {
+            co_return false;
+        }
+    }
 
-    return rstats;
+    co_await PrefetchAwaiter(this, std::make_pair(qid_path, block_index), session.getEventLoop());
+    co_return true;
 }
 
-std::optional<RStat> Client::Impl::getFileInformation(const std::wstring &wpath)
+bool Client::Impl::isBlockCached(uint64_t qid_path, uint64_t block_index, FileVersion version)
 {
-    Fid new_fid = doWalk(wpath);
+    return (m_block_cache.isEnabled() && m_block_cache.contains(qid_path, block_index, version)) ||
+           m_disk_cache.contains(qid_path, block_index, version);
+}
 
-    ParsedRStat parsed_rstat = doStat(new_fid);
+// Copies the cached part of the block that falls within [block_offset, block_offset + length) into the buffer,
+// returning the size of the whole block, or nothing if neither tier has the block for this version of the file
+std::optional<size_t> Client::Impl::copyCachedBlock(uint64_t qid_path, uint64_t block_index, FileVersion version,
+                                                    size_t block_offset, char *buffer, size_t length,
+                                                    uint64_t stream_id)
+{
+    if (m_block_cache.isEnabled()) {
+        BlockPtr block = m_block_cache.find(qid_path, block_index, version, stream_id);
+        if (block) {
+            if (block_offset < block->size()) {
+                std::copy_n(block->data() + block_offset, (std::min)(length, block->size() - block_offset), buffer);
+            }
+
+            return block->size();
+        }
+    }
 
-    doClunk(new_fid);
+    if (m_disk_cache.isEnabled()) {
+        return m_disk_cache.read(qid_path, block_index, version, block_offset, buffer, length);
+    }
 
-    return parsed_rstat.stat;
+    return std::nullopt;
 }
 
-int64_t Client::Impl::readFile(const std::wstring &wpath, uint64_t offset, void *buffer, uint64_t buffer_length)
+Task<RStat> Client::Impl::getAttributes(Session &session, FidHandle entry)
 {
-    Fid new_fid = doWalk(wpath);
+    std::optional<RStat> cached_rstat = m_attribute_cache.find(entry->path);
+    if (cached_rstat) {
+        co_return *cached_rstat;
+    }
 
-    FileMode file_mode(FileMode::Access::Read);
-    doOpen(new_fid, file_mode);
+    co_return co_await fetchAttributes(session, entry);
+}
 
-    uint32_t buffer_length32 = gsl::narrow<uint32_t>(buffer_length);
-    ParsedRRead parsed_rread = doRead(new_fid, offset, buffer_length32);
+// Stats the fid of the entry, bypassing the attribute cache, and caches the result
+Task<RStat> Client::Impl::fetchAttributes(Session &session, FidHandle entry)
+{
+    std::optional<RStat> rstat = co_await forgetFidOnError(session, entry, statFile(session, entry->fid));
+    m_attribute_cache.validate(entry->path, rstat->qid);
+    m_attribute_cache.add(entry->path, *rstat);
+
+    co_return *rstat;
+}
 
-    size_t read_size = parsed_rread.data.size();
+// Reads the directory of the entry, bypassing the attribute cache, and caches its listing along with the attributes of
+// the files in it
+Task<std::vector<RStat>> Client::Impl::fetchDirectoryContents(Session &session, FidHandle entry)
+{
+    DirectoryListing listing = co_await forgetFidOnError(session, entry, listDirectory(session, entry->fid));
+    m_attribute_cache.validate(entry->path, listing.qid);
+    m_attribute_cache.addListing(entry->path, listing.qid, listing.rstats);
 
-    // It is possible that server sent back more data than what we requested
-    size_t data_to_copy_count = min(read_size, buffer_length);
-    memcpy_s(buffer, buffer_length, parsed_rread.data.c_str(), data_to_copy_count);
+    for (const RStat &run_rstat : listing.rstats) {
+        session.validateFid(entry->path.empty() ? run_rstat.name : entry->path + '/' + run_rstat.name, run_rstat.qid);
+    }
 
-    doClunk(new_fid);
-    return read_size;
+    co_return std::move(listing.rstats);
 }
 
-Fid Client::Impl::doWalk(const std::wstring &wpath)
+// Drops everything cached for the path, including the fids walked to it (or below it) by any of the sessions, as
+// these may lead to a file that has since been replaced
+void Client::Impl::invalidatePath(const std::string &path)
 {
-    std::string path = convertWstringToUtf8(wpath);
-    std::vector<std::string> path_components = splitToPathComponents(path);
+    m_attribute_cache.invalidate(path);
 
-    Fid new_fid = sendWalkMessage(path_components);
+    for (const std::unique_ptr<Session> &run_session : m_sessions) {
+        run_session->forgetPath(path);
+    }
+}
+
+// Writes are buffered per handle and merged while each one continues where the previous one ended, up to one message
+// worth of data, which is then sent with a single TWrite. The buffer is sent once it is full, when a write does not
+// continue it, when the handle is flushed, resized or closed, and once it has been held for longer than the write back
+// delay. Writes that would fill a buffer on their own, and writes made while the data buffered by all the handles is
+// over the write back limit, are sent right away. A write only throws the errors of sending its own data; those of
+// sending buffered data are reported by the next flush. Reads through the handle see the buffered data without sending
+// it (see readThroughWriteBack()).
+void Client::Impl::writeFile(const OpenedFile *file, uint64_t offset, const char *buffer, uint64_t length)
+{
+    Session &session = *file->session;
+    OpenedFid write_fid = syncWait(session.getWriteFid(file->entry));
+    uint64_t max_buffer_size = session.getMaxIoSize(write_fid.iounit);
+
+    bool is_buffered = m_write_back_delay.count() && length < max_buffer_size &&
+                       m_write_back_size.load() + length <= m_write_back_limit;
+
+    WriteBack &write_back = *file->write_back;
+    std::lock_guard<std::mutex> send_lock(write_back.send_mutex);
+
+    // Either the buffer that the write does not continue, or the one that the write fills
+    uint64_t sent_offset = 0;
+    std::vector<char> sent_data;
+    {
+        std::lock_guard<std::mutex> lock(write_back.mutex);
+
+        uint64_t buffered_size = write_back.data.size();
+        bool continues_buffer = offset == write_back.offset + buffered_size &&
+                                buffered_size + length <= max_buffer_size;
+        if (buffered_size && (!is_buffered || !continues_buffer)) {
+            sent_offset = write_back.offset;
+            sent_data = takeWriteBack(&write_back);
+        }
+
+        if (is_buffered) {
+            if (write_back.data.empty()) {
+                write_back.offset = offset;
+                markDirty(file->write_back);
+            }
+
+            write_back.data.insert(write_back.data.end(), buffer, buffer + length);
+            m_write_back_size += length;
+
+            if (write_back.data.size() == max_buffer_size) {
+                sent_offset = write_back.offset;
+                sent_data = takeWriteBack(&write_back);
+            }
+        }
+    }
 
-    ParsedRMessage response = readParseIncomingMessage();
+    sendWriteBack(&write_back, sent_offset, sent_data);
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedRWalk>(response_payload)) {
-        spdlog::debug(L"Server responded to TWalk with RWalk");
-        return new_fid;
-    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
-        logErrorReceivedFor(response_payload, L"TWalk");
-        throw ErrorMessageReceived();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TWalk");
-        throw UnexpectedMessageReceived();
+    if (!is_buffered) {
+        sendData(session, file->entry, offset, buffer, length);
     }
 }
 
-Fid Client::Impl::sendWalkMessage(const std::vector<std::string> &path_components)
+// Reads through the handle see the data buffered for it on top of what the server (or the cache) has, without sending
+// it; sending through the handle waits meanwhile, so that none of the data is on its way to the server while reading.
+// Errors of sending buffered data are left to be reported by the next flush.
+int64_t Client::Impl::readThroughWriteBack(const OpenedFile *file, uint64_t offset, char *buffer,
+                                           uint64_t buffer_length)
 {
-    Tag tag = m_tag_issuer.issue();
+    if (!file->write_back) {
+        return syncWait(readFile(file, offset, buffer, buffer_length));
+    }
+
+    WriteBack &write_back = *file->write_back;
+    std::lock_guard<std::mutex> send_lock(write_back.send_mutex);
 
-    const FidEntry *root_fid_entry = m_fid_tracker.getRootEntry();
-    Fid root_fid = root_fid_entry->fid;
-    Fid new_fid = m_fid_issuer.issue();
+    uint64_t read_size = syncWait(readFile(file, offset, buffer, buffer_length));
 
-    m_tx_msg_builder.buildTWalk(tag, root_fid, new_fid, path_components);
-    sendMessageInTxBuffer();
+    std::lock_guard<std::mutex> lock(write_back.mutex);
+    uint64_t buffered_start = (std::max)(offset, write_back.offset);
+    uint64_t buffered_end = (std::min)(offset + buffer_length, write_back.offset + write_back.data.size());
+    if (buffered_start >= buffered_end) {
+        return gsl::narrow<int64_t>(read_size);
+    }
+
+    // Past the end of the file on the server, the file reads as zeros up to the buffered data
+    if (offset + read_size < buffered_start) {
+        std::fill(buffer + read_size, buffer + (buffered_start - offset), 0);
+    }
 
-    return new_fid;
+    std::copy_n(write_back.data.data() + (buffered_start - write_back.offset), buffered_end - buffered_start,
+                buffer + (buffered_start - offset));
+    return gsl::narrow<int64_t>((std::max)(read_size, buffered_end - offset));
 }
 
-ParsedROpen Client::Impl::doOpen(Fid fid, FileMode file_mode)
+void Client::Impl::flushFile(const OpenedFile *file)
 {
-    sendOpenMessage(fid, file_mode);
+    if (!file->write_back) {
+        return;
+    }
 
-    ParsedRMessage response = readParseIncomingMessage();
+    WriteBack &write_back = *file->write_back;
+    std::lock_guard<std::mutex> send_lock(write_back.send_mutex);
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedROpen>(response_payload)) {
-        spdlog::debug(L"Server responded to TOpen with ROpen");
-        return std::get<ParsedROpen>(response_payload);
-    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
-        logErrorReceivedFor(response_payload, L"TOpen");
-        throw ErrorMessageReceived();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TOpen");
-        throw UnexpectedMessageReceived();
+    uint64_t sent_offset = 0;
+    std::vector<char> sent_data;
+    {
+        std::lock_guard<std::mutex> lock(write_back.mutex);
+        sent_offset = write_back.offset;
+        sent_data = takeWriteBack(&write_back);
+    }
+
+    sendWriteBack(&write_back, sent_offset, sent_data);
+
+    std::lock_guard<std::mutex> lock(write_back.mutex);
+    if (write_back.error) {
+        std::rethrow_exception(std::exchange(write_back.error, nullptr));
     }
 }
 
-void Client::Impl::sendOpenMessage(Fid fid, FileMode file_mode)
+void Client::Impl::setFileSize(const OpenedFile *file, uint64_t size)
 {
-    Tag tag = m_tag_issuer.issue();
+    flushFile(file);
+
+    RStat rstat = syncWait(getAttributes(*file->session, file->entry));
+    syncWait(file->session->wstat(file->entry->fid, makeResizingStat(size)));
 
-    uint8_t encoded_file_mode = file_mode.encode();
-    m_tx_msg_builder.buildTOpen(tag, fid, encoded_file_mode);
-    sendMessageInTxBuffer();
+    uint64_t first_offset = (std::min)(size, rstat.length);
+    invalidateWritten(file->entry, first_offset, (std::max)(size, rstat.length) - first_offset);
 }
 
-ParsedRStat Client::Impl::doStat(Fid fid)
+void Client::Impl::closeFile(OpenedFile *file)
 {
-    sendStatMessage(fid);
+    try {
+        flushFile(file);
+    }
+    catch (const std::exception &e) {
+        spdlog::error("Data written to '{}' could not be sent on closing: {}", file->entry->path, e.what());
+    }
 
-    ParsedRMessage response = readParseIncomingMessage();
+    delete file;
+}
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedRStat>(response_payload)) {
-        spdlog::debug(L"Server responded to TStat with RStat");
-        return std::get<ParsedRStat>(response_payload);
-    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
-        logErrorReceivedFor(response_payload, L"TStat");
-        throw ErrorMessageReceived();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TStat");
-        throw UnexpectedMessageReceived();
+// End of the data buffered for the handle, or zero if there is none
+uint64_t Client::Impl::getBufferedEnd(const OpenedFile *file)
+{
+    if (!file->write_back) {
+        return 0;
     }
+
+    std::lock_guard<std::mutex> lock(file->write_back->mutex);
+    return file->write_back->data.empty() ? 0 : file->write_back->offset + file->write_back->data.size();
 }
 
-void Client::Impl::sendStatMessage(Fid fid)
+// Empties the buffer, which must be locked by the caller, returning the data that was in it
+std::vector<char> Client::Impl::takeWriteBack(WriteBack *write_back)
 {
-    Tag tag = m_tag_issuer.issue();
+    std::vector<char> data = std::move(write_back->data);
+    write_back->data.clear();
+
+    if (!data.empty()) {
+        m_write_back_size -= data.size();
+        markClean(write_back);
+    }
 
-    m_tx_msg_builder.buildTStat(tag, fid);
-    sendMessageInTxBuffer();
+    return data;
 }
 
-ParsedRRead Client::Impl::doRead(Fid fid, uint64_t offset, uint32_t count)
+// Sends data taken out of the buffer, with sending through the handle locked by the caller. A failure is kept to be
+// reported by the next flush.
+void Client::Impl::sendWriteBack(WriteBack *write_back, uint64_t offset, const std::vector<char> &data)
 {
-    sendReadMessage(fid, offset, count);
+    if (data.empty()) {
+        return;
+    }
 
-    ParsedRMessage response = readParseIncomingMessage();
+    try {
+        sendData(*write_back->session, write_back->entry, offset, data.data(), data.size());
+    }
+    catch (const std::exception &e) {
+        spdlog::error("Data written to '{}' could not be sent: {}", write_back->entry->path, e.what());
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedRRead>(response_payload)) {
-        spdlog::debug(L"Server responded to TRead with RRead");
-        return std::get<ParsedRRead>(response_payload);
-    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
-        logErrorReceivedFor(response_payload, L"TRead");
-        throw ErrorMessageReceived();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TOpen");
-        throw UnexpectedMessageReceived();
+        std::lock_guard<std::mutex> lock(write_back->mutex);
+        if (!write_back->error) {
+            write_back->error = std::current_exception();
+        }
     }
 }
 
-void Client::Impl::sendReadMessage(Fid fid, uint64_t offset, uint32_t count)
+// The written range is invalidated even if sending fails, as part of it may have been written by then
+void Client::Impl::sendData(Session &session, const FidHandle &entry, uint64_t offset, const char *data,
+                            uint64_t length)
 {
-    Tag tag = m_tag_issuer.issue();
+    OpenedFid write_fid = syncWait(session.getWriteFid(entry));
+    try {
+        syncWait(writeChunks(session, write_fid.fid, offset, data, length, session.getMaxIoSize(write_fid.iounit),
+                             m_max_writes_in_flight));
+    }
+    catch (...) {
+        invalidateWritten(entry, offset, length);
+        throw;
+    }
 
-    m_tx_msg_builder.buildTRead(tag, fid, offset, count);
-    sendMessageInTxBuffer();
+    invalidateWritten(entry, offset, length);
 }
 
-ParsedRClunk Client::Impl::doClunk(Fid fid)
+// Drops whatever has been cached for the file written to, as its attributes and the written blocks have changed
+void Client::Impl::invalidateWritten(const FidHandle &entry, uint64_t offset, uint64_t length)
 {
-    sendClunkMessage(fid);
+    m_attribute_cache.invalidate(entry->path);
 
-    ParsedRMessage response = readParseIncomingMessage();
+    uint64_t block_size = m_block_cache.getBlockSize();
+    uint64_t block_index = offset / block_size;
+    uint64_t end_block_index = (offset + length + block_size - 1) / block_size;
+    m_block_cache.erase(entry->qid.path, block_index, end_block_index);
+    m_disk_cache.erase(entry->qid.path, block_index, end_block_index);
+}
 
-    const ParsedRMessagePayload &response_payload = response.payload;
-    if (std::holds_alternative<ParsedRClunk>(response_payload)) {
-        spdlog::debug(L"Server responded to TClunk with RClunk");
-        return std::get<ParsedRClunk>(response_payload);
-    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
-        const ParsedRError &rerror = std::get<ParsedRError>(response_payload);
-        std::wstring w_ename = convertUtf8ToWstring(rerror.ename);
-        spdlog::error(L"Server responded with RError to TClunk sent, with ename: {}", w_ename);
-        throw ErrorMessageReceived();
-    } else {
-        spdlog::error(L"Unexpected message received while waiting for response to TOpen");
-        throw UnexpectedMessageReceived();
-    }
+void Client::Impl::markDirty(const std::shared_ptr<WriteBack> &write_back)
+{
+    std::lock_guard<std::mutex> lock(m_dirty_mutex);
+    m_dirty_write_backs.emplace(write_back.get(), DirtyWriteBack{write_back, std::chrono::steady_clock::now()});
 }
 
-void Client::Impl::sendClunkMessage(Fid fid)
+void Client::Impl::markClean(WriteBack *write_back)
 {
-    Tag tag = m_tag_issuer.issue();
+    std::lock_guard<std::mutex> lock(m_dirty_mutex);
+    m_dirty_write_backs.erase(write_back);
+}
 
-    m_tx_msg_builder.buildTClunk(tag, fid);
-    sendMessageInTxBuffer();
+// Sends the buffers held for longer than the write back delay, and all of them once stopping. A failure is reported
+// by the next flush of the handle.
+void Client::Impl::sendExpiredWriteBacks()
+{
+    std::unique_lock<std::mutex> lock(m_dirty_mutex);
+
+    for (;;) {
+        bool stopping = m_dirty_cv.wait_for(lock, m_write_back_delay / 2, [&] { return m_stopping_write_back; });
+
+        auto expiry_time = std::chrono::steady_clock::now() - m_write_back_delay;
+        std::vector<std::shared_ptr<WriteBack>> expired_write_backs;
+        for (const auto &[run_write_back, run_dirty] : m_dirty_write_backs) {
+            if (stopping || run_dirty.dirty_since <= expiry_time) {
+                expired_write_backs.push_back(run_dirty.write_back);
+            }
+        }
+
+        lock.unlock();
+
+        for (const std::shared_ptr<WriteBack> &run_write_back : expired_write_backs) {
+            // A handle that is being written through is left for the next round rather than waited for, unless
+            // stopping
+            std::unique_lock<std::mutex> send_lock(run_write_back->send_mutex, std::try_to_lock);
+            if (!send_lock.owns_lock()) {
+                if (!stopping) {
+                    continue;
+                }
+
+                send_lock.lock();
+            }
+
+            uint64_t sent_offset = 0;
+            std::vector<char> sent_data;
+            {
+                std::lock_guard<std::mutex> write_back_lock(run_write_back->mutex);
+                sent_offset = run_write_back->offset;
+                sent_data = takeWriteBack(run_write_back.get());
+            }
+
+            sendWriteBack(run_write_back.get(), sent_offset, sent_data);
+        }
+
+        lock.lock();
+        if (stopping) {
+            return;
+        }
+    }
 }
 
 Client::Client(const ClientConfiguration &config) : m_i(new Impl(config))
@@ -644,22 +1474,146 @@ Client::Client(const ClientConfiguration &config) : m_i(new Impl(config))
 Client::~Client()
 {}
 
-std::vector<RStat> Client::getDirectoryContents(const std::wstring &wpath)
+std::vector<RStat> Client::getDirectoryContents(const std::string &path)
 {
-    return m_i->getDirectoryContents(wpath);
+    return syncWait(m_i->getDirectoryContents(path));
 }
 
-std::optional<RStat> Client::getFileInformation(const std::wstring &wpath)
+std::optional<RStat> Client::getFileInformation(const std::string &path)
 {
-    return m_i->getFileInformation(wpath);
+    return syncWait(m_i->getFileInformation(path));
 }
 
-int64_t Client::readFile(const std::wstring &wpath, uint64_t offset, void *buffer, uint64_t buffer_length)
+int64_t Client::readFile(const std::string &path, uint64_t offset, void *buffer, uint64_t buffer_length)
 {
     try {
-        return m_i->readFile(wpath, offset, buffer, buffer_length);
+        return syncWait(m_i->readFile(path, offset, buffer, buffer_length));
+    }
+    catch (const RequestTimedOut &) {
+        throw;
     }
     catch (...) {
         return -1;
     }
 }
+
+OpenedFile *Client::openFile(const std::string &path)
+{
+    return syncWait(m_i->openFile(path)).release();
+}
+
+bool Client::isDirectory(const OpenedFile *file)
+{
+    return file->is_directory;
+}
+
+// Data that is still buffered counts towards the length of the file
+RStat Client::getFileInformation(const OpenedFile *file)
+{
+    RStat rstat = syncWait(m_i->getAttributes(*file->session, file->entry));
+    rstat.length = (std::max)(rstat.length, m_i->getBufferedEnd(file));
+
+    return rstat;
+}
+
+std::vector<RStat> Client::getDirectoryContents(const OpenedFile *file)
+{
+    return syncWait(m_i->getDirectoryContents(file));
+}
+
+int64_t Client::readFile(const OpenedFile *file, uint64_t offset, void *buffer, uint64_t buffer_length)
+{
+    try {
+        return m_i->readThroughWriteBack(file, offset, static_cast<char *>(buffer), buffer_length);
+    }
+    catch (const RequestTimedOut &) {
+        throw;
+    }
+    catch (...) {
+        return -1;
+    }
+}
+
+OpenedFile *Client::createFile(const std::string &path, bool is_directory)
+{
+    return syncWait(m_i->createFile(path, is_directory)).release();
+}
+
+bool Client::openFileForWriting(const OpenedFile *file)
+{
+    try {
+        syncWait(file->session->getWriteFid(file->entry));
+        return true;
+    }
+    catch (const RequestTimedOut &) {
+        throw;
+    }
+    catch (const ClientException &) {
+        return false;
+    }
+}
+
+void Client::writeFile(const OpenedFile *file, uint64_t offset, const void *buffer, uint64_t length)
+{
+    m_i->writeFile(file, offset, static_cast<const char *>(buffer), length);
+}
+
+void Client::flushFile(const OpenedFile *file)
+{
+    m_i->flushFile(file);
+}
+
+void Client::setFileSize(const OpenedFile *file, uint64_t size)
+{
+    m_i->setFileSize(file, size);
+}
+
+void Client::closeFile(OpenedFile *file)
+{
+    m_i->closeFile(file);
+}
+
+AttributeCacheStatistics Client::getAttributeCacheStatistics() const
+{
+    return m_i->m_attribute_cache.getStatistics();
+}
+
+BlockCacheStatistics Client::getBlockCacheStatistics() const
+{
+    return m_i->m_block_cache.getStatistics();
+}
+
+DiskCacheStatistics Client::getDiskCacheStatistics() const
+{
+    return m_i->m_disk_cache.getStatistics();
+}
+
+Task<RemoteFile> Client::walk(std::string path)
+{
+    Session &session = m_i->pickSession();
+
+    Fid fid = co_await session.walk(std::move(path));
+    co_return RemoteFile{&session, fid};
+}
+
+Task<ParsedROpen> Client::open(RemoteFile file, FileMode file_mode)
+{
+    return file.session->open(file.fid, file_mode);
+}
+
+Task<uint32_t> Client::read(RemoteFile file, uint64_t offset, uint32_t count, void *buffer)
+{
+    count = (std::min)(count, file.session->getMaxIoSize(0));
+    return file.session->readInto(file.fid, offset, count, static_cast<char *>(buffer));
+}
+
+Task<RStat> Client::stat(RemoteFile file)
+{
+    ParsedRStat parsed_rstat = co_await file.session->stat(file.fid);
+    co_return parsed_rstat.stat;
+}
+
+Task<void> Client::clunk(RemoteFile file)
+{
+    co_await file.session->clunk(file.fid);
+}
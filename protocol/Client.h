@@ -26,29 +26,171 @@
 #include <string>
 #include <vector>
 
+#include "AttributeCache.h"
+#include "BlockCache.h"
+#include "DiskCache.h"
 #include "Exceptions.h"
 #include "DataTypes.h"
+#include "FileMode.h"
+#include "MessageReader.h"
+#include "Task.h"
 
+class Session;
+struct OpenedFile;
+
+enum class TransportBackend
+{
+    Default, // Winsock on Windows, epoll on Linux
+    IoUring
+};
+
+// All the strings are UTF-8
 struct ClientConfiguration
 {
-    ClientConfiguration(const std::wstring &host, const std::wstring &service) : host(host), service(service)
+    ClientConfiguration(const std::string &host, const std::string &service) : host(host), service(service)
     {}
 
-    std::wstring host;
-    std::wstring service;
-    std::wstring uname = L"nobody";
-    std::wstring aname;
+    std::string host;
+    std::string service;
+
+    // When set, the server is reached over the AF_UNIX stream socket at this path, instead of over TCP at host /
+    // service
+    std::string unix_socket_path;
+
+    // When set, the server is reached through the shared mapping with this name, set up by a server running on the
+    // same host (see SharedMemoryLayout.h). Only a single session may be attached to a mapping.
+    std::string shared_memory_name;
+    std::string uname = "nobody";
+    std::string aname;
+
+    // Maximum message size offered to the server. The size actually used is the smaller of this and the msize the
+    // server responds with; it bounds the data transferred by each read / write.
+    uint32_t msize = 512 * 1024;
+
+    // Number of independent sessions (each with its own connection) opened to the server
+    unsigned int session_count = 1;
+
+    TransportBackend transport_backend = TransportBackend::Default;
+
+    // Outgoing messages are sent in batches. A batch is sent as soon as possible, but if tx_flush_delay_us is non-zero
+    // the sender waits up to that long for more messages, unless tx_flush_threshold bytes are already queued.
+    size_t tx_flush_threshold = 64 * 1024;
+    unsigned int tx_flush_delay_us = 0;
+
+    // Requests not responded to within this long fail with RequestTimedOut and are flushed on the server (zero means
+    // that requests are waited for indefinitely)
+    unsigned int request_timeout_ms = 0;
+
+    // Maximum number of fids in use at once on each session, which bounds the resources held on the server. Walking
+    // to a file waits while all of them are in use, until one is clunked. As an operation may hold up to two fids at
+    // once, this must be well above twice the number of operations carried out concurrently.
+    uint32_t max_fid_count = 16 * 1024;
+
+    // Number of paths whose walked fids are kept on each session, so that later operations on the same paths need not
+    // walk to them again (the cache is limited to a quarter of max_fid_count in any case)
+    size_t fid_cache_size = 1024;
+
+    // Cached fids are walked anew once they have been cached for this long, as another client may have replaced the
+    // file at their path in the meantime (zero keeps them until evicted)
+    unsigned int fid_cache_ttl_ms = 10000;
+
+    // Attributes of files are served from a cache shared by all sessions for up to this long after they were last
+    // fetched, unless the file is seen to have changed in the meantime (zero disables the cache)
+    unsigned int attribute_cache_ttl_ms = 1000;
+    size_t attribute_cache_size = 4096;
+
+    // Number of directories whose listings are cached, under the same time to live as attributes
+    size_t directory_cache_size = 256;
+
+    // Paths found not to exist are reported as such without asking the server again for up to this long, unless
+    // their parent directory is seen to have changed in the meantime (zero disables the cache)
+    unsigned int missing_cache_ttl_ms = 500;
+    size_t missing_cache_size = 1024;
+
+    // Memory budget of the cache of file data shared by all sessions, which is read from the server and cached in
+    // blocks of block_cache_block_size bytes each. Cached data is only served for the same version of the file it was
+    // read from, as told by the qid version and modification time in its attributes (zero disables the cache).
+    size_t block_cache_size = 64 * 1024 * 1024;
+    size_t block_cache_block_size = 64 * 1024;
+
+    // When set, file data is cached in this local file as well, which is kept across runs so that files read in an
+    // earlier run need not be read from the server again, unless they have changed since. The file takes up to
+    // disk_cache_size bytes, in blocks of block_cache_block_size bytes each.
+    std::string disk_cache_path;
+    uint64_t disk_cache_size = 4ULL * 1024 * 1024 * 1024;
+
+    // Largest amount of data read ahead of the reads made through a file handle, for as long as they are sequential
+    // (zero disables reading ahead, which also needs one of the caches above to read into)
+    uint64_t read_ahead_max_size = 4 * 1024 * 1024;
+
+    // Longest time that data written through a file handle is buffered for before being sent to the server (zero
+    // sends every write right away), and the most data buffered by all the handles together
+    unsigned int write_back_delay_ms = 1000;
+    uint64_t write_back_limit = 64 * 1024 * 1024;
+
+    // Most writes kept in flight at once while sending data that does not fit into a single message
+    unsigned int max_writes_in_flight = 8;
 };
 
+// File on the server that has been walked to through the asynchronous API of the Client. It may only be used with
+// the session (connection) it was walked on, and must eventually be released with Client::clunk().
+struct RemoteFile
+{
+    Session *session;
+    Fid fid;
+};
+
+// All public methods may be called concurrently; requests issued from different threads are pipelined over the same
+// connection and matched to their responses by tag. Paths are UTF-8, with their components separated by backslashes.
 class Client
 {
 public:
     Client(const ClientConfiguration &config);
     ~Client();
 
-    std::vector<RStat> getDirectoryContents(const std::wstring &wpath);
-    std::optional<RStat> getFileInformation(const std::wstring &wpath);
-    int64_t readFile(const std::wstring &wpath, uint64_t offset, void *buffer, uint64_t buffer_length);
+    // Synchronous API, blocking the calling thread until the whole operation has completed. Each of them throws
+    // RequestTimedOut if the server did not respond to one of the requests making up the operation in time.
+    std::vector<RStat> getDirectoryContents(const std::string &path);
+    std::optional<RStat> getFileInformation(const std::string &path);
+    int64_t readFile(const std::string &path, uint64_t offset, void *buffer, uint64_t buffer_length);
+
+    // Handle based form of the synchronous API, for callers that keep a file open across several operations (such as
+    // the Dokany callbacks, from CreateFile until CloseFile). openFile() walks to the file and stats it, and opens it
+    // for reading too unless it is a directory; the operations on the returned handle reuse all of that instead of
+    // walking to the file again, and attributes missing from the attribute cache are fetched through its fid. The
+    // handle must eventually be released with closeFile(). openFile() returns null if there is no such file, and
+    // throws ErrorMessageReceived if the file cannot be walked to for any other reason.
+    OpenedFile *openFile(const std::string &path);
+    bool isDirectory(const OpenedFile *file);
+    RStat getFileInformation(const OpenedFile *file);
+    std::vector<RStat> getDirectoryContents(const OpenedFile *file);
+    int64_t readFile(const OpenedFile *file, uint64_t offset, void *buffer, uint64_t buffer_length);
+
+    // Writing through a handle. createFile() creates the file (or directory) in its parent directory and returns a
+    // handle to it, and openFileForWriting() returns false if the file cannot be opened for writing. Writes are
+    // buffered for up to the write back delay (see ClientConfiguration) and sent by flushFile() at the latest, which
+    // closeFile() calls too; reads through the handle see the buffered data. Failing to send buffered data is reported
+    // by the next flushFile(), not by the writeFile() that sent it. All of them throw a ClientException on failure.
+    OpenedFile *createFile(const std::string &path, bool is_directory);
+    bool openFileForWriting(const OpenedFile *file);
+    void writeFile(const OpenedFile *file, uint64_t offset, const void *buffer, uint64_t length);
+    void flushFile(const OpenedFile *file);
+    void setFileSize(const OpenedFile *file, uint64_t size);
+    void closeFile(OpenedFile *file);
+
+    AttributeCacheStatistics getAttributeCacheStatistics() const;
+    BlockCacheStatistics getBlockCacheStatistics() const;
+    DiskCacheStatistics getDiskCacheStatistics() const;
+
+    // Asynchronous API. Each request is sent once the returned task is awaited, and the awaiting coroutine is resumed
+    // once the response has arrived, on the event loop of the session (so it must not block) or, under syncWait(), on
+    // the waiting thread. read() transfers at most one message worth of data, and may return fewer bytes than
+    // requested even before the end of file.
+    Task<RemoteFile> walk(std::string path);
+    Task<ParsedROpen> open(RemoteFile file, FileMode file_mode);
+    Task<uint32_t> read(RemoteFile file, uint64_t offset, uint32_t count, void *buffer);
+    Task<RStat> stat(RemoteFile file);
+    Task<void> clunk(RemoteFile file);
 
     Client(const Client &) = delete;
     Client &operator=(const Client &) = delete;
@@ -24,6 +24,25 @@
 
 namespace constant {
 
+constexpr Tag NOTAG = static_cast<Tag>(~0);
 constexpr Fid NOFID = static_cast<Fid>(~0);
 
+// size[4] type[1] tag[2]
+constexpr size_t MESSAGE_HEADER_SIZE = sizeof(MsgLength) + sizeof(MsgType) + sizeof(Tag);
+
+// Header of an RRead up to the data, i.e. followed by count[4]
+constexpr size_t RREAD_HEADER_SIZE = MESSAGE_HEADER_SIZE + sizeof(uint32_t);
+
+// Room reserved in a message for the header of a TRead / TWrite / RRead, out of the negotiated msize
+constexpr uint32_t IOHDRSZ = 24;
+
+// Maximum number of path components walked by a single TWalk
+constexpr size_t MAXWELEM = 16;
+
+// Bit of Qid::type set for directories
+constexpr uint8_t QTDIR = 0x80;
+
+// Bit of the permissions of a file (as in Stat::mode or TCreate) set for directories
+constexpr uint32_t DMDIR = 0x80000000;
+
 }
\ No newline at end of file
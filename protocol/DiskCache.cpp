@@ -0,0 +1,485 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "DiskCache.h"
+
+#ifdef _WIN32
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "utils/TextUtilities.h"
+#include "spdlog/spdlog.h"
+
+namespace {
+
+constexpr uint64_t MAGIC = 0x4548434143503946ULL; // "F9PCACHE"
+constexpr uint32_t VERSION = 2;
+constexpr uint64_t MAPPING_ALIGNMENT = 4096;
+
+enum SlotState : uint32_t
+{
+    FREE_SLOT = 0,
+    USED_SLOT = 1
+};
+
+struct DiskCacheHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t slot_count;
+
+    // Hash of the server and export that the cached blocks were read from, as qid paths are only unique within those
+    uint64_t server_id;
+};
+
+// Entry of the index describing the data in one slot. The entry and the data are plain stores into the mapping, which
+// the system may write back in any order, so after a crash an entry may well describe data other than what its slot
+// holds; it is the checksum, verified on every read, that keeps such a slot from being served.
+struct DiskCacheSlot
+{
+    uint64_t qid_path;
+    uint64_t block_index;
+
+    // Orders the slots by their last use, so that the least recently used one is reused first across runs as well
+    uint64_t last_used;
+
+    // Covers all of the above but last_used, and the data itself
+    uint64_t checksum;
+    uint64_t length;
+    uint32_t vers;
+    uint32_t mtime;
+    uint32_t data_size;
+    uint32_t state;
+};
+
+uint64_t mixChecksum(uint64_t checksum, uint64_t value)
+{
+    checksum ^= value;
+    checksum *= 0x100000001b3ULL;
+    return checksum ^ (checksum >> 29);
+}
+
+uint64_t computeChecksum(const DiskCacheSlot &slot, const char *data)
+{
+    uint64_t checksum = 0xcbf29ce484222325ULL;
+    checksum = mixChecksum(checksum, slot.qid_path);
+    checksum = mixChecksum(checksum, slot.block_index);
+    checksum = mixChecksum(checksum, (uint64_t(slot.vers) << 32) | slot.mtime);
+    checksum = mixChecksum(checksum, slot.length);
+    checksum = mixChecksum(checksum, slot.data_size);
+
+    size_t offset = 0;
+    for (; offset + sizeof(uint64_t) <= slot.data_size; offset += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + offset, sizeof(word));
+        checksum = mixChecksum(checksum, word);
+    }
+
+    for (; offset < slot.data_size; offset++) {
+        checksum = mixChecksum(checksum, static_cast<unsigned char>(data[offset]));
+    }
+
+    return checksum;
+}
+
+uint64_t computeServerId(const std::string &server_identity)
+{
+    uint64_t server_id = 0xcbf29ce484222325ULL;
+    for (char run_char : server_identity) {
+        server_id = mixChecksum(server_id, static_cast<unsigned char>(run_char));
+    }
+
+    return server_id;
+}
+
+DiskCacheHeader *getHeader(char *mapping)
+{
+    return reinterpret_cast<DiskCacheHeader *>(mapping);
+}
+
+DiskCacheSlot *getSlots(char *mapping)
+{
+    return reinterpret_cast<DiskCacheSlot *>(mapping + sizeof(DiskCacheHeader));
+}
+
+} // namespace
+
+size_t DiskCache::BlockKeyHash::operator()(const BlockKey &key) const
+{
+    return std::hash<uint64_t>()(key.qid_path) ^ (std::hash<uint64_t>()(key.block_index) * 0x9e3779b97f4a7c15ULL);
+}
+
+DiskCache::DiskCache(const std::string &path, const std::string &server_identity, size_t block_size, uint64_t size)
+    : m_block_size(block_size), m_server_id(computeServerId(server_identity))
+{
+    if (path.empty() || block_size == 0 || size < MAPPING_ALIGNMENT + block_size) {
+        return;
+    }
+
+    m_slot_count = static_cast<size_t>((size - MAPPING_ALIGNMENT) / (block_size + sizeof(DiskCacheSlot)));
+    uint64_t index_size = sizeof(DiskCacheHeader) + m_slot_count * sizeof(DiskCacheSlot);
+    m_data_offset = (index_size + MAPPING_ALIGNMENT - 1) / MAPPING_ALIGNMENT * MAPPING_ALIGNMENT;
+
+    if (!mapFile(path, m_data_offset + m_slot_count * block_size)) {
+        m_slot_count = 0;
+        return;
+    }
+
+    m_slot_positions.resize(m_slot_count);
+    loadIndex();
+
+    spdlog::debug("Disk cache {} holds {} of {} blocks", path, m_used_slots.size(), m_slot_count);
+}
+
+DiskCache::~DiskCache()
+{
+    unmapFile();
+}
+
+bool DiskCache::isEnabled() const
+{
+    return m_mapping != nullptr;
+}
+
+std::optional<size_t> DiskCache::read(uint64_t qid_path, uint64_t block_index, FileVersion version,
+                                      size_t block_offset, char *buffer, size_t length)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_slots_by_key.find(BlockKey{qid_path, block_index});
+    if (it == m_slots_by_key.end()) {
+        m_misses++;
+        return std::nullopt;
+    }
+
+    size_t slot = it->second;
+    const DiskCacheSlot &slot_entry = getSlots(m_mapping)[slot];
+    const char *data = getSlotData(slot);
+    if (FileVersion{slot_entry.vers, slot_entry.mtime, slot_entry.length} != version) {
+        freeSlot(slot);
+        m_misses++;
+        return std::nullopt;
+    }
+
+    if (computeChecksum(slot_entry, data) != slot_entry.checksum) {
+        spdlog::warn("Dropping corrupt block {} of file {} from disk cache", block_index, qid_path);
+        freeSlot(slot);
+        m_misses++;
+        return std::nullopt;
+    }
+
+    if (block_offset < slot_entry.data_size) {
+        memcpy(buffer, data + block_offset, (std::min)(length, slot_entry.data_size - block_offset));
+    }
+
+    touchSlot(slot);
+    m_hits++;
+    return slot_entry.data_size;
+}
+
+bool DiskCache::contains(uint64_t qid_path, uint64_t block_index, FileVersion version)
+{
+    if (!isEnabled()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_slots_by_key.find(BlockKey{qid_path, block_index});
+    if (it == m_slots_by_key.end()) {
+        return false;
+    }
+
+    const DiskCacheSlot &slot_entry = getSlots(m_mapping)[it->second];
+    return FileVersion{slot_entry.vers, slot_entry.mtime, slot_entry.length} == version;
+}
+
+void DiskCache::add(uint64_t qid_path, uint64_t block_index, FileVersion version, const char *data, size_t data_size)
+{
+    if (!isEnabled() || data_size > m_block_size) {
+        return;
+    }
+
+    BlockKey key{qid_path, block_index};
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_slots_by_key.find(key);
+    if (it != m_slots_by_key.end()) {
+        freeSlot(it->second);
+    }
+
+    if (m_free_slots.empty()) {
+        freeSlot(m_used_slots.back());
+    }
+
+    size_t slot = m_free_slots.back();
+    m_free_slots.pop_back();
+
+    DiskCacheSlot &slot_entry = getSlots(m_mapping)[slot];
+    memcpy(getSlotData(slot), data, data_size);
+    slot_entry.qid_path = qid_path;
+    slot_entry.block_index = block_index;
+    slot_entry.vers = version.vers;
+    slot_entry.mtime = version.mtime;
+    slot_entry.length = version.length;
+    slot_entry.data_size = static_cast<uint32_t>(data_size);
+    slot_entry.checksum = computeChecksum(slot_entry, data);
+    slot_entry.state = USED_SLOT;
+
+    m_slots_by_key.emplace(key, slot);
+    m_used_slots.push_front(slot);
+    m_slot_positions[slot] = m_used_slots.begin();
+    slot_entry.last_used = ++m_use_count;
+}
+
+void DiskCache::erase(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Large ranges are matched against the slots in use rather than looked up block by block
+    if (end_block_index - block_index > m_slots_by_key.size()) {
+        std::vector<size_t> slots_in_range;
+        for (const auto &[key, slot] : m_slots_by_key) {
+            if (key.qid_path == qid_path && key.block_index >= block_index && key.block_index < end_block_index) {
+                slots_in_range.push_back(slot);
+            }
+        }
+
+        for (size_t run_slot : slots_in_range) {
+            freeSlot(run_slot);
+        }
+
+        return;
+    }
+
+    for (uint64_t i = block_index; i < end_block_index; i++) {
+        auto it = m_slots_by_key.find(BlockKey{qid_path, i});
+        if (it != m_slots_by_key.end()) {
+            freeSlot(it->second);
+        }
+    }
+}
+
+DiskCacheStatistics DiskCache::getStatistics() const
+{
+    return DiskCacheStatistics{m_hits.load(), m_misses.load()};
+}
+
+#ifdef _WIN32
+
+// The file is opened without sharing, which keeps other clients from using it at the same time, and made sparse so
+// that slots never written to take up no space
+bool DiskCache::mapFile(const std::string &path, uint64_t mapping_size)
+{
+    std::wstring wpath = convertUtf8ToWstring(path);
+    m_file =
+        CreateFileW(wpath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        spdlog::warn("Disk cache {} could not be opened. Error status: {}", path, GetLastError());
+        return false;
+    }
+
+    DWORD bytes_returned;
+    DeviceIoControl(m_file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes_returned, NULL);
+
+    LARGE_INTEGER file_size;
+    file_size.QuadPart = static_cast<LONGLONG>(mapping_size);
+    if (!SetFilePointerEx(m_file, file_size, NULL, FILE_BEGIN) || !SetEndOfFile(m_file)) {
+        spdlog::warn("Disk cache {} could not be resized. Error status: {}", path, GetLastError());
+        unmapFile();
+        return false;
+    }
+
+    m_file_mapping = CreateFileMappingW(m_file, NULL, PAGE_READWRITE, file_size.HighPart, file_size.LowPart, NULL);
+    if (m_file_mapping != NULL) {
+        m_mapping = static_cast<char *>(MapViewOfFile(m_file_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    }
+
+    if (m_mapping == nullptr) {
+        spdlog::warn("Disk cache {} could not be mapped. Error status: {}", path, GetLastError());
+        unmapFile();
+        return false;
+    }
+
+    m_mapping_size = mapping_size;
+    return true;
+}
+
+void DiskCache::unmapFile()
+{
+    if (m_mapping) {
+        UnmapViewOfFile(m_mapping);
+        m_mapping = nullptr;
+    }
+
+    if (m_file_mapping != NULL) {
+        CloseHandle(m_file_mapping);
+        m_file_mapping = NULL;
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+#else
+
+// The file is locked exclusively, which keeps other clients from using it at the same time
+bool DiskCache::mapFile(const std::string &path, uint64_t mapping_size)
+{
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd == -1) {
+        spdlog::warn("Disk cache {} could not be opened: {}", path, strerror(errno));
+        return false;
+    }
+
+    if (flock(m_fd, LOCK_EX | LOCK_NB) == -1) {
+        spdlog::warn("Disk cache {} is in use by another client: {}", path, strerror(errno));
+        unmapFile();
+        return false;
+    }
+
+    if (ftruncate(m_fd, static_cast<off_t>(mapping_size)) == -1) {
+        spdlog::warn("Disk cache {} could not be resized: {}", path, strerror(errno));
+        unmapFile();
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        spdlog::warn("Disk cache {} could not be mapped: {}", path, strerror(errno));
+        unmapFile();
+        return false;
+    }
+
+    m_mapping = static_cast<char *>(mapping);
+    m_mapping_size = mapping_size;
+    return true;
+}
+
+void DiskCache::unmapFile()
+{
+    if (m_mapping) {
+        munmap(m_mapping, m_mapping_size);
+        m_mapping = nullptr;
+    }
+
+    if (m_fd != -1) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+#endif
+
+// Takes over the slots left by an earlier run, unless the file was laid out for a different block size or number of
+// slots (or not at all), or filled from a different server, in which case it starts out empty. Entries are only
+// checked against their data when read.
+void DiskCache::loadIndex()
+{
+    DiskCacheHeader *header = getHeader(m_mapping);
+    if (header->magic != MAGIC || header->version != VERSION || header->block_size != m_block_size ||
+        header->slot_count != m_slot_count || header->server_id != m_server_id) {
+        initializeIndex();
+        return;
+    }
+
+    DiskCacheSlot *slots = getSlots(m_mapping);
+
+    std::vector<size_t> used_slots;
+    for (size_t i = 0; i < m_slot_count; i++) {
+        BlockKey key{slots[i].qid_path, slots[i].block_index};
+        if (slots[i].state != USED_SLOT || slots[i].data_size > m_block_size || m_slots_by_key.count(key)) {
+            slots[i].state = FREE_SLOT;
+            m_free_slots.push_back(i);
+            continue;
+        }
+
+        m_slots_by_key.emplace(key, i);
+        used_slots.push_back(i);
+    }
+
+    // Most recently used first
+    std::sort(used_slots.begin(), used_slots.end(),
+              [slots](size_t lhs, size_t rhs) { return slots[lhs].last_used > slots[rhs].last_used; });
+    for (size_t run_slot : used_slots) {
+        m_used_slots.push_back(run_slot);
+        m_slot_positions[run_slot] = std::prev(m_used_slots.end());
+        m_use_count = (std::max)(m_use_count, slots[run_slot].last_used);
+    }
+}
+
+// The header is invalidated first and only written back once all the slots have been freed, so that a crash half way
+// through leaves a file that is initialized anew the next time
+void DiskCache::initializeIndex()
+{
+    DiskCacheHeader *header = getHeader(m_mapping);
+    header->magic = 0;
+
+    memset(getSlots(m_mapping), 0, m_slot_count * sizeof(DiskCacheSlot));
+
+    header->version = VERSION;
+    header->block_size = static_cast<uint32_t>(m_block_size);
+    header->slot_count = m_slot_count;
+    header->server_id = m_server_id;
+    header->magic = MAGIC;
+
+    m_free_slots.clear();
+    for (size_t i = m_slot_count; i > 0; i--) {
+        m_free_slots.push_back(i - 1);
+    }
+}
+
+char *DiskCache::getSlotData(size_t slot) const
+{
+    return m_mapping + m_data_offset + slot * m_block_size;
+}
+
+void DiskCache::freeSlot(size_t slot)
+{
+    DiskCacheSlot &slot_entry = getSlots(m_mapping)[slot];
+    slot_entry.state = FREE_SLOT;
+    m_slots_by_key.erase(BlockKey{slot_entry.qid_path, slot_entry.block_index});
+
+    m_used_slots.erase(*m_slot_positions[slot]);
+    m_slot_positions[slot].reset();
+    m_free_slots.push_back(slot);
+}
+
+void DiskCache::touchSlot(size_t slot)
+{
+    m_used_slots.splice(m_used_slots.begin(), m_used_slots, *m_slot_positions[slot]);
+    getSlots(m_mapping)[slot].last_used = ++m_use_count;
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BlockCache.h"
+
+struct DiskCacheStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Cache of file data in a local file, which is memory mapped and kept across runs of the client. The file holds a
+// fixed number of slots of one block each, along with an index recording the file, version and block index of the data
+// in each slot; its size is fixed up front, and the least recently used slot is reused once all of them are taken.
+// Nothing is flushed to disk explicitly, so after a crash the index and the data may be out of step; each slot of the
+// index carries a checksum of the slot's data, which is checked whenever the data is read, so that blocks left half
+// written are dropped rather than served. The file records the server it was filled from (server_identity, e.g. its
+// address and the name of the export) and starts out empty when used with another one. Only a single client may use
+// the file at a time; if it cannot be opened, mapped, or locked, the cache is disabled.
+class DiskCache
+{
+public:
+    DiskCache(const std::string &path, const std::string &server_identity, size_t block_size, uint64_t size);
+    ~DiskCache();
+
+    DiskCache(const DiskCache &) = delete;
+    DiskCache &operator=(const DiskCache &) = delete;
+
+    bool isEnabled() const;
+
+    // Copies up to length bytes of the cached block, starting at block_offset within it, straight from the mapping
+    // into the buffer. Returns the size of the data in the block (a block shorter than the block size being the last
+    // one of the file), or nothing if the block is not cached for this version of the file.
+    std::optional<size_t> read(uint64_t qid_path, uint64_t block_index, FileVersion version, size_t block_offset,
+                               char *buffer, size_t length);
+
+    // Tells whether the block is cached, without counting as a use of it or checking its data
+    bool contains(uint64_t qid_path, uint64_t block_index, FileVersion version);
+    void add(uint64_t qid_path, uint64_t block_index, FileVersion version, const char *data, size_t data_size);
+
+    // Drops the blocks of the file in [block_index, end_block_index), e.g. after they have been written to
+    void erase(uint64_t qid_path, uint64_t block_index, uint64_t end_block_index);
+
+    DiskCacheStatistics getStatistics() const;
+
+private:
+    struct BlockKey
+    {
+        uint64_t qid_path;
+        uint64_t block_index;
+
+        bool operator==(const BlockKey &other) const = default;
+    };
+
+    struct BlockKeyHash
+    {
+        size_t operator()(const BlockKey &key) const;
+    };
+
+    bool mapFile(const std::string &path, uint64_t mapping_size);
+    void unmapFile();
+    void loadIndex();
+    void initializeIndex();
+
+    char *getSlotData(size_t slot) const;
+    void freeSlot(size_t slot);
+    void touchSlot(size_t slot);
+
+    size_t m_block_size;
+    uint64_t m_server_id;
+    size_t m_slot_count = 0;
+    uint64_t m_data_offset = 0;
+
+    char *m_mapping = nullptr;
+    uint64_t m_mapping_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_file_mapping = NULL;
+#else
+    int m_fd = -1;
+#endif
+
+    std::mutex m_mutex;
+    std::unordered_map<BlockKey, size_t, BlockKeyHash> m_slots_by_key;
+
+    // Slots holding data, most recently used first, and the position of each of them in the list
+    std::list<size_t> m_used_slots;
+    std::vector<std::optional<std::list<size_t>::iterator>> m_slot_positions;
+    std::vector<size_t> m_free_slots;
+    uint64_t m_use_count = 0;
+
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+};
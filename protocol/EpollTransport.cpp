@@ -0,0 +1,160 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifdef __linux__
+
+#include "EpollTransport.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "Exceptions.h"
+
+#include "spdlog/spdlog.h"
+
+namespace {
+
+void setNonBlocking(int s)
+{
+    int flags = fcntl(s, F_GETFL, 0);
+    if (flags == -1 || fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1) {
+        spdlog::error("Socket could not be switched to non-blocking mode: {}", strerror(errno));
+        throw ClientInitializationError();
+    }
+}
+
+int createEpollFor(int s, uint32_t events)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        spdlog::error("Epoll instance could not be created: {}", strerror(errno));
+        throw ClientInitializationError();
+    }
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = s;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &event) == -1) {
+        spdlog::error("Socket could not be added to epoll instance: {}", strerror(errno));
+        close(epoll_fd);
+        throw ClientInitializationError();
+    }
+
+    return epoll_fd;
+}
+
+bool isTransientError(int error)
+{
+    return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+} // namespace
+
+EpollTransport::EpollTransport(int connected_socket) : m_socket(connected_socket)
+{
+    try {
+        setNonBlocking(m_socket);
+        m_tx_epoll = createEpollFor(m_socket, EPOLLOUT);
+        m_rx_epoll = createEpollFor(m_socket, EPOLLIN | EPOLLRDHUP);
+    }
+    catch (...) {
+        if (m_tx_epoll != -1) {
+            close(m_tx_epoll);
+        }
+
+        close(m_socket);
+        throw;
+    }
+}
+
+EpollTransport::~EpollTransport()
+{
+    close(m_rx_epoll);
+    close(m_tx_epoll);
+    close(m_socket);
+}
+
+void EpollTransport::sendv(std::vector<std::string_view> buffers)
+{
+    std::vector<iovec> iovecs;
+
+    while (!buffers.empty()) {
+        size_t iovec_count = (std::min)(buffers.size(), static_cast<size_t>(IOV_MAX));
+
+        iovecs.clear();
+        for (size_t i = 0; i < iovec_count; i++) {
+            iovecs.push_back(iovec{const_cast<char *>(buffers[i].data()), buffers[i].size()});
+        }
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovecs.data();
+        msg.msg_iovlen = iovecs.size();
+
+        ssize_t res = sendmsg(m_socket, &msg, MSG_NOSIGNAL);
+        if (res >= 0) {
+            removeSentData(&buffers, res);
+        } else if (!isTransientError(errno) || !waitForEvents(m_tx_epoll)) {
+            spdlog::error("Send failed: {}", strerror(errno));
+            throw SendFailed();
+        }
+    }
+}
+
+size_t EpollTransport::receive(char *buffer, size_t length)
+{
+    for (;;) {
+        ssize_t res = recv(m_socket, buffer, length, 0);
+        if (res > 0) {
+            return res;
+        } else if (res == 0) {
+            spdlog::error("Server closed connection");
+            throw ConnectionClosed();
+        } else if (!isTransientError(errno) || !waitForEvents(m_rx_epoll)) {
+            spdlog::error("Reading from socket failed: {}", strerror(errno));
+            throw RecvFailed();
+        }
+    }
+}
+
+void EpollTransport::shutdown()
+{
+    ::shutdown(m_socket, SHUT_RDWR);
+}
+
+bool EpollTransport::waitForEvents(int epoll_fd)
+{
+    epoll_event event;
+
+    int res = epoll_wait(epoll_fd, &event, 1, -1);
+    return res != -1 || errno == EINTR;
+}
+
+#endif
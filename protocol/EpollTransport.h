@@ -0,0 +1,53 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#ifdef __linux__
+
+#include <vector>
+
+#include "Transport.h"
+
+// Transport over a non-blocking POSIX socket, waiting for readiness with epoll. Sending and receiving use separate
+// epoll instances, as they are done from different threads.
+class EpollTransport : public Transport
+{
+public:
+    // Takes ownership of the given connected stream socket
+    explicit EpollTransport(int connected_socket);
+    ~EpollTransport() override;
+
+    EpollTransport(const EpollTransport &) = delete;
+    EpollTransport &operator=(const EpollTransport &) = delete;
+
+    void sendv(std::vector<std::string_view> buffers) override;
+    size_t receive(char *buffer, size_t length) override;
+    void shutdown() override;
+
+private:
+    static bool waitForEvents(int epoll_fd);
+
+    int m_socket = -1;
+    int m_tx_epoll = -1;
+    int m_rx_epoll = -1;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "EventLoop.h"
+
+EventLoop::EventLoop() : m_thread(&EventLoop::run, this)
+{}
+
+EventLoop::~EventLoop()
+{
+    stop();
+}
+
+void EventLoop::post(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(handle);
+    }
+
+    m_cv.notify_one();
+}
+
+bool EventLoop::isCurrentThread() const
+{
+    return std::this_thread::get_id() == m_thread.get_id();
+}
+
+void EventLoop::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_cv.notify_one();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void EventLoop::run()
+{
+    Executor::Scope scope(this);
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;) {
+        m_cv.wait(lock, [&] { return m_stopping || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            return;
+        }
+
+        std::coroutine_handle<> handle = m_queue.front();
+        m_queue.pop_front();
+
+        lock.unlock();
+        handle.resume();
+        lock.lock();
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Executor.h"
+
+// Thread on which coroutines waiting for responses are resumed, unless a thread blocked in syncWait() is running them
+// itself. Resuming them on the thread receiving the responses instead could block it while the resumed coroutine sends
+// its next request, so it is only handed the coroutine to be resumed here. Coroutines run on the loop must therefore
+// not block for long, as they hold up each other.
+class EventLoop : public Executor
+{
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    void post(std::coroutine_handle<> handle) override;
+
+    // Tells whether the calling thread is the one running the loop
+    bool isCurrentThread() const;
+
+    // Resumes whatever is still queued and then stops the loop
+    void stop();
+
+private:
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::coroutine_handle<>> m_queue;
+    bool m_stopping = false;
+
+    std::thread m_thread;
+};
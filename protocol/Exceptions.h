@@ -136,6 +136,33 @@ public:
     }
 };
 
+class FileNotFound : public ClientException
+{
+public:
+    const char *what() const noexcept override
+    {
+        return "File Not Found";
+    }
+};
+
+class WriteFailed : public ClientException
+{
+public:
+    const char *what() const noexcept override
+    {
+        return "Write Failed";
+    }
+};
+
+class RequestTimedOut : public ClientException
+{
+public:
+    const char *what() const noexcept override
+    {
+        return "Request Timed Out";
+    }
+};
+
 class ServerRequestedAuthentication : public ClientException
 {
 public:
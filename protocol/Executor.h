@@ -0,0 +1,63 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <coroutine>
+
+// Resumes the coroutines handed to it, on a thread of its own choosing. Awaiters that suspend a coroutine hand it back
+// to the executor that was current when it was suspended (see current()), so that it keeps running where it was.
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+
+    virtual void post(std::coroutine_handle<> handle) = 0;
+
+    // Returns the executor that is running the calling thread's coroutines, or the given one if there is none
+    static Executor *currentOr(Executor *fallback)
+    {
+        return t_current ? t_current : fallback;
+    }
+
+    // Makes the given executor (possibly none) the current one of the calling thread for the lifetime of the scope
+    class Scope
+    {
+    public:
+        explicit Scope(Executor *executor) : m_previous(t_current)
+        {
+            t_current = executor;
+        }
+
+        ~Scope()
+        {
+            t_current = m_previous;
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Executor *m_previous;
+    };
+
+private:
+    static inline thread_local Executor *t_current = nullptr;
+};
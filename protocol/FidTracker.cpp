@@ -17,19 +17,69 @@
  * Copyright (C) 2020-2021 Gerasimos Dimitriadis
  *
  * SPDX-License-Identifier: GPL-3.0-or-later
- */#include "FidTracker.h"
+ */
+#include "FidTracker.h"
 
 #include <cassert>
 
-void FidTracker::setRoot(Fid fid, Qid qid)
+FidEntry::FidEntry(Fid fid, const std::string &path, Qid qid) : fid(fid), path(path), qid(qid)
+{}
+
+std::optional<OpenedFid> FidEntry::getReadFid() const
 {
-    std::vector<std::string> wnames;
-    m_root_entry.emplace(fid, wnames, qid);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_read_fid;
 }
 
-void FidTracker::addFid(Fid fid, const std::vector<std::string> &wnames, Qid qid)
+std::optional<OpenedFid> FidEntry::getWriteFid() const
 {
-    m_fid_entries.emplace_back(fid, wnames, qid);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_write_fid;
+}
+
+std::optional<OpenedFid> FidEntry::setReadFid(OpenedFid read_fid)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_read_fid) {
+        return m_read_fid;
+    }
+
+    m_read_fid = read_fid;
+    return std::nullopt;
+}
+
+std::optional<OpenedFid> FidEntry::setWriteFid(OpenedFid write_fid)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_write_fid) {
+        return m_write_fid;
+    }
+
+    m_write_fid = write_fid;
+    return std::nullopt;
+}
+
+FidTracker::FidTracker(size_t capacity, std::chrono::milliseconds time_to_live)
+    : m_capacity(capacity), m_time_to_live(time_to_live)
+{}
+
+std::string FidTracker::makePathKey(const std::vector<std::string> &path_components)
+{
+    std::string path;
+    for (const std::string &run_component : path_components) {
+        if (!path.empty()) {
+            path += '/';
+        }
+
+        path += run_component;
+    }
+
+    return path;
+}
+
+void FidTracker::setRoot(Fid fid, Qid qid)
+{
+    m_root_entry.emplace(fid, std::string(), qid);
 }
 
 const FidEntry *FidTracker::getRootEntry() const
@@ -41,13 +91,205 @@ const FidEntry *FidTracker::getRootEntry() const
     }
 }
 
-const FidEntry *FidTracker::findEntry(Fid fid) const
+// Expired entries along the path are removed on the way. The nodes left empty are only pruned once done with the
+// path; pruning the deepest of them prunes the shallower ones as well, as they are its ancestors.
+FidHandle FidTracker::findClosest(const std::vector<std::string> &path_components, size_t *depth)
+{
+    std::vector<FidHandle> expired_entries;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TrieNode *closest_node = nullptr;
+    TrieNode *deepest_expired_node = nullptr;
+    *depth = 0;
+
+    Clock::time_point now = Clock::now();
+    TrieNode *node = &m_trie_root;
+    for (size_t i = 0;; i++) {
+        if (node->cached_entry) {
+            const std::optional<Clock::time_point> &expiry = (*node->cached_entry)->expiry;
+            if (expiry && *expiry <= now) {
+                removeEntry(node, &expired_entries);
+                deepest_expired_node = node;
+            } else {
+                closest_node = node;
+                *depth = i;
+            }
+        }
+
+        if (i == path_components.size()) {
+            break;
+        }
+
+        auto it = node->children.find(path_components[i]);
+        if (it == node->children.end()) {
+            break;
+        }
+
+        node = it->second.get();
+    }
+
+    if (deepest_expired_node) {
+        pruneNode(deepest_expired_node);
+    }
+
+    if (!closest_node) {
+        return nullptr;
+    }
+
+    EntryList::iterator entry_it = *closest_node->cached_entry;
+    m_entries.splice(m_entries.begin(), m_entries, entry_it);
+    return entry_it->entry;
+}
+
+FidHandle FidTracker::add(FidHandle entry)
+{
+    // Entries are dropped only after releasing the lock, as dropping the last reference to one clunks its fids
+    std::vector<FidHandle> evicted_entries;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TrieNode *node = findNode(entry->path, true);
+    if (node->cached_entry) {
+        EntryList::iterator entry_it = *node->cached_entry;
+        m_entries.splice(m_entries.begin(), m_entries, entry_it);
+        return entry_it->entry;
+    }
+
+    std::optional<Clock::time_point> expiry;
+    if (m_time_to_live.count()) {
+        expiry = Clock::now() + m_time_to_live;
+    }
+
+    m_entries.push_front(CachedEntry{entry, node, expiry});
+    node->cached_entry = m_entries.begin();
+
+    evictExcessEntries(&evicted_entries);
+    return entry;
+}
+
+void FidTracker::remove(const FidHandle &entry)
 {
-    for (const auto &run_entry : m_fid_entries) {
-        if (run_entry.fid == fid) {
-            return &run_entry;
+    std::vector<FidHandle> removed_entries;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TrieNode *node = findNode(entry->path, false);
+    if (!node || !node->cached_entry || (*node->cached_entry)->entry != entry) {
+        return;
+    }
+
+    removeEntry(node, &removed_entries);
+    pruneNode(node);
+}
+
+void FidTracker::removeTree(const std::string &path)
+{
+    std::vector<FidHandle> removed_entries;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TrieNode *node = findNode(path, false);
+    if (!node) {
+        return;
+    }
+
+    removeTreeLocked(node, &removed_entries);
+}
+
+// The fid of a directory that has been replaced leads to the old directory, and so do the fids walked from it
+void FidTracker::validate(const std::string &path, const Qid &qid)
+{
+    std::vector<FidHandle> removed_entries;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TrieNode *node = findNode(path, false);
+    if (!node || !node->cached_entry || (*node->cached_entry)->entry->qid.path == qid.path) {
+        return;
+    }
+
+    removeTreeLocked(node, &removed_entries);
+}
+
+void FidTracker::clear()
+{
+    EntryList removed_entries;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_trie_root.children.clear();
+    m_trie_root.cached_entry.reset();
+    removed_entries.swap(m_entries);
+}
+
+// Returns the node of the path, optionally creating it (and any of its ancestors) if it does not exist yet
+FidTracker::TrieNode *FidTracker::findNode(const std::string &path, bool create)
+{
+    TrieNode *node = &m_trie_root;
+
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
         }
+
+        std::string name = path.substr(start, end - start);
+        auto it = node->children.find(name);
+        if (it == node->children.end()) {
+            if (!create) {
+                return nullptr;
+            }
+
+            auto child = std::make_unique<TrieNode>();
+            child->parent = node;
+            child->name = name;
+            it = node->children.emplace(std::move(name), std::move(child)).first;
+        }
+
+        node = it->second.get();
+        start = end + 1;
+    }
+
+    return node;
+}
+
+void FidTracker::removeEntry(TrieNode *node, std::vector<FidHandle> *removed_entries)
+{
+    EntryList::iterator entry_it = *node->cached_entry;
+    removed_entries->push_back(std::move(entry_it->entry));
+    m_entries.erase(entry_it);
+    node->cached_entry.reset();
+}
+
+void FidTracker::removeTreeEntries(TrieNode *node, std::vector<FidHandle> *removed_entries)
+{
+    if (node->cached_entry) {
+        removeEntry(node, removed_entries);
     }
 
-    return nullptr;
+    for (auto &[name, child] : node->children) {
+        removeTreeEntries(child.get(), removed_entries);
+    }
+}
+
+void FidTracker::removeTreeLocked(TrieNode *node, std::vector<FidHandle> *removed_entries)
+{
+    removeTreeEntries(node, removed_entries);
+    node->children.clear();
+    pruneNode(node);
+}
+
+// Removes the node, and then any of its ancestors, for as long as they are left with neither an entry nor children
+void FidTracker::pruneNode(TrieNode *node)
+{
+    while (node != &m_trie_root && !node->cached_entry && node->children.empty()) {
+        TrieNode *parent = node->parent;
+        parent->children.erase(parent->children.find(node->name));
+        node = parent;
+    }
+}
+
+void FidTracker::evictExcessEntries(std::vector<FidHandle> *evicted_entries)
+{
+    while (m_entries.size() > m_capacity) {
+        TrieNode *node = m_entries.back().node;
+        removeEntry(node, evicted_entries);
+        pruneNode(node);
+    }
 }
@@ -20,32 +20,130 @@
  */
 #pragma once
 
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "DataTypes.h"
 
-struct FidEntry
+// Fid cloned from a walked fid and opened
+struct OpenedFid
 {
-    FidEntry(Fid fid, const std::vector<std::string> &wnames, Qid qid) : fid(fid), wnames(wnames), qid(qid)
-    {}
-
     Fid fid;
-    std::vector<std::string> wnames;
-    Qid qid;
+    uint32_t iounit;
+};
+
+// Fid walked to the file at the given path, which is shared by all operations on that path while it is in the cache.
+// The fid itself is never opened; a file is read (or written) through a clone of it instead, which is opened on first
+// use and then kept along with it.
+class FidEntry
+{
+public:
+    FidEntry(Fid fid, const std::string &path, Qid qid);
+
+    std::optional<OpenedFid> getReadFid() const;
+    std::optional<OpenedFid> getWriteFid() const;
+
+    // Return the fid already set if there is one, in which case the given one is not kept
+    std::optional<OpenedFid> setReadFid(OpenedFid read_fid);
+    std::optional<OpenedFid> setWriteFid(OpenedFid write_fid);
+
+    const Fid fid;
+    const std::string path;
+    const Qid qid;
+
+private:
+    mutable std::mutex m_mutex;
+    std::optional<OpenedFid> m_read_fid;
+    std::optional<OpenedFid> m_write_fid;
 };
 
+// Shared ownership of a FidEntry; the fids of the entry are clunked once the last owner drops it
+using FidHandle = std::shared_ptr<FidEntry>;
+
+// Keeps the fid walked to the root of the attached file tree, and a bounded cache of the fids walked to other paths,
+// with the least recently used ones evicted first. Paths are keyed by their components joined with '/'. The cached
+// entries are arranged in a trie of path components, so that looking up a path, or the deepest of its ancestors that
+// has a cached fid, takes time proportional to the depth of the path rather than to the number of cached entries.
+//
+// A fid stays with the file it was walked to even if another file takes its place at the path (e.g. when another
+// client replaces it), so entries are dropped once they have been cached for longer than the time to live (zero keeps
+// them until evicted), or as soon as a walk or a directory listing shows a different file at their path.
 class FidTracker
 {
 public:
-    void setRoot(Fid fid, Qid qid);
-    void addFid(Fid fid, const std::vector<std::string> &wnames, Qid qid);
+    explicit FidTracker(size_t capacity, std::chrono::milliseconds time_to_live = std::chrono::milliseconds(0));
 
+    static std::string makePathKey(const std::vector<std::string> &path_components);
+
+    void setRoot(Fid fid, Qid qid);
     const FidEntry *getRootEntry() const;
-    const FidEntry *findEntry(Fid fid) const;
+
+    // Returns the cached entry of the deepest path out of the given one and its ancestors, and sets depth to the
+    // number of path components leading to it. Returns null (with depth set to zero) if none of them is cached.
+    FidHandle findClosest(const std::vector<std::string> &path_components, size_t *depth);
+
+    // Returns the entry that is cached for the path after the call, which is the one already cached if the path has
+    // been walked concurrently
+    FidHandle add(FidHandle entry);
+
+    // Removes the entry, if it is still the one cached for its path
+    void remove(const FidHandle &entry);
+
+    // Removes the entries of the path and of all the paths below it
+    void removeTree(const std::string &path);
+
+    // Removes the entries of the path and of all the paths below it if the entry cached for the path is not of the
+    // file with the given qid
+    void validate(const std::string &path, const Qid &qid);
+
+    void clear();
 
 private:
+    using Clock = std::chrono::steady_clock;
+
+    struct TrieNode;
+
+    struct CachedEntry
+    {
+        FidHandle entry;
+        TrieNode *node;
+        std::optional<Clock::time_point> expiry;
+    };
+
+    using EntryList = std::list<CachedEntry>;
+
+    struct TrieNode
+    {
+        TrieNode *parent = nullptr;
+        std::string name;
+        std::unordered_map<std::string, std::unique_ptr<TrieNode>> children;
+
+        // Position of the entry cached for the path of the node, if there is one
+        std::optional<EntryList::iterator> cached_entry;
+    };
+
+    TrieNode *findNode(const std::string &path, bool create);
+    void removeEntry(TrieNode *node, std::vector<FidHandle> *removed_entries);
+    void removeTreeEntries(TrieNode *node, std::vector<FidHandle> *removed_entries);
+    void removeTreeLocked(TrieNode *node, std::vector<FidHandle> *removed_entries);
+    void pruneNode(TrieNode *node);
+    void evictExcessEntries(std::vector<FidHandle> *evicted_entries);
+
     std::optional<FidEntry> m_root_entry;
-    std::vector<FidEntry> m_fid_entries;
-};
\ No newline at end of file
+
+    size_t m_capacity;
+    std::chrono::milliseconds m_time_to_live;
+    std::mutex m_mutex;
+
+    // Most recently used first
+    EntryList m_entries;
+
+    // Node of the root path, which is never removed
+    TrieNode m_trie_root;
+};
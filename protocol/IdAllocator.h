@@ -0,0 +1,244 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+
+#include "EventLoop.h"
+
+// Allocator of integer ids in the range [0, capacity), safe to be used from multiple threads without locking. The ids
+// in use are kept in a bitmap; an id is allocated by claiming a clear bit with a compare-and-swap, starting from a
+// different word on each allocation so that concurrent allocations rarely contend for the same word. Released ids are
+// reused. When all ids are in use, allocate() blocks until one is released, which holds back the requesting threads
+// until the server has completed some of their earlier requests.
+template <class T>
+class IdAllocator
+{
+public:
+    class AllocateAwaiter;
+
+    explicit IdAllocator(size_t capacity);
+
+    IdAllocator(const IdAllocator &) = delete;
+    IdAllocator &operator=(const IdAllocator &) = delete;
+
+    T allocate();
+
+    // Awaitable form of allocate(), which suspends the awaiting coroutine instead of blocking the thread while all ids
+    // are in use. The coroutine is resumed once an id has been released for it, by the current executor or else on
+    // the given event loop. Coroutines running on the event loop have to allocate this way, as it is on the event loop
+    // that ids are often released.
+    AllocateAwaiter allocateAsync(EventLoop *event_loop);
+
+    void release(T id);
+
+private:
+    using Word = uint64_t;
+    static constexpr size_t WORD_BITS = std::numeric_limits<Word>::digits;
+    static constexpr Word FULL_WORD = ~Word(0);
+
+    std::optional<T> tryAllocate();
+    bool addAsyncWaiter(AllocateAwaiter *waiter);
+    void handOverToAsyncWaiters();
+
+    size_t m_capacity;
+    size_t m_word_count;
+    std::unique_ptr<std::atomic<Word>[]> m_words;
+    std::atomic<size_t> m_next_word = 0;
+
+    // Incremented on every release, for allocate() to wait on when no id is available
+    std::atomic<uint32_t> m_release_count = 0;
+    std::atomic<uint32_t> m_waiter_count = 0;
+
+    // Coroutines waiting for an id, in the order they started to wait
+    std::mutex m_async_mutex;
+    std::deque<AllocateAwaiter *> m_async_waiters;
+    std::atomic<uint32_t> m_async_waiter_count = 0;
+};
+
+template <class T>
+class IdAllocator<T>::AllocateAwaiter
+{
+public:
+    AllocateAwaiter(IdAllocator *allocator, EventLoop *event_loop) : m_allocator(allocator), m_event_loop(event_loop)
+    {}
+
+    bool await_ready()
+    {
+        m_id = m_allocator->tryAllocate();
+        return m_id.has_value();
+    }
+
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+        m_awaiting = awaiting;
+        m_resumer = Executor::currentOr(m_event_loop);
+        return m_allocator->addAsyncWaiter(this);
+    }
+
+    T await_resume()
+    {
+        return *m_id;
+    }
+
+private:
+    friend class IdAllocator;
+
+    IdAllocator *m_allocator;
+    EventLoop *m_event_loop;
+    std::optional<T> m_id;
+    std::coroutine_handle<> m_awaiting;
+    Executor *m_resumer = nullptr;
+};
+
+template <class T>
+IdAllocator<T>::IdAllocator(size_t capacity)
+    : m_capacity(capacity), m_word_count((capacity + WORD_BITS - 1) / WORD_BITS),
+      m_words(new std::atomic<Word>[m_word_count])
+{
+    static_assert(std::is_integral_v<T> && std::is_unsigned_v<T>, "Id Allocator can allocate only unsigned integers");
+    assert(capacity > 0 && capacity - 1 <= (std::numeric_limits<T>::max)());
+
+    for (size_t i = 0; i < m_word_count; i++) {
+        m_words[i] = 0;
+    }
+
+    // The bits past the capacity are marked as permanently in use
+    size_t tail_bits = capacity % WORD_BITS;
+    if (tail_bits) {
+        m_words[m_word_count - 1] = FULL_WORD << tail_bits;
+    }
+}
+
+template <class T>
+T IdAllocator<T>::allocate()
+{
+    for (;;) {
+        // Sampled before looking for a free id, so that a release happening in the meantime is not missed
+        uint32_t release_count = m_release_count.load();
+
+        std::optional<T> id = tryAllocate();
+        if (id) {
+            return *id;
+        }
+
+        m_waiter_count++;
+        m_release_count.wait(release_count);
+        m_waiter_count--;
+    }
+}
+
+template <class T>
+typename IdAllocator<T>::AllocateAwaiter IdAllocator<T>::allocateAsync(EventLoop *event_loop)
+{
+    return AllocateAwaiter(this, event_loop);
+}
+
+template <class T>
+void IdAllocator<T>::release(T id)
+{
+    assert(id < m_capacity);
+
+    Word bit = Word(1) << (id % WORD_BITS);
+    [[maybe_unused]] Word previous = m_words[id / WORD_BITS].fetch_and(~bit);
+    assert(previous & bit);
+
+    m_release_count++;
+    if (m_waiter_count.load()) {
+        m_release_count.notify_all();
+    }
+
+    if (m_async_waiter_count.load()) {
+        handOverToAsyncWaiters();
+    }
+}
+
+// Returns false (i.e. the coroutine is not suspended) if an id has been released in the meantime
+template <class T>
+bool IdAllocator<T>::addAsyncWaiter(AllocateAwaiter *waiter)
+{
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+
+    // Announced before looking for a free id again, so that a release happening in the meantime is not missed
+    m_async_waiter_count++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    waiter->m_id = tryAllocate();
+    if (waiter->m_id) {
+        m_async_waiter_count--;
+        return false;
+    }
+
+    m_async_waiters.push_back(waiter);
+    return true;
+}
+
+template <class T>
+void IdAllocator<T>::handOverToAsyncWaiters()
+{
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+
+    while (!m_async_waiters.empty()) {
+        std::optional<T> id = tryAllocate();
+        if (!id) {
+            break;
+        }
+
+        AllocateAwaiter *waiter = m_async_waiters.front();
+        m_async_waiters.pop_front();
+        m_async_waiter_count--;
+
+        waiter->m_id = id;
+        waiter->m_resumer->post(waiter->m_awaiting);
+    }
+}
+
+template <class T>
+std::optional<T> IdAllocator<T>::tryAllocate()
+{
+    size_t start_word = m_next_word.fetch_add(1, std::memory_order_relaxed) % m_word_count;
+
+    for (size_t i = 0; i < m_word_count; i++) {
+        size_t word_index = (start_word + i) % m_word_count;
+        std::atomic<Word> &word = m_words[word_index];
+
+        Word value = word.load(std::memory_order_relaxed);
+        while (value != FULL_WORD) {
+            int free_bit = std::countr_one(value);
+            if (word.compare_exchange_weak(value, value | (Word(1) << free_bit), std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+                return static_cast<T>(word_index * WORD_BITS + free_bit);
+            }
+        }
+    }
+
+    return std::nullopt;
+}
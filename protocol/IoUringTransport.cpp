@@ -0,0 +1,347 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifdef __linux__
+
+#include "IoUringTransport.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "Exceptions.h"
+
+#include "spdlog/spdlog.h"
+
+namespace {
+
+constexpr unsigned QUEUE_ENTRIES = 64;
+// The length of a single receive is limited to what its completion result can report
+constexpr uint32_t MAX_RECEIVE_LENGTH = 1u << 30;
+
+// Index of the socket in the table of registered files of each ring
+constexpr int SOCKET_FILE_INDEX = 0;
+
+int sysIoUringSetup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sysIoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sysIoUringRegister(int ring_fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T *ringMember(void *ring, uint32_t offset)
+{
+    return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+} // namespace
+
+// Minimal io_uring submission / completion queue pair, used by a single thread at a time
+class IoUringQueue
+{
+public:
+    explicit IoUringQueue(unsigned entries);
+    ~IoUringQueue();
+
+    IoUringQueue(const IoUringQueue &) = delete;
+    IoUringQueue &operator=(const IoUringQueue &) = delete;
+
+    void registerFile(int fd);
+
+    io_uring_sqe *getSqe();
+    void submit(unsigned wait_nr);
+    io_uring_cqe waitCqe();
+
+private:
+    void release();
+
+    int m_ring_fd = -1;
+
+    void *m_sq_ring = MAP_FAILED;
+    size_t m_sq_ring_size = 0;
+    void *m_cq_ring = MAP_FAILED;
+    size_t m_cq_ring_size = 0;
+    io_uring_sqe *m_sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t m_sqes_size = 0;
+
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned *m_sq_array;
+    unsigned m_sq_local_tail;
+    unsigned m_to_submit = 0;
+
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe *m_cqes;
+};
+
+IoUringQueue::IoUringQueue(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    m_ring_fd = sysIoUringSetup(entries, &params);
+    if (m_ring_fd < 0) {
+        spdlog::error("io_uring could not be set up: {}", strerror(errno));
+        throw ClientInitializationError();
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+
+    m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                     IORING_OFF_SQ_RING);
+    if (single_mmap) {
+        m_cq_ring = m_sq_ring;
+    } else if (m_sq_ring != MAP_FAILED) {
+        m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                         IORING_OFF_CQ_RING);
+    }
+
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                      IORING_OFF_SQES);
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+        spdlog::error("io_uring rings could not be mapped: {}", strerror(errno));
+        release();
+        throw ClientInitializationError();
+    }
+
+    m_sq_head = ringMember<unsigned>(m_sq_ring, params.sq_off.head);
+    m_sq_tail = ringMember<unsigned>(m_sq_ring, params.sq_off.tail);
+    m_sq_mask = *ringMember<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+    m_sq_entries = *ringMember<unsigned>(m_sq_ring, params.sq_off.ring_entries);
+    m_sq_array = ringMember<unsigned>(m_sq_ring, params.sq_off.array);
+    m_sq_local_tail = *m_sq_tail;
+
+    m_cq_head = ringMember<unsigned>(m_cq_ring, params.cq_off.head);
+    m_cq_tail = ringMember<unsigned>(m_cq_ring, params.cq_off.tail);
+    m_cq_mask = *ringMember<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+    m_cqes = ringMember<io_uring_cqe>(m_cq_ring, params.cq_off.cqes);
+}
+
+IoUringQueue::~IoUringQueue()
+{
+    release();
+}
+
+void IoUringQueue::release()
+{
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqes_size);
+    }
+
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+
+    if (m_sq_ring != MAP_FAILED) {
+        munmap(m_sq_ring, m_sq_ring_size);
+    }
+
+    close(m_ring_fd);
+}
+
+void IoUringQueue::registerFile(int fd)
+{
+    int res = sysIoUringRegister(m_ring_fd, IORING_REGISTER_FILES, &fd, 1);
+    if (res < 0) {
+        spdlog::error("Socket could not be registered with io_uring: {}", strerror(errno));
+        throw ClientInitializationError();
+    }
+}
+
+// Returns a zeroed submission queue entry. Entries are handed to the kernel on the next submit().
+io_uring_sqe *IoUringQueue::getSqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sq_local_tail - head >= m_sq_entries) {
+        return nullptr;
+    }
+
+    unsigned index = m_sq_local_tail & m_sq_mask;
+    m_sq_array[index] = index;
+    m_sq_local_tail++;
+    m_to_submit++;
+
+    io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+void IoUringQueue::submit(unsigned wait_nr)
+{
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        int res = sysIoUringEnter(m_ring_fd, m_to_submit, wait_nr, flags);
+        if (res >= 0) {
+            m_to_submit -= res;
+            return;
+        } else if (errno != EINTR) {
+            spdlog::error("Submission to io_uring failed: {}", strerror(errno));
+            throw SendFailed();
+        }
+    }
+}
+
+io_uring_cqe IoUringQueue::waitCqe()
+{
+    for (;;) {
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head != tail) {
+            io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+            __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+            return cqe;
+        }
+
+        submit(1);
+    }
+}
+
+IoUringTransport::IoUringTransport(int connected_socket) : m_socket(connected_socket)
+{
+    try {
+        m_tx_queue = std::make_unique<IoUringQueue>(QUEUE_ENTRIES);
+        m_tx_queue->registerFile(m_socket);
+
+        m_rx_queue = std::make_unique<IoUringQueue>(QUEUE_ENTRIES);
+        m_rx_queue->registerFile(m_socket);
+    }
+    catch (...) {
+        close(m_socket);
+        throw;
+    }
+}
+
+IoUringTransport::~IoUringTransport()
+{
+    m_rx_queue.reset();
+    m_tx_queue.reset();
+    close(m_socket);
+}
+
+// Sends straight from the caller's buffers: a single io_uring_enter submits a SENDMSG on all of them (up to IOV_MAX
+// at a time) and waits for it, so that the messages built by the TxQueue reach the socket without being staged
+// anywhere. A send that comes back short is resubmitted for the rest of the data.
+void IoUringTransport::sendv(std::vector<std::string_view> buffers)
+{
+    std::vector<iovec> iovecs;
+
+    while (!buffers.empty()) {
+        size_t iovec_count = (std::min)(buffers.size(), static_cast<size_t>(IOV_MAX));
+
+        iovecs.clear();
+        for (size_t i = 0; i < iovec_count; i++) {
+            iovecs.push_back(iovec{const_cast<char *>(buffers[i].data()), buffers[i].size()});
+        }
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovecs.data();
+        msg.msg_iovlen = iovecs.size();
+
+        io_uring_sqe *sqe = m_tx_queue->getSqe();
+        assert(sqe);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = SOCKET_FILE_INDEX;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = reinterpret_cast<uint64_t>(&msg);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+
+        m_tx_queue->submit(1);
+        io_uring_cqe cqe = m_tx_queue->waitCqe();
+        if (cqe.res < 0 && cqe.res != -EINTR) {
+            spdlog::error("Send failed: {}", strerror(-cqe.res));
+            throw SendFailed();
+        }
+
+        if (cqe.res > 0) {
+            removeSentData(&buffers, cqe.res);
+        }
+    }
+}
+
+// Receives straight into the caller's buffer: a single io_uring_enter submits the receive and waits for it, so that
+// unlike with epoll no separate readiness wait is needed when no data is available yet, and RRead payloads that the
+// RxBuffer hands down land in their destination without being staged anywhere.
+size_t IoUringTransport::receive(char *buffer, size_t length)
+{
+    io_uring_sqe *sqe = m_rx_queue->getSqe();
+    assert(sqe);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = SOCKET_FILE_INDEX;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = static_cast<uint32_t>((std::min)(length, static_cast<size_t>(MAX_RECEIVE_LENGTH)));
+
+    m_rx_queue->submit(1);
+    io_uring_cqe cqe = m_rx_queue->waitCqe();
+
+    if (cqe.res == 0) {
+        spdlog::error("Server closed connection");
+        throw ConnectionClosed();
+    } else if (cqe.res < 0) {
+        spdlog::error("Reading from socket failed: {}", strerror(-cqe.res));
+        throw RecvFailed();
+    }
+
+    return cqe.res;
+}
+
+void IoUringTransport::shutdown()
+{
+    ::shutdown(m_socket, SHUT_RDWR);
+}
+
+#endif
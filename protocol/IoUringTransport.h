@@ -0,0 +1,57 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#ifdef __linux__
+
+#include <memory>
+#include <vector>
+
+#include "Transport.h"
+
+class IoUringQueue;
+
+// Transport over a POSIX socket driven through io_uring. Sending and receiving each have their own ring, with the
+// socket registered as a fixed file. A whole batch of outgoing data is handed to the kernel with a single
+// io_uring_enter and sent from the caller's buffers, and incoming data is received straight into the caller's buffer.
+class IoUringTransport : public Transport
+{
+public:
+    // Takes ownership of the given connected stream socket
+    explicit IoUringTransport(int connected_socket);
+    ~IoUringTransport() override;
+
+    IoUringTransport(const IoUringTransport &) = delete;
+    IoUringTransport &operator=(const IoUringTransport &) = delete;
+
+    void sendv(std::vector<std::string_view> buffers) override;
+    size_t receive(char *buffer, size_t length) override;
+    void shutdown() override;
+
+private:
+    int m_socket = -1;
+
+    std::unique_ptr<IoUringQueue> m_tx_queue;
+
+    std::unique_ptr<IoUringQueue> m_rx_queue;
+};
+
+#endif
@@ -143,6 +143,8 @@ ParsedRCreate parseRCreate(std::string_view &buffer)
 ParsedRRead parseRRead(std::string_view &buffer)
 {
     uint32_t count = parseInteger<uint32_t>(buffer);
+
+    checkForBufferOverrun(buffer, count);
     std::string_view data = extractDataView(count, buffer);
 
     return ParsedRRead(data);
@@ -209,7 +211,7 @@ ParsedRMessage parseMessage(std::string_view buffer)
     Tag tag = parseInteger<Tag>(buffer);
     ParsedRMessagePayload payload = parseMessagePayload(type, buffer);
 
-    return ParsedRMessage(tag, payload);
+    return ParsedRMessage(tag, std::move(payload));
 }
 
 MsgLength parseMessageLength(const char* buf)
@@ -218,6 +220,33 @@ MsgLength parseMessageLength(const char* buf)
     return parseInteger<MsgLength>(string_view);
 }
 
+Tag parseMessageTag(std::string_view msg)
+{
+    parseInteger<MsgLength>(msg);
+    parseInteger<MsgType>(msg);
+
+    return parseInteger<Tag>(msg);
+}
+
+MessageHeader parseMessageHeader(std::string_view msg)
+{
+    MessageHeader header;
+    header.length = parseInteger<MsgLength>(msg);
+    header.type = parseInteger<MsgType>(msg);
+    header.tag = parseInteger<Tag>(msg);
+
+    return header;
+}
+
+uint32_t parseRReadCount(std::string_view msg)
+{
+    parseInteger<MsgLength>(msg);
+    parseInteger<MsgType>(msg);
+    parseInteger<Tag>(msg);
+
+    return parseInteger<uint32_t>(msg);
+}
+
 RStat parseRawRStat(std::string_view &buffer)
 {
     RStat stat;
@@ -20,6 +20,7 @@
  */
 #pragma once
 
+#include <string>
 #include <string_view>
 #include <variant>
 #include <vector>
@@ -32,7 +33,7 @@ struct ParsedRVersion
     {}
 
     uint32_t msize;
-    std::string_view version;
+    std::string version;
 };
 
 struct ParsedRAuth
@@ -48,7 +49,7 @@ struct ParsedRError
     ParsedRError(std::string_view ename) : ename(ename)
     {}
 
-    std::string_view ename;
+    std::string ename;
 };
 
 struct ParsedRFlush
@@ -90,9 +91,14 @@ struct ParsedRCreate
 
 struct ParsedRRead
 {
-    ParsedRRead(std::string_view data) : data(data)
+    ParsedRRead(std::string_view data) : count(static_cast<uint32_t>(data.size())), data(data)
     {}
 
+    // RRead whose data has been received directly into the destination registered for the read, leaving data empty
+    explicit ParsedRRead(uint32_t count) : count(count)
+    {}
+
+    uint32_t count;
     std::string data;
 };
 
@@ -127,15 +133,28 @@ typedef std::variant<ParsedRVersion, ParsedRAuth, ParsedRError, ParsedRFlush, Pa
 
 struct ParsedRMessage
 {
-    ParsedRMessage(Tag tag, ParsedRMessagePayload payload) : tag(tag), payload(payload)
+    ParsedRMessage(Tag tag, ParsedRMessagePayload payload) : tag(tag), payload(std::move(payload))
     {}
 
     Tag tag;
     ParsedRMessagePayload payload;
 };
 
+// The parsed message does not refer to the buffer it was parsed from
 ParsedRMessage parseMessage(std::string_view msg);
 
+struct MessageHeader
+{
+    MsgLength length;
+    MsgType type;
+    Tag tag;
+};
+
 MsgLength parseMessageLength(const char *buf);
+Tag parseMessageTag(std::string_view msg);
+MessageHeader parseMessageHeader(std::string_view msg);
+
+// Parses the count of an RRead, without requiring the data that follows it to be present
+uint32_t parseRReadCount(std::string_view msg);
 
 RStat parseRawRStat(std::string_view &buffer);
\ No newline at end of file
@@ -0,0 +1,297 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "PendingRequests.h"
+
+#include <cassert>
+#include <utility>
+
+#include "EventLoop.h"
+#include "Exceptions.h"
+
+Response::Response(EventLoop *event_loop) : m_state(std::make_shared<State>())
+{
+    m_state->event_loop = event_loop;
+}
+
+ParsedRMessage Response::get()
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    m_state->cv.wait(lock, [&] { return m_state->done; });
+
+    return takeResult();
+}
+
+bool Response::await_ready() const
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->done;
+}
+
+// Returns false (i.e. the coroutine is not suspended) if the response has arrived in the meantime
+bool Response::await_suspend(std::coroutine_handle<> awaiting)
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    if (m_state->done) {
+        return false;
+    }
+
+    m_state->awaiting = awaiting;
+    m_state->resumer = Executor::currentOr(m_state->event_loop);
+    return true;
+}
+
+ParsedRMessage Response::await_resume()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    assert(m_state->done);
+
+    return takeResult();
+}
+
+void Response::complete(ParsedRMessage message)
+{
+    finish(std::move(message), nullptr);
+}
+
+void Response::fail(std::exception_ptr error)
+{
+    finish(std::nullopt, error);
+}
+
+void Response::finish(std::optional<ParsedRMessage> message, std::exception_ptr error)
+{
+    std::coroutine_handle<> awaiting;
+    Executor *resumer;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->done = true;
+        m_state->message = std::move(message);
+        m_state->error = error;
+        awaiting = m_state->awaiting;
+        resumer = m_state->resumer;
+    }
+
+    m_state->cv.notify_all();
+
+    if (awaiting) {
+        resumer->post(awaiting);
+    }
+}
+
+// Must be called while holding the mutex of the state
+ParsedRMessage Response::takeResult()
+{
+    if (m_state->error) {
+        std::rethrow_exception(m_state->error);
+    }
+
+    return std::move(*m_state->message);
+}
+
+PendingRequests::PendingRequests(EventLoop *event_loop, IdAllocator<Tag> *tag_allocator,
+                                 std::chrono::milliseconds request_timeout)
+    : m_event_loop(event_loop), m_tag_allocator(tag_allocator), m_request_timeout(request_timeout)
+{}
+
+Response PendingRequests::add(Tag tag, const RequestDetails &details)
+{
+    Response response(m_event_loop);
+
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if (details.has_deadline && m_request_timeout.count()) {
+        deadline = std::chrono::steady_clock::now() + m_request_timeout;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_failure) {
+        // The connection is already gone, no response will ever arrive for this request
+        releaseTag(tag, details);
+        response.fail(m_failure);
+        return response;
+    }
+
+    auto [it, inserted] = m_requests.emplace(tag, Request{response, details, deadline});
+    assert(inserted);
+
+    return response;
+}
+
+bool PendingRequests::remove(Tag tag)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_requests.find(tag);
+    if (it == m_requests.end()) {
+        return false;
+    }
+
+    releaseTag(tag, it->second.details);
+    m_requests.erase(it);
+    return true;
+}
+
+std::optional<ReadDestination> PendingRequests::beginReceivingReadData(Tag tag, uint32_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_requests.find(tag);
+    if (it == m_requests.end()) {
+        return std::nullopt;
+    }
+
+    Request &request = it->second;
+    if (request.expired || !request.details.read_destination || count > request.details.read_destination->length) {
+        return std::nullopt;
+    }
+
+    request.receiving = true;
+    return request.details.read_destination;
+}
+
+bool PendingRequests::complete(Tag tag, ParsedRMessage message)
+{
+    std::optional<Response> response = takeResponse(tag);
+    if (!response) {
+        return false;
+    }
+
+    response->complete(std::move(message));
+    return true;
+}
+
+bool PendingRequests::fail(Tag tag, std::exception_ptr error)
+{
+    std::optional<Response> response = takeResponse(tag);
+    if (!response) {
+        return false;
+    }
+
+    response->fail(error);
+    return true;
+}
+
+void PendingRequests::failAll(std::exception_ptr error)
+{
+    std::unordered_map<Tag, Request> failed_requests;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failure = error;
+        failed_requests.swap(m_requests);
+
+        for (auto &run_request : failed_requests) {
+            releaseTag(run_request.first, run_request.second.details);
+        }
+    }
+
+    for (auto &run_request : failed_requests) {
+        run_request.second.response.fail(error);
+    }
+}
+
+std::vector<ExpiredRequest> PendingRequests::expire(std::chrono::steady_clock::time_point now)
+{
+    std::vector<ExpiredRequest> expired_requests;
+    std::vector<Response> timed_out_responses;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto &[run_tag, run_request] : m_requests) {
+            if (run_request.expired || run_request.receiving || !run_request.deadline || *run_request.deadline > now) {
+                continue;
+            }
+
+            // The buffer of the requester may be gone once it has been told about the timeout, so any data that
+            // arrives late is not to be received into it
+            run_request.expired = true;
+            run_request.details.read_destination.reset();
+
+            Response late_response(m_event_loop);
+            timed_out_responses.push_back(std::exchange(run_request.response, late_response));
+            const RequestDetails &details = run_request.details;
+            expired_requests.push_back(
+                ExpiredRequest{run_tag, details.new_fid, details.walk_length, details.clunked_fid, late_response});
+        }
+    }
+
+    for (Response &run_response : timed_out_responses) {
+        run_response.fail(std::make_exception_ptr(RequestTimedOut()));
+    }
+
+    return expired_requests;
+}
+
+bool PendingRequests::releaseExpired(Tag tag)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_requests.find(tag);
+    if (it == m_requests.end() || !it->second.expired) {
+        return false;
+    }
+
+    bool flushed = !it->second.responded;
+    releaseTag(tag, it->second.details);
+    m_requests.erase(it);
+
+    return flushed;
+}
+
+size_t PendingRequests::count() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_requests.size();
+}
+
+// Returns the Response to be completed for the given tag, taking the request out of the table unless it has expired
+std::optional<Response> PendingRequests::takeResponse(Tag tag)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_requests.find(tag);
+    if (it == m_requests.end()) {
+        return std::nullopt;
+    }
+
+    // The tag of an expired request stays in use until the request has been flushed (see releaseExpired()), as the
+    // server may only be done with it once it has responded to the TFlush
+    Request &request = it->second;
+    if (request.expired) {
+        if (request.responded) {
+            return std::nullopt;
+        }
+
+        request.responded = true;
+        return request.response;
+    }
+
+    Response response = std::move(request.response);
+    releaseTag(tag, request.details);
+    m_requests.erase(it);
+
+    return response;
+}
+
+// TVersion is sent with NOTAG, which is not allocated
+void PendingRequests::releaseTag(Tag tag, const RequestDetails &details)
+{
+    if (tag != constant::NOTAG && details.release_tag) {
+        m_tag_allocator->release(tag);
+    }
+}
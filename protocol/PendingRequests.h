@@ -0,0 +1,178 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ConstantValues.h"
+#include "DataTypes.h"
+#include "IdAllocator.h"
+#include "MessageReader.h"
+
+class EventLoop;
+
+// Memory into which the data of an RRead is to be received directly. The ParsedRRead handed over on completion then
+// carries only the count.
+struct ReadDestination
+{
+    char *data;
+    size_t length;
+};
+
+// What the table of pending requests needs to know about a request besides its tag
+struct RequestDetails
+{
+    std::optional<ReadDestination> read_destination;
+
+    // Fid that the request associates with a file on the server (NOFID if none). The server may still carry out a
+    // request after it has been given up on, leaving the fid to be clunked.
+    Fid new_fid = constant::NOFID;
+
+    // Fid that the request clunks (NOFID if none). A TClunk that is flushed may not have been carried out, so that the
+    // fid can only be reused after clunking it again.
+    Fid clunked_fid = constant::NOFID;
+
+    // Number of path components of a TWalk. new_fid is only associated with a file if all of them were walked.
+    size_t walk_length = 0;
+
+    // Requests that are not subject to the request timeout (such as a TFlush, which must always be waited for)
+    bool has_deadline = true;
+
+    // Requests whose tag is not taken from the allocator of the table (such as a TFlush) release it themselves
+    bool release_tag = true;
+};
+
+// R-message received in response to a request (or the error that prevented it from being received or parsed), which
+// may be waited for either by blocking in get() or from a coroutine with co_await. An awaiting coroutine is resumed by
+// the executor current at the time it was suspended, or else on the given event loop.
+class Response
+{
+public:
+    Response(EventLoop *event_loop);
+
+    ParsedRMessage get();
+
+    bool await_ready() const;
+    bool await_suspend(std::coroutine_handle<> awaiting);
+    ParsedRMessage await_resume();
+
+    void complete(ParsedRMessage message);
+    void fail(std::exception_ptr error);
+
+private:
+    struct State
+    {
+        EventLoop *event_loop;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        std::optional<ParsedRMessage> message;
+        std::exception_ptr error;
+        std::coroutine_handle<> awaiting;
+        Executor *resumer = nullptr;
+    };
+
+    void finish(std::optional<ParsedRMessage> message, std::exception_ptr error);
+    ParsedRMessage takeResult();
+
+    std::shared_ptr<State> m_state;
+};
+
+// Request that has not been responded to in time. The Response handed out for it has already failed with
+// RequestTimedOut, but its tag remains in use until the server confirms with an RFlush that the request is flushed; a
+// response to the request arriving before that completes late_response instead.
+struct ExpiredRequest
+{
+    Tag tag;
+    Fid new_fid;
+    size_t walk_length;
+    Fid clunked_fid;
+    Response late_response;
+};
+
+// Table of the requests that have been sent to the server and are still waiting for a response. Each request is
+// identified by its tag; the R-message received for that tag completes the Response handed out for it. The tag of
+// a request is released to the given allocator once the request leaves the table.
+class PendingRequests
+{
+public:
+    // A request_timeout of zero means that requests never expire
+    PendingRequests(EventLoop *event_loop, IdAllocator<Tag> *tag_allocator, std::chrono::milliseconds request_timeout);
+
+    Response add(Tag tag, const RequestDetails &details = RequestDetails());
+
+    // Returns false if the request is no longer pending, i.e. it has already been completed or failed
+    bool remove(Tag tag);
+
+    // Returns where to receive the count bytes of data of the RRead with the given tag, if the request has registered
+    // a destination large enough for them. The request can no longer expire after that, as its data is being written
+    // into memory owned by the requester.
+    std::optional<ReadDestination> beginReceivingReadData(Tag tag, uint32_t count);
+
+    bool complete(Tag tag, ParsedRMessage message);
+
+    // Fails a single request, e.g. because the response to it could not be parsed
+    bool fail(Tag tag, std::exception_ptr error);
+    void failAll(std::exception_ptr error);
+
+    // Fails the requests whose deadline has passed (see ExpiredRequest), returning them so that they can be flushed
+    std::vector<ExpiredRequest> expire(std::chrono::steady_clock::time_point now);
+
+    // Drops an expired request once the server has responded to the TFlush for it, releasing its tag. Returns true if
+    // the request was flushed, i.e. no response to it arrived before the RFlush.
+    bool releaseExpired(Tag tag);
+
+    size_t count() const;
+
+private:
+    struct Request
+    {
+        Response response;
+        RequestDetails details;
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        bool receiving = false;
+        bool expired = false;
+
+        // Set once the late response to an expired request has arrived
+        bool responded = false;
+    };
+
+    std::optional<Response> takeResponse(Tag tag);
+    void releaseTag(Tag tag, const RequestDetails &details);
+
+    EventLoop *m_event_loop;
+    IdAllocator<Tag> *m_tag_allocator;
+    std::chrono::milliseconds m_request_timeout;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<Tag, Request> m_requests;
+    std::exception_ptr m_failure;
+};
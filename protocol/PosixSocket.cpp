@@ -0,0 +1,124 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef _WIN32
+
+#include "PosixSocket.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "Exceptions.h"
+
+#include "spdlog/spdlog.h"
+
+namespace {
+
+void setNoDelaySocketOption(int s)
+{
+    int no_delay = 1;
+    int res = setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    if (res == -1) {
+        spdlog::warn("Setting socket option 'TCP No Delay' failed: {}", strerror(errno));
+    }
+}
+
+} // namespace
+
+int connectPosixTcpSocket(const std::string &host, const std::string &service)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addresses = nullptr;
+    int res = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+    if (res != 0) {
+        spdlog::warn("Resolving of {}:{} failed: {}", host, service, gai_strerror(res));
+        throw ConnectionFailed();
+    }
+
+    int s = -1;
+    for (addrinfo *run_address = addresses; run_address; run_address = run_address->ai_next) {
+        s = socket(run_address->ai_family, run_address->ai_socktype | SOCK_CLOEXEC, run_address->ai_protocol);
+        if (s == -1) {
+            continue;
+        }
+
+        if (connect(s, run_address->ai_addr, run_address->ai_addrlen) == 0) {
+            break;
+        }
+
+        close(s);
+        s = -1;
+    }
+
+    freeaddrinfo(addresses);
+
+    if (s == -1) {
+        spdlog::warn("Connection to {}:{} could not be established", host, service);
+        throw ConnectionFailed();
+    }
+
+    setNoDelaySocketOption(s);
+    spdlog::debug("Successfully connected to {}:{}", host, service);
+
+    return s;
+}
+
+int connectPosixUnixSocket(const std::string &path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        spdlog::warn("Invalid unix socket path: {}", path);
+        throw ConnectionFailed();
+    }
+
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s == -1) {
+        spdlog::error("Unix socket could not be created: {}", strerror(errno));
+        throw ConnectionFailed();
+    }
+
+    if (connect(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+        spdlog::warn("Connection to unix socket {} could not be established: {}", path, strerror(errno));
+        close(s);
+        throw ConnectionFailed();
+    }
+
+    spdlog::debug("Successfully connected to unix socket {}", path);
+
+    return s;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#ifndef _WIN32
+
+#include <string>
+
+// Resolves the given host and service and returns a blocking TCP socket connected to the first address that accepts
+// the connection. Throws ConnectionFailed if no address could be connected to.
+int connectPosixTcpSocket(const std::string &host, const std::string &service);
+
+// Returns a blocking socket connected to the AF_UNIX stream socket at the given path. Throws ConnectionFailed if it
+// could not be connected to.
+int connectPosixUnixSocket(const std::string &path);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "RxBuffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "ConstantValues.h"
+#include "DataTypes.h"
+#include "Exceptions.h"
+#include "MessageReader.h"
+#include "Transport.h"
+
+#include "spdlog/spdlog.h"
+
+RxBuffer::RxBuffer(size_t capacity) : m_buffer(capacity)
+{}
+
+std::string_view RxBuffer::nextMessage(Transport *transport)
+{
+    receiveAtLeast(transport, sizeof(MsgLength));
+
+    MsgLength message_length = parseMessageLength(m_buffer.data() + m_begin);
+    if (message_length < constant::MESSAGE_HEADER_SIZE || message_length > m_buffer.size()) {
+        spdlog::error("Received message with invalid length: {}", message_length);
+        throw RecvFailed();
+    }
+
+    receiveAtLeast(transport, message_length);
+
+    std::string_view message(m_buffer.data() + m_begin, message_length);
+    m_begin += message_length;
+
+    return message;
+}
+
+std::string_view RxBuffer::peek(Transport *transport, size_t count)
+{
+    receiveAtLeast(transport, count);
+
+    return std::string_view(m_buffer.data() + m_begin, m_end - m_begin);
+}
+
+void RxBuffer::consume(size_t count)
+{
+    assert(count <= m_end - m_begin);
+    m_begin += count;
+}
+
+void RxBuffer::receiveInto(Transport *transport, char *destination, size_t count)
+{
+    size_t buffered_count = (std::min)(count, m_end - m_begin);
+    memcpy(destination, m_buffer.data() + m_begin, buffered_count);
+    m_begin += buffered_count;
+
+    for (size_t received_count = buffered_count; received_count < count;) {
+        received_count += transport->receive(destination + received_count, count - received_count);
+    }
+}
+
+// Makes sure that at least count bytes are buffered, moving any partial data to the front of the buffer first if the
+// space left after it is not enough
+void RxBuffer::receiveAtLeast(Transport *transport, size_t count)
+{
+    if (m_begin == m_end) {
+        m_begin = m_end = 0;
+    }
+
+    if (m_end - m_begin >= count) {
+        return;
+    }
+
+    if (m_buffer.size() - m_begin < count) {
+        size_t buffered_size = m_end - m_begin;
+        memmove(m_buffer.data(), m_buffer.data() + m_begin, buffered_size);
+        m_begin = 0;
+        m_end = buffered_size;
+    }
+
+    while (m_end - m_begin < count) {
+        m_end += transport->receive(m_buffer.data() + m_end, m_buffer.size() - m_end);
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class Transport;
+
+// Buffer for incoming data, which is filled from the transport in chunks as large as the free space allows. Several
+// pipelined responses are therefore typically framed out of a single receive call. The buffer must be large enough to
+// hold the largest message that may be received (i.e. at least msize bytes).
+class RxBuffer
+{
+public:
+    explicit RxBuffer(size_t capacity);
+
+    // Returns the next complete message, receiving more data from the transport if needed. The returned view points
+    // into the buffer and remains valid only until the next call.
+    std::string_view nextMessage(Transport *transport);
+
+    // Returns all the buffered data, receiving more first if less than count bytes are buffered. The returned view
+    // remains valid only until the next call.
+    std::string_view peek(Transport *transport, size_t count);
+    void consume(size_t count);
+
+    // Moves the next count bytes of the stream to the destination. Whatever is already buffered is copied, while the
+    // rest is received directly into the destination, bypassing the buffer.
+    void receiveInto(Transport *transport, char *destination, size_t count);
+
+private:
+    void receiveAtLeast(Transport *transport, size_t count);
+
+    std::vector<char> m_buffer;
+    size_t m_begin = 0;
+    size_t m_end = 0;
+};
@@ -0,0 +1,981 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "Session.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+
+#include "ConstantValues.h"
+#include "MessageTypes.h"
+
+#include "utils/TextUtilities.h"
+#include "spdlog/spdlog.h"
+
+namespace {
+
+constexpr size_t MIN_RX_BUFFER_SIZE = 256 * 1024;
+
+// Requests are checked for having expired this many times within the request timeout
+constexpr unsigned int DEADLINE_CHECKS_PER_TIMEOUT = 8;
+constexpr std::chrono::milliseconds MIN_DEADLINE_CHECK_INTERVAL(10);
+
+// The tags right below NOTAG are kept for TFlush messages. The tags of expired requests stay in use until these are
+// flushed, so that taking the tag of a TFlush from the same pool could wait forever once all of them have expired.
+constexpr Tag FLUSH_TAG_COUNT = 16;
+constexpr Tag FIRST_FLUSH_TAG = constant::NOTAG - FLUSH_TAG_COUNT;
+
+// The fid cache takes up at most this fraction of the fids of the session (each cached entry holds up to two), so
+// that walks never end up waiting for fids that only the cache holds
+constexpr uint32_t FIDS_PER_CACHED_FID = 4;
+constexpr std::string_view PROTOCOL_VERSION = "9P2000";
+
+void logErrorReceivedFor(const ParsedRMessagePayload &response_payload, const char *msg_sent)
+{
+    const ParsedRError &rerror = std::get<ParsedRError>(response_payload);
+    spdlog::error("Server responded with RError to {} sent, with ename: {}", msg_sent, rerror.ename);
+}
+
+// Tells whether the error reported by the server is that of a file not existing, going by the messages that the
+// commonly used servers report for it
+bool isNotFoundError(std::string_view ename)
+{
+    std::string lower_ename(ename);
+    std::transform(lower_ename.begin(), lower_ename.end(), lower_ename.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    for (std::string_view run_message : {"not found", "no such file", "does not exist"}) {
+        if (lower_ename.find(run_message) != std::string::npos) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+Session::Session(const ClientConfiguration &config, AttributeCache *attribute_cache)
+    : m_config(config), m_attribute_cache(attribute_cache), m_transport(createTransport(config)),
+      m_tx_message(config.msize), m_tx_msg_builder(&m_tx_message), m_max_message_size(config.msize),
+      m_tx_queue(m_transport.get(), config.tx_flush_threshold, std::chrono::microseconds(config.tx_flush_delay_us)),
+      m_tag_allocator(FIRST_FLUSH_TAG), m_flush_tag_allocator(FLUSH_TAG_COUNT),
+      m_fid_allocator(config.max_fid_count),
+      m_fid_tracker((std::min<size_t>)(config.fid_cache_size, config.max_fid_count / FIDS_PER_CACHED_FID),
+                    std::chrono::milliseconds(config.fid_cache_ttl_ms)),
+      m_pending_requests(&m_event_loop, &m_tag_allocator, std::chrono::milliseconds(config.request_timeout_ms)),
+      m_rx_buffer((std::max)(static_cast<size_t>(config.msize), MIN_RX_BUFFER_SIZE))
+{
+    startReceiving();
+    startWatchingDeadlines();
+
+    try {
+        doVersionHandshake();
+        doAuthentication();
+        doAttachment();
+    }
+    catch (...) {
+        stopWatchingDeadlines();
+        stopReceiving();
+        m_event_loop.stop();
+        m_tx_queue.stop();
+        m_fid_tracker.clear();
+        throw;
+    }
+}
+
+// Coroutines that are still waiting for responses get to run to completion (with the responses failed), before the
+// rest of the session is torn down
+Session::~Session()
+{
+    stopWatchingDeadlines();
+    stopReceiving();
+    m_event_loop.stop();
+    m_tx_queue.stop();
+    m_fid_tracker.clear();
+}
+
+// Largest amount of data that may be transferred with a single TRead / TWrite on a fid opened with the given iounit
+// (where zero means that the server imposes no limit other than msize)
+uint32_t Session::getMaxIoSize(uint32_t iounit) const
+{
+    uint32_t max_io_size = m_max_message_size - constant::IOHDRSZ;
+    if (iounit) {
+        max_io_size = (std::min)(max_io_size, iounit);
+    }
+
+    return max_io_size;
+}
+
+size_t Session::getOutstandingRequestCount() const
+{
+    return m_pending_requests.count();
+}
+
+EventLoop *Session::getEventLoop()
+{
+    return &m_event_loop;
+}
+
+void Session::startReceiving()
+{
+    m_receiver_thread = std::thread(&Session::receiveMessages, this);
+}
+
+void Session::stopReceiving()
+{
+    m_stopping = true;
+
+    // Shutting down the transport wakes up the receiver thread from the blocking receive
+    m_transport->shutdown();
+
+    if (m_receiver_thread.joinable()) {
+        m_receiver_thread.join();
+    }
+}
+
+void Session::receiveMessages()
+{
+    try {
+        for (;;) {
+            std::string_view header_data = m_rx_buffer.peek(m_transport.get(), constant::MESSAGE_HEADER_SIZE);
+            MessageHeader header = parseMessageHeader(header_data);
+
+            if (receiveReadDataDirectly(header)) {
+                continue;
+            }
+
+            // The message is parsed where it lies in the receive buffer, only the parsed fields being handed over
+            std::string_view incoming_msg = m_rx_buffer.nextMessage(m_transport.get());
+            bool pending = false;
+            try {
+                pending = m_pending_requests.complete(header.tag, parseMessage(incoming_msg));
+            }
+            catch (const ParsingException &) {
+                pending = m_pending_requests.fail(header.tag, std::current_exception());
+            }
+
+            if (!pending) {
+                spdlog::warn("Received message with tag {}, which does not match any pending request", header.tag);
+            }
+        }
+    }
+    catch (const std::exception &e) {
+        if (!m_stopping) {
+            spdlog::error("Receiving of messages stopped: {}", e.what());
+        }
+
+        m_pending_requests.failAll(std::current_exception());
+    }
+}
+
+// The data of an RRead is received straight into the destination registered by the reader, if any. Only the count
+// of the RRead is handed over as the response in that case.
+bool Session::receiveReadDataDirectly(const MessageHeader &header)
+{
+    if (header.type != msg_type::RRead) {
+        return false;
+    }
+
+    std::string_view rread_header = m_rx_buffer.peek(m_transport.get(), constant::RREAD_HEADER_SIZE);
+    uint32_t count = parseRReadCount(rread_header);
+
+    // Anything unexpected is left for the regular path, which validates the message as a whole
+    if (header.length != constant::RREAD_HEADER_SIZE + count) {
+        return false;
+    }
+
+    std::optional<ReadDestination> read_destination = m_pending_requests.beginReceivingReadData(header.tag, count);
+    if (!read_destination) {
+        return false;
+    }
+
+    m_rx_buffer.consume(constant::RREAD_HEADER_SIZE);
+    m_rx_buffer.receiveInto(m_transport.get(), read_destination->data, count);
+
+    m_pending_requests.complete(header.tag, ParsedRMessage(header.tag, ParsedRRead(count)));
+    return true;
+}
+
+void Session::startWatchingDeadlines()
+{
+    if (m_config.request_timeout_ms) {
+        m_deadline_thread = std::thread(&Session::watchDeadlines, this);
+    }
+}
+
+void Session::stopWatchingDeadlines()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_deadline_mutex);
+        m_stopping_deadlines = true;
+    }
+
+    m_deadline_cv.notify_one();
+
+    if (m_deadline_thread.joinable()) {
+        m_deadline_thread.join();
+    }
+}
+
+void Session::watchDeadlines()
+{
+    auto check_interval = (std::max)(
+        std::chrono::milliseconds(m_config.request_timeout_ms / DEADLINE_CHECKS_PER_TIMEOUT),
+        MIN_DEADLINE_CHECK_INTERVAL);
+
+    std::unique_lock<std::mutex> lock(m_deadline_mutex);
+    while (!m_deadline_cv.wait_for(lock, check_interval, [&] { return m_stopping_deadlines; })) {
+        lock.unlock();
+
+        for (ExpiredRequest &run_request : m_pending_requests.expire(std::chrono::steady_clock::now())) {
+            spdlog::warn("Request with tag {} timed out, flushing it", run_request.tag);
+            startDetached(flushExpiredRequest(std::move(run_request)));
+        }
+
+        lock.lock();
+    }
+}
+
+// The tag of an expired request is only released once the server has responded to the TFlush for it, and so is the
+// fid that the request was to associate with a file or to clunk. Should a walk have been responded to in the
+// meantime, its effects are undone as far as they concern the session, i.e. the fid is clunked if the whole path was
+// walked (it is left unassociated otherwise). A clunk that was flushed before being responded to is sent again.
+Task<void> Session::flushExpiredRequest(ExpiredRequest expired_request)
+{
+    Tag flush_tag = FIRST_FLUSH_TAG + co_await m_flush_tag_allocator.allocateAsync(&m_event_loop);
+
+    try {
+        Response pending_response = co_await sendFlushMessage(flush_tag, expired_request.tag);
+        co_await pending_response;
+    }
+    catch (const std::exception &e) {
+        m_flush_tag_allocator.release(flush_tag - FIRST_FLUSH_TAG);
+        spdlog::warn("Flushing of request with tag {} failed: {}", expired_request.tag, e.what());
+        co_return;
+    }
+
+    m_flush_tag_allocator.release(flush_tag - FIRST_FLUSH_TAG);
+
+    try {
+        bool flushed = m_pending_requests.releaseExpired(expired_request.tag);
+
+        if (expired_request.clunked_fid != constant::NOFID) {
+            if (flushed) {
+                co_await clunk(expired_request.clunked_fid);
+            } else {
+                m_fid_allocator.release(expired_request.clunked_fid);
+            }
+        }
+
+        if (expired_request.new_fid == constant::NOFID) {
+            co_return;
+        }
+
+        if (!flushed) {
+            ParsedRMessage response = expired_request.late_response.get();
+            const ParsedRWalk *rwalk = std::get_if<ParsedRWalk>(&response.payload);
+            if (rwalk && rwalk->wqids.size() == expired_request.walk_length) {
+                spdlog::debug("Clunking fid {} of walk that completed after timing out", expired_request.new_fid);
+                co_await clunk(expired_request.new_fid);
+                co_return;
+            }
+        }
+
+        m_fid_allocator.release(expired_request.new_fid);
+    }
+    catch (const std::exception &e) {
+        spdlog::warn("Releasing of fids of flushed request with tag {} failed: {}", expired_request.tag, e.what());
+    }
+}
+
+void Session::doVersionHandshake()
+{
+    ParsedRMessage response = syncWait(sendVersionMessage()).get();
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRVersion>(response_payload)) {
+        const ParsedRVersion &rversion = std::get<ParsedRVersion>(response_payload);
+
+        spdlog::debug("Received RVersion with msize: {} and version: {}", rversion.msize, rversion.version);
+
+        if (rversion.msize <= constant::IOHDRSZ) {
+            spdlog::error("Server proposed an msize too small to be usable: {}", rversion.msize);
+            throw VersionHandshakeError();
+        }
+
+        m_max_message_size = (std::min)(m_max_message_size, rversion.msize);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TVersion");
+        throw VersionHandshakeError();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TVersion");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+void Session::doAuthentication()
+{
+    ParsedRMessage response = syncWait(sendAuthMessage()).get();
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRError>(response_payload)) {
+        spdlog::info("Server doesn't support authentication");
+    } else if (std::holds_alternative<ParsedRAuth>(response_payload)) {
+        spdlog::error("Server sent unsupported authentication details");
+        throw ServerRequestedAuthentication();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TVersion");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+void Session::doAttachment()
+{
+    Fid fid = m_fid_allocator.allocate();
+
+    ParsedRMessage response = syncWait(sendAttachMessage(fid)).get();
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRAttach>(response_payload)) {
+        spdlog::debug("Server responded to TAttach with RAttach");
+        const ParsedRAttach &parsed_rattach = std::get<ParsedRAttach>(response_payload);
+        m_fid_tracker.setRoot(fid, parsed_rattach.qid);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        const ParsedRError &rerror = std::get<ParsedRError>(response_payload);
+        spdlog::error("Server responded with RError to TAttach sent, with ename: {}", rerror.ename);
+        throw UnexpectedMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TAttach");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<Response> Session::sendVersionMessage()
+{
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTVersion(m_max_message_size, PROTOCOL_VERSION);
+    co_return co_await sendMessageInTxBuffer(constant::NOTAG, std::move(lock));
+}
+
+Task<Response> Session::sendAuthMessage()
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+    Fid afid = constant::NOFID;
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTAuth(tag, afid, m_config.uname, m_config.aname);
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock));
+}
+
+Task<Response> Session::sendAttachMessage(Fid fid)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+    Fid afid = static_cast<Fid>(-1);
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTAttach(tag, fid, afid, m_config.uname, m_config.aname);
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock));
+}
+
+// Queues the message built in the tx buffer and releases the given lock on m_tx_mutex, so that other threads may queue
+// their messages while this one is flushed. The request is registered as pending before it is sent, since the response
+// may arrive at the receiver thread before the flush even returns. On the event loop, the flush is left to the thread
+// of the tx queue, and the coroutine suspended until then, rather than holding up the loop.
+Task<Response> Session::sendMessageInTxBuffer(Tag tag, std::unique_lock<std::mutex> tx_lock, RequestDetails details)
+{
+    Response response = m_pending_requests.add(tag, details);
+
+    uint64_t sequence = m_tx_queue.push(m_tx_message.getData(), m_tx_message.getTrailingData());
+    tx_lock.unlock();
+
+    std::exception_ptr failure;
+    try {
+        co_await m_tx_queue.flushAsync(sequence, &m_event_loop);
+    }
+    catch (...) {
+        failure = std::current_exception();
+    }
+
+    // If the request is no longer pending, the response has already been failed along with every other one
+    if (failure && m_pending_requests.remove(tag)) {
+        std::rethrow_exception(failure);
+    }
+
+    co_return response;
+}
+
+Task<Fid> Session::walk(std::string path)
+{
+    std::vector<std::string> path_components = splitToPathComponents(path);
+    if (m_attribute_cache->isKnownMissing(FidTracker::makePathKey(path_components))) {
+        throw FileNotFound();
+    }
+
+    size_t depth = 0;
+    FidHandle closest_entry = m_fid_tracker.findClosest(path_components, &depth);
+
+    WalkedFid walked_fid = co_await walkFromClosest(std::move(path_components), std::move(closest_entry), depth);
+    co_return walked_fid.fid;
+}
+
+// Paths longer than a single TWalk may carry are walked in steps, the first of which sets up the new fid and the rest
+// move it further along the path
+Task<WalkedFid> Session::walkFrom(Fid fid, std::vector<std::string> path_components)
+{
+    Fid new_fid = co_await m_fid_allocator.allocateAsync(&m_event_loop);
+
+    WalkedFid walked_fid{new_fid};
+    size_t walked_count = 0;
+    try {
+        do {
+            size_t step_count = (std::min)(path_components.size() - walked_count, constant::MAXWELEM);
+            auto step_begin = path_components.begin() + walked_count;
+            std::vector<std::string> step_components(step_begin, step_begin + step_count);
+
+            Fid step_fid = walked_count ? new_fid : fid;
+            std::vector<Qid> step_wqids = co_await walkStep(step_fid, new_fid, std::move(step_components));
+            walked_fid.wqids.insert(walked_fid.wqids.end(), step_wqids.begin(), step_wqids.end());
+
+            walked_count += step_count;
+        } while (walked_count < path_components.size());
+    }
+    catch (const RequestTimedOut &) {
+        // If the first step times out, the fid is released after the walk has been flushed
+        if (walked_count) {
+            clunkInBackground(new_fid);
+        }
+
+        throw;
+    }
+    catch (...) {
+        if (walked_count) {
+            clunkInBackground(new_fid);
+        } else {
+            m_fid_allocator.release(new_fid);
+        }
+
+        throw;
+    }
+
+    if (!walked_fid.wqids.empty()) {
+        walked_fid.qid = walked_fid.wqids.back();
+    }
+
+    co_return walked_fid;
+}
+
+// Walks up to MAXWELEM path components, returning the qids of the files walked to. A walk that stops short of the last
+// component (i.e. a partial RWalk) leaves new_fid as it was, and fails with FileNotFound.
+Task<std::vector<Qid>> Session::walkStep(Fid fid, Fid new_fid, std::vector<std::string> path_components)
+{
+    Response pending_response = co_await sendWalkMessage(fid, new_fid, path_components);
+    ParsedRMessage response = co_await pending_response;
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRWalk>(response_payload)) {
+        const ParsedRWalk &parsed_rwalk = std::get<ParsedRWalk>(response_payload);
+        if (parsed_rwalk.wqids.size() == path_components.size()) {
+            spdlog::debug("Server responded to TWalk with RWalk");
+            co_return parsed_rwalk.wqids;
+        }
+
+        spdlog::debug("Server walked only {} of {} path components", parsed_rwalk.wqids.size(),
+                      path_components.size());
+        throw FileNotFound();
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        // The first path component could not be walked, which most of the time is because it does not exist
+        std::string_view ename = std::get<ParsedRError>(response_payload).ename;
+        if (isNotFoundError(ename)) {
+            spdlog::debug("Server could not find the first of {} path components", path_components.size());
+            throw FileNotFound();
+        }
+
+        logErrorReceivedFor(response_payload, "TWalk");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TWalk");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<FidHandle> Session::acquireFid(std::string path)
+{
+    std::vector<std::string> path_components = splitToPathComponents(path);
+    std::string path_key = FidTracker::makePathKey(path_components);
+    if (m_attribute_cache->isKnownMissing(path_key)) {
+        throw FileNotFound();
+    }
+
+    size_t depth = 0;
+    FidHandle closest_entry = m_fid_tracker.findClosest(path_components, &depth);
+    if (closest_entry && depth == path_components.size()) {
+        co_return closest_entry;
+    }
+
+    WalkedFid walked_fid = co_await walkFromClosest(path_components, std::move(closest_entry), depth);
+    if (path_components.empty()) {
+        walked_fid.qid = m_fid_tracker.getRootEntry()->qid;
+    }
+
+    co_return m_fid_tracker.add(makeFidHandle(walked_fid, path_key));
+}
+
+// Walks to a new fid for the path, starting from the closest entry, i.e. the deepest ancestor of the path with a
+// cached fid (or from the root if there is none), so that only the path components below it need to be walked. The
+// entry is held on to until the walk has completed, so that its fid cannot be clunked in the meantime.
+Task<WalkedFid> Session::walkFromClosest(std::vector<std::string> path_components, FidHandle closest_entry,
+                                         size_t depth)
+{
+    const FidEntry *root_fid_entry = m_fid_tracker.getRootEntry();
+    Fid fid = closest_entry ? closest_entry->fid : root_fid_entry->fid;
+
+    std::vector<std::string> remaining_components(path_components.begin() + depth, path_components.end());
+    WalkedFid walked_fid{constant::NOFID};
+    try {
+        walked_fid = co_await walkFrom(fid, std::move(remaining_components));
+    }
+    catch (const FileNotFound &) {
+        // The qid of the directory the file is missing from is known only if the walk started from that directory
+        std::optional<Qid> parent_qid;
+        if (depth + 1 == path_components.size()) {
+            parent_qid = closest_entry ? closest_entry->qid : root_fid_entry->qid;
+        }
+
+        m_attribute_cache->addMissing(FidTracker::makePathKey(path_components), parent_qid);
+        throw;
+    }
+
+    validateCachedAttributes(path_components, depth, walked_fid.wqids);
+    co_return walked_fid;
+}
+
+// Checks the attributes and fids cached for the files along the path against the qids that a walk has come across,
+// the walk having started from the ancestor at the given depth
+void Session::validateCachedAttributes(const std::vector<std::string> &path_components, size_t depth,
+                                       const std::vector<Qid> &wqids)
+{
+    std::vector<std::string> walked_components(path_components.begin(), path_components.begin() + depth);
+    for (const Qid &run_wqid : wqids) {
+        walked_components.push_back(path_components[walked_components.size()]);
+        std::string path_key = FidTracker::makePathKey(walked_components);
+        m_attribute_cache->validate(path_key, run_wqid);
+        m_fid_tracker.validate(path_key, run_wqid);
+    }
+}
+
+// The fids of an entry are clunked once it has been evicted from the cache and is no longer in use
+FidHandle Session::makeFidHandle(const WalkedFid &walked_fid, const std::string &path)
+{
+    auto release_entry = [this](FidEntry *entry) {
+        std::optional<OpenedFid> read_fid = entry->getReadFid();
+        if (read_fid) {
+            clunkInBackground(read_fid->fid);
+        }
+
+        std::optional<OpenedFid> write_fid = entry->getWriteFid();
+        if (write_fid) {
+            clunkInBackground(write_fid->fid);
+        }
+
+        clunkInBackground(entry->fid);
+        delete entry;
+    };
+
+    return FidHandle(new FidEntry(walked_fid.fid, path, walked_fid.qid), release_entry);
+}
+
+Task<OpenedFid> Session::getReadFid(FidHandle entry)
+{
+    std::optional<OpenedFid> read_fid = entry->getReadFid();
+    if (read_fid) {
+        co_return *read_fid;
+    }
+
+    OpenedFid opened_fid = co_await openClone(entry, FileMode(FileMode::Access::Read));
+
+    // Another reader may have opened the file concurrently, in which case its fid is used instead
+    std::optional<OpenedFid> existing_read_fid = entry->setReadFid(opened_fid);
+    if (existing_read_fid) {
+        clunkInBackground(opened_fid.fid);
+        co_return *existing_read_fid;
+    }
+
+    co_return opened_fid;
+}
+
+Task<OpenedFid> Session::getWriteFid(FidHandle entry)
+{
+    std::optional<OpenedFid> write_fid = entry->getWriteFid();
+    if (write_fid) {
+        co_return *write_fid;
+    }
+
+    OpenedFid opened_fid = co_await openClone(entry, FileMode(FileMode::Access::Write));
+
+    std::optional<OpenedFid> existing_write_fid = entry->setWriteFid(opened_fid);
+    if (existing_write_fid) {
+        clunkInBackground(opened_fid.fid);
+        co_return *existing_write_fid;
+    }
+
+    co_return opened_fid;
+}
+
+Task<OpenedFid> Session::openClone(FidHandle entry, FileMode file_mode)
+{
+    WalkedFid cloned_fid = co_await walkFrom(entry->fid, {});
+
+    std::optional<ParsedROpen> parsed_ropen;
+    try {
+        parsed_ropen = co_await open(cloned_fid.fid, file_mode);
+    }
+    catch (...) {
+        clunkInBackground(cloned_fid.fid);
+        throw;
+    }
+
+    m_attribute_cache->validate(entry->path, parsed_ropen->qid);
+    co_return OpenedFid{cloned_fid.fid, parsed_ropen->iounit};
+}
+
+void Session::forgetFid(const FidHandle &entry)
+{
+    m_fid_tracker.remove(entry);
+}
+
+void Session::forgetPath(const std::string &path)
+{
+    m_fid_tracker.removeTree(path);
+}
+
+void Session::validateFid(const std::string &path, const Qid &qid)
+{
+    m_fid_tracker.validate(path, qid);
+}
+
+Task<Response> Session::sendWalkMessage(Fid fid, Fid new_fid, std::vector<std::string> path_components)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTWalk(tag, fid, new_fid, path_components);
+
+    // A walk moving an existing fid along does not set up a new one, which would need to be released on timeout
+    RequestDetails details;
+    if (new_fid != fid) {
+        details.new_fid = new_fid;
+        details.walk_length = path_components.size();
+    }
+
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock), details);
+}
+
+Task<ParsedROpen> Session::open(Fid fid, FileMode file_mode)
+{
+    Response pending_response = co_await sendOpenMessage(fid, file_mode);
+    ParsedRMessage response = co_await pending_response;
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedROpen>(response_payload)) {
+        spdlog::debug("Server responded to TOpen with ROpen");
+        co_return std::get<ParsedROpen>(response_payload);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TOpen");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TOpen");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<Response> Session::sendOpenMessage(Fid fid, FileMode file_mode)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    uint8_t encoded_file_mode = file_mode.encode();
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTOpen(tag, fid, encoded_file_mode);
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock));
+}
+
+Task<ParsedRStat> Session::stat(Fid fid)
+{
+    Response pending_response = co_await sendStatMessage(fid);
+    ParsedRMessage response = co_await pending_response;
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRStat>(response_payload)) {
+        spdlog::debug("Server responded to TStat with RStat");
+        co_return std::get<ParsedRStat>(response_payload);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TStat");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TStat");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<Response> Session::sendStatMessage(Fid fid)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTStat(tag, fid);
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock));
+}
+
+Task<ParsedRCreate> Session::create(Fid fid, std::string name, uint32_t perm, FileMode file_mode)
+{
+    Response pending_response = co_await sendCreateMessage(fid, name, perm, file_mode);
+    ParsedRMessage response = co_await pending_response;
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRCreate>(response_payload)) {
+        spdlog::debug("Server responded to TCreate with RCreate");
+        co_return std::get<ParsedRCreate>(response_payload);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TCreate");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TCreate");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<Response> Session::sendCreateMessage(Fid fid, std::string name, uint32_t perm, FileMode file_mode)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    uint8_t encoded_file_mode = file_mode.encode();
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTCreate(tag, fid, name, perm, encoded_file_mode);
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock));
+}
+
+Task<ParsedRWstat> Session::wstat(Fid fid, TStat stat)
+{
+    Response pending_response = co_await sendWstatMessage(fid, stat);
+    ParsedRMessage response = co_await pending_response;
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRWstat>(response_payload)) {
+        spdlog::debug("Server responded to TWstat with RWstat");
+        co_return std::get<ParsedRWstat>(response_payload);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TWstat");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TWstat");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<Response> Session::sendWstatMessage(Fid fid, TStat stat)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTWstat(tag, fid, stat);
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock));
+}
+
+Task<ParsedRRead> Session::read(Fid fid, uint64_t offset, uint32_t count)
+{
+    Response pending_response = co_await sendReadMessage(fid, offset, count);
+    ParsedRMessage response = co_await pending_response;
+
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRRead>(response_payload)) {
+        spdlog::debug("Server responded to TRead with RRead");
+        co_return std::get<ParsedRRead>(response_payload);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TRead");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TOpen");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<uint32_t> Session::readInto(Fid fid, uint64_t offset, uint32_t count, char *buffer)
+{
+    Response pending_response = co_await startReadInto(fid, offset, count, buffer);
+    ParsedRMessage response = co_await pending_response;
+    co_return completeReadInto(response, count, buffer);
+}
+
+Task<Response> Session::startReadInto(Fid fid, uint64_t offset, uint32_t count, char *buffer)
+{
+    return sendReadMessage(fid, offset, count, ReadDestination{buffer, count});
+}
+
+uint32_t Session::completeReadInto(const ParsedRMessage &response, uint32_t count, char *buffer)
+{
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRRead>(response_payload)) {
+        const ParsedRRead &parsed_rread = std::get<ParsedRRead>(response_payload);
+        if (parsed_rread.data.empty()) {
+            spdlog::debug("Server responded to TRead with RRead");
+            return parsed_rread.count;
+        }
+
+        // The server sent back more data than what was requested, so it could not be received directly
+        spdlog::warn("Server responded to TRead for {} bytes with {} bytes", count, parsed_rread.data.size());
+
+        uint32_t copied_count = static_cast<uint32_t>((std::min<size_t>)(count, parsed_rread.data.size()));
+        memcpy(buffer, parsed_rread.data.data(), copied_count);
+        return copied_count;
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TRead");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TRead");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<Response> Session::sendReadMessage(Fid fid, uint64_t offset, uint32_t count,
+                                  std::optional<ReadDestination> read_destination)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTRead(tag, fid, offset, count);
+
+    RequestDetails details;
+    details.read_destination = read_destination;
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock), details);
+}
+
+Task<uint32_t> Session::write(Fid fid, uint64_t offset, std::string_view data)
+{
+    Response pending_response = co_await sendWriteMessage(fid, offset, data);
+    ParsedRMessage response = co_await pending_response;
+    co_return completeWrite(response);
+}
+
+Task<Response> Session::startWrite(Fid fid, uint64_t offset, std::string_view data)
+{
+    return sendWriteMessage(fid, offset, data);
+}
+
+uint32_t Session::completeWrite(const ParsedRMessage &response)
+{
+    const ParsedRMessagePayload &response_payload = response.payload;
+    if (std::holds_alternative<ParsedRWrite>(response_payload)) {
+        spdlog::debug("Server responded to TWrite with RWrite");
+        return std::get<ParsedRWrite>(response_payload).count;
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        logErrorReceivedFor(response_payload, "TWrite");
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TWrite");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+Task<Response> Session::sendWriteMessage(Fid fid, uint64_t offset, std::string_view data)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTWrite(tag, fid, offset, data);
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock));
+}
+
+Task<ParsedRClunk> Session::clunk(Fid fid)
+{
+    // If the clunk times out, the fid is released after the clunk has been flushed
+    Response pending_response = co_await sendClunkMessage(fid);
+    std::optional<ParsedRMessage> response;
+    try {
+        response = co_await pending_response;
+    }
+    catch (const ParsingException &) {
+        // The fid is no longer valid after a TClunk, whether it succeeded or not
+        m_fid_allocator.release(fid);
+        throw;
+    }
+
+    m_fid_allocator.release(fid);
+
+    const ParsedRMessagePayload &response_payload = response->payload;
+    if (std::holds_alternative<ParsedRClunk>(response_payload)) {
+        spdlog::debug("Server responded to TClunk with RClunk");
+        co_return std::get<ParsedRClunk>(response_payload);
+    } else if (std::holds_alternative<ParsedRError>(response_payload)) {
+        const ParsedRError &rerror = std::get<ParsedRError>(response_payload);
+        spdlog::error("Server responded with RError to TClunk sent, with ename: {}", rerror.ename);
+        throw ErrorMessageReceived();
+    } else {
+        spdlog::error("Unexpected message received while waiting for response to TOpen");
+        throw UnexpectedMessageReceived();
+    }
+}
+
+// Nothing is sent once the session is being torn down, as the server releases all fids along with the connection
+void Session::clunkInBackground(Fid fid)
+{
+    if (m_stopping) {
+        return;
+    }
+
+    startDetached(clunkQuietly(fid));
+}
+
+Task<void> Session::clunkQuietly(Fid fid)
+{
+    try {
+        co_await clunk(fid);
+    }
+    catch (const std::exception &e) {
+        spdlog::warn("Clunking of fid {} failed: {}", fid, e.what());
+    }
+}
+
+Task<Response> Session::sendClunkMessage(Fid fid)
+{
+    Tag tag = co_await m_tag_allocator.allocateAsync(&m_event_loop);
+
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTClunk(tag, fid);
+
+    RequestDetails details;
+    details.clunked_fid = fid;
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock), details);
+}
+
+// The tag is one of the reserved flush tags, which the caller releases
+Task<Response> Session::sendFlushMessage(Tag tag, Tag old_tag)
+{
+    std::unique_lock<std::mutex> lock(m_tx_mutex);
+    m_tx_msg_builder.buildTFlush(tag, old_tag);
+
+    RequestDetails details;
+    details.has_deadline = false;
+    details.release_tag = false;
+    co_return co_await sendMessageInTxBuffer(tag, std::move(lock), details);
+}
@@ -0,0 +1,206 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AttributeCache.h"
+#include "Client.h"
+#include "EventLoop.h"
+#include "FidTracker.h"
+#include "FileMode.h"
+#include "IdAllocator.h"
+#include "MessageReader.h"
+#include "PendingRequests.h"
+#include "RxBuffer.h"
+#include "Task.h"
+#include "Transport.h"
+#include "TxMessage.h"
+#include "TxMessageBuilder.h"
+#include "TxQueue.h"
+
+using TagAllocator = IdAllocator<Tag>;
+using FidAllocator = IdAllocator<Fid>;
+
+struct WalkedFid
+{
+    Fid fid;
+
+    // Qid of the file walked to, left zeroed if no path components were walked
+    Qid qid{0, 0, 0};
+
+    // Qids of all the path components walked
+    std::vector<Qid> wqids;
+};
+
+// A single attached 9P session over its own connection. A session owns its tags and fids, so a fid obtained from one
+// session must only be used in requests sent through the same session. Attributes cached for files are checked against
+// the qids of the files seen in the responses of the session.
+class Session
+{
+public:
+    Session(const ClientConfiguration &config, AttributeCache *attribute_cache);
+    ~Session();
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    // Each request is sent once the returned task is awaited. The awaiting coroutine is resumed once the response has
+    // arrived, on the event loop of the session or, under syncWait(), on the waiting thread.
+    Task<Fid> walk(std::string path);
+
+    // Walks from the given fid to a new fid along the given path components (any number of them), or clones the fid if
+    // there are none
+    Task<WalkedFid> walkFrom(Fid fid, std::vector<std::string> path_components);
+
+    // Returns the entry for the file at the given path from the cache of walked fids, walking to the file first if it
+    // is not cached. The fid of the entry is shared, so it must not be opened or clunked; reads and writes go through
+    // the fids returned by getReadFid() / getWriteFid() instead.
+    Task<FidHandle> acquireFid(std::string path);
+    Task<OpenedFid> getReadFid(FidHandle entry);
+    Task<OpenedFid> getWriteFid(FidHandle entry);
+
+    // Drops the entry from the cache, for the path to be walked anew the next time, e.g. after a request on its fid
+    // failed
+    void forgetFid(const FidHandle &entry);
+
+    // Drops the entries of the path (keyed as in FidTracker) and of the paths below it, e.g. after the file at the
+    // path has been replaced. validateFid() only does so if the entry for the path is not of the file with the qid.
+    void forgetPath(const std::string &path);
+    void validateFid(const std::string &path, const Qid &qid);
+
+    Task<ParsedROpen> open(Fid fid, FileMode file_mode);
+    Task<ParsedRCreate> create(Fid fid, std::string name, uint32_t perm, FileMode file_mode);
+    Task<ParsedRStat> stat(Fid fid);
+    Task<ParsedRWstat> wstat(Fid fid, TStat stat);
+    Task<ParsedRRead> read(Fid fid, uint64_t offset, uint32_t count);
+
+    // Reads into the given buffer, which must be at least count bytes long, and returns the number of bytes read. The
+    // data is received straight into the buffer rather than being copied out of the response.
+    Task<uint32_t> readInto(Fid fid, uint64_t offset, uint32_t count, char *buffer);
+
+    // Split form of readInto(), which sends the request once awaited, so that several reads may be in flight at once.
+    // The buffer must remain valid until the returned response has completed.
+    Task<Response> startReadInto(Fid fid, uint64_t offset, uint32_t count, char *buffer);
+    uint32_t completeReadInto(const ParsedRMessage &response, uint32_t count, char *buffer);
+
+    // Writes at most one message worth of data (see getMaxIoSize()), returning the number of bytes the server wrote.
+    // The data must remain valid until the returned task has completed.
+    Task<uint32_t> write(Fid fid, uint64_t offset, std::string_view data);
+
+    // Split form of write(), which sends the request once awaited, so that several writes may be in flight at once.
+    // The data must remain valid until the returned response has completed.
+    Task<Response> startWrite(Fid fid, uint64_t offset, std::string_view data);
+    uint32_t completeWrite(const ParsedRMessage &response);
+
+    Task<ParsedRClunk> clunk(Fid fid);
+
+    // Clunks the fid without waiting for the outcome
+    void clunkInBackground(Fid fid);
+
+    uint32_t getMaxIoSize(uint32_t iounit) const;
+    size_t getOutstandingRequestCount() const;
+
+    // Loop that the responses of the session complete on, which resumes the coroutines waiting outside of syncWait()
+    EventLoop *getEventLoop();
+
+private:
+    void doVersionHandshake();
+    void doAuthentication();
+    void doAttachment();
+
+    // Each message is sent once the returned task is awaited, which (like the tags, when all of them are in use) is
+    // waited for without blocking the event loop
+    Task<Response> sendVersionMessage();
+    Task<Response> sendAuthMessage();
+    Task<Response> sendAttachMessage(Fid fid);
+    Task<Response> sendWalkMessage(Fid fid, Fid new_fid, std::vector<std::string> path_components);
+    Task<Response> sendOpenMessage(Fid fid, FileMode file_mode);
+    Task<Response> sendCreateMessage(Fid fid, std::string name, uint32_t perm, FileMode file_mode);
+    Task<Response> sendStatMessage(Fid fid);
+    Task<Response> sendWstatMessage(Fid fid, TStat stat);
+    Task<Response> sendReadMessage(Fid fid, uint64_t offset, uint32_t count,
+                                   std::optional<ReadDestination> read_destination = std::nullopt);
+    Task<Response> sendWriteMessage(Fid fid, uint64_t offset, std::string_view data);
+    Task<Response> sendClunkMessage(Fid fid);
+    Task<Response> sendFlushMessage(Tag tag, Tag old_tag);
+
+    Task<Response> sendMessageInTxBuffer(Tag tag, std::unique_lock<std::mutex> tx_lock,
+                                         RequestDetails details = RequestDetails());
+
+    void startReceiving();
+    void stopReceiving();
+    void receiveMessages();
+    bool receiveReadDataDirectly(const MessageHeader &header);
+
+    void startWatchingDeadlines();
+    void stopWatchingDeadlines();
+    void watchDeadlines();
+    Task<void> flushExpiredRequest(ExpiredRequest expired_request);
+
+    Task<std::vector<Qid>> walkStep(Fid fid, Fid new_fid, std::vector<std::string> path_components);
+    Task<WalkedFid> walkFromClosest(std::vector<std::string> path_components, FidHandle closest_entry, size_t depth);
+    void validateCachedAttributes(const std::vector<std::string> &path_components, size_t depth,
+                                  const std::vector<Qid> &wqids);
+    Task<OpenedFid> openClone(FidHandle entry, FileMode file_mode);
+    FidHandle makeFidHandle(const WalkedFid &walked_fid, const std::string &path);
+    Task<void> clunkQuietly(Fid fid);
+
+    ClientConfiguration m_config;
+    AttributeCache *m_attribute_cache;
+    std::unique_ptr<Transport> m_transport;
+
+    // Guards the transmission buffer, which is shared by all threads sending requests
+    std::mutex m_tx_mutex;
+    TxMessage m_tx_message;
+    TxMessageBuilder m_tx_msg_builder;
+    uint32_t m_max_message_size;
+
+    // Stopped explicitly on destruction, after the event loop, as the coroutines still run there may send requests
+    TxQueue m_tx_queue;
+
+    TagAllocator m_tag_allocator;
+    TagAllocator m_flush_tag_allocator;
+    FidAllocator m_fid_allocator;
+
+    // Cleared explicitly on destruction, while the session can still tell that it is being torn down
+    FidTracker m_fid_tracker;
+
+    // Stopped explicitly on destruction, before any of the members used by the coroutines it runs is destroyed
+    EventLoop m_event_loop;
+
+    PendingRequests m_pending_requests;
+    RxBuffer m_rx_buffer;
+    std::thread m_receiver_thread;
+    std::atomic<bool> m_stopping = false;
+
+    // Periodically expires the requests that have been waiting for too long, if a request timeout is configured
+    std::thread m_deadline_thread;
+    std::mutex m_deadline_mutex;
+    std::condition_variable m_deadline_cv;
+    bool m_stopping_deadlines = false;
+};
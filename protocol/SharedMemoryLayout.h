@@ -0,0 +1,70 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Layout of the shared mapping through which the client and a co-located server exchange 9P messages. The mapping is
+// created by the server and starts with a SharedMemoryHeader, followed by the data of the ring towards the server and
+// then by the data of the ring towards the client, ring_size bytes each.
+//
+// Each ring is a single producer / single consumer byte stream. Positions only ever grow; the offset into the data is
+// the position modulo ring_size, which must be a power of two. A side that finds nothing to do announces that it is
+// going to sleep through the waiting flag, and is woken up by the other side bumping the matching sequence word (which
+// doubles as the futex word on Linux, while named events are used on Windows).
+
+namespace shared_memory {
+
+constexpr uint32_t MAGIC = 0x50395348; // "HS9P"
+constexpr uint32_t VERSION = 1;
+
+} // namespace shared_memory
+
+struct SharedMemoryRing
+{
+    alignas(64) std::atomic<uint64_t> write_pos;
+    std::atomic<uint32_t> closed; // Set by the producer, once it will write no more
+
+    alignas(64) std::atomic<uint64_t> read_pos;
+
+    alignas(64) std::atomic<uint32_t> data_seq;
+    std::atomic<uint32_t> consumer_waiting;
+
+    alignas(64) std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> producer_waiting;
+};
+
+struct SharedMemoryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+
+    // Only one client may be attached at a time, as the rings have a single producer / consumer on each side
+    std::atomic<uint32_t> client_attached;
+
+    SharedMemoryRing to_server;
+    SharedMemoryRing to_client;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "Atomics shared between processes must be lock free");
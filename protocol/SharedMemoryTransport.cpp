@@ -0,0 +1,365 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "SharedMemoryTransport.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "Exceptions.h"
+
+#include "utils/TextUtilities.h"
+#include "spdlog/spdlog.h"
+
+namespace {
+
+// Requests are typically answered within microseconds by a co-located server, so it pays off to poll the ring for a
+// while before going to sleep
+constexpr int SPIN_COUNT = 1000;
+
+#ifdef _WIN32
+
+enum EventIndex
+{
+    TO_SERVER_DATA_EVENT,
+    TO_SERVER_SPACE_EVENT,
+    TO_CLIENT_DATA_EVENT,
+    TO_CLIENT_SPACE_EVENT,
+    EVENT_COUNT
+};
+
+const char *EVENT_SUFFIXES[EVENT_COUNT] = {".ToServer.Data", ".ToServer.Space", ".ToClient.Data", ".ToClient.Space"};
+
+#else
+
+void futexWait(std::atomic<uint32_t> *word, uint32_t expected_value)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected_value, nullptr, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+#endif
+
+void copyToRing(char *ring_data, uint64_t ring_mask, uint64_t pos, const char *src, size_t count)
+{
+    size_t offset = static_cast<size_t>(pos & ring_mask);
+    size_t first_part = (std::min)(count, static_cast<size_t>(ring_mask + 1 - offset));
+
+    memcpy(ring_data + offset, src, first_part);
+    memcpy(ring_data, src + first_part, count - first_part);
+}
+
+void copyFromRing(const char *ring_data, uint64_t ring_mask, uint64_t pos, char *dest, size_t count)
+{
+    size_t offset = static_cast<size_t>(pos & ring_mask);
+    size_t first_part = (std::min)(count, static_cast<size_t>(ring_mask + 1 - offset));
+
+    memcpy(dest, ring_data + offset, first_part);
+    memcpy(dest + first_part, ring_data, count - first_part);
+}
+
+} // namespace
+
+SharedMemoryTransport::SharedMemoryTransport(const std::string &name)
+{
+    mapSharedMemory(name);
+
+    try {
+        validateHeader();
+    }
+    catch (...) {
+        unmapSharedMemory();
+        throw;
+    }
+
+    uint32_t attached = 0;
+    if (!m_header->client_attached.compare_exchange_strong(attached, 1)) {
+        spdlog::warn("Shared memory {} is already in use by another client / session", name);
+        unmapSharedMemory();
+        throw ConnectionFailed();
+    }
+
+    char *ring_data = reinterpret_cast<char *>(m_header + 1);
+    m_tx_ring = &m_header->to_server;
+    m_tx_data = ring_data;
+    m_rx_ring = &m_header->to_client;
+    m_rx_data = ring_data + m_header->ring_size;
+    m_ring_mask = m_header->ring_size - 1;
+
+    m_tx_data_wakeup.seq = &m_tx_ring->data_seq;
+    m_tx_data_wakeup.waiting = &m_tx_ring->consumer_waiting;
+    m_tx_space_wakeup.seq = &m_tx_ring->space_seq;
+    m_tx_space_wakeup.waiting = &m_tx_ring->producer_waiting;
+    m_rx_data_wakeup.seq = &m_rx_ring->data_seq;
+    m_rx_data_wakeup.waiting = &m_rx_ring->consumer_waiting;
+    m_rx_space_wakeup.seq = &m_rx_ring->space_seq;
+    m_rx_space_wakeup.waiting = &m_rx_ring->producer_waiting;
+#ifdef _WIN32
+    m_tx_data_wakeup.event = m_events[TO_SERVER_DATA_EVENT];
+    m_tx_space_wakeup.event = m_events[TO_SERVER_SPACE_EVENT];
+    m_rx_data_wakeup.event = m_events[TO_CLIENT_DATA_EVENT];
+    m_rx_space_wakeup.event = m_events[TO_CLIENT_SPACE_EVENT];
+#endif
+
+    spdlog::debug("Attached to shared memory {} with rings of {} bytes", name, m_header->ring_size);
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+    m_tx_ring->closed = 1;
+    wake(m_tx_data_wakeup, true);
+
+    m_header->client_attached = 0;
+    unmapSharedMemory();
+}
+
+#ifdef _WIN32
+
+void SharedMemoryTransport::mapSharedMemory(const std::string &name)
+{
+    m_mapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, convertUtf8ToWstring(name).c_str());
+    if (m_mapping == NULL) {
+        spdlog::warn("Shared memory {} could not be opened. Error status: {}", name, GetLastError());
+        throw ConnectionFailed();
+    }
+
+    m_header = static_cast<SharedMemoryHeader *>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+
+    MEMORY_BASIC_INFORMATION memory_info;
+    if (m_header == NULL || VirtualQuery(m_header, &memory_info, sizeof(memory_info)) == 0) {
+        spdlog::warn("Shared memory {} could not be mapped. Error status: {}", name, GetLastError());
+        unmapSharedMemory();
+        throw ConnectionFailed();
+    }
+
+    m_mapping_size = memory_info.RegionSize;
+
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        std::string event_name = name + EVENT_SUFFIXES[i];
+        m_events[i] = OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, convertUtf8ToWstring(event_name).c_str());
+        if (m_events[i] == NULL) {
+            spdlog::warn("Event {} could not be opened. Error status: {}", event_name, GetLastError());
+            unmapSharedMemory();
+            throw ConnectionFailed();
+        }
+    }
+}
+
+void SharedMemoryTransport::unmapSharedMemory()
+{
+    for (HANDLE &run_event : m_events) {
+        if (run_event != NULL) {
+            CloseHandle(run_event);
+            run_event = NULL;
+        }
+    }
+
+    if (m_header) {
+        UnmapViewOfFile(m_header);
+        m_header = nullptr;
+    }
+
+    if (m_mapping != NULL) {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+}
+
+#else
+
+void SharedMemoryTransport::mapSharedMemory(const std::string &name)
+{
+    std::string shm_name = name;
+    if (shm_name.empty() || shm_name[0] != '/') {
+        shm_name.insert(0, "/");
+    }
+
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        spdlog::warn("Shared memory {} could not be opened: {}", shm_name, strerror(errno));
+        throw ConnectionFailed();
+    }
+
+    struct stat shm_stat;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &shm_stat) == 0 && shm_stat.st_size > 0) {
+        m_mapping_size = static_cast<size_t>(shm_stat.st_size);
+        mapping = mmap(nullptr, m_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        spdlog::warn("Shared memory {} could not be mapped: {}", shm_name, strerror(errno));
+        throw ConnectionFailed();
+    }
+
+    m_header = static_cast<SharedMemoryHeader *>(mapping);
+}
+
+void SharedMemoryTransport::unmapSharedMemory()
+{
+    if (m_header) {
+        munmap(m_header, m_mapping_size);
+        m_header = nullptr;
+    }
+}
+
+#endif
+
+void SharedMemoryTransport::validateHeader()
+{
+    if (m_mapping_size < sizeof(SharedMemoryHeader) || m_header->magic != shared_memory::MAGIC ||
+        m_header->version != shared_memory::VERSION) {
+        spdlog::warn("Shared memory does not have the expected layout");
+        throw ConnectionFailed();
+    }
+
+    uint32_t ring_size = m_header->ring_size;
+    bool is_power_of_two = ring_size && (ring_size & (ring_size - 1)) == 0;
+    if (!is_power_of_two || m_mapping_size < sizeof(SharedMemoryHeader) + 2 * static_cast<size_t>(ring_size)) {
+        spdlog::warn("Shared memory has invalid ring size: {}", ring_size);
+        throw ConnectionFailed();
+    }
+}
+
+void SharedMemoryTransport::sendv(std::vector<std::string_view> buffers)
+{
+    uint64_t ring_size = m_ring_mask + 1;
+    uint64_t write_pos = m_tx_ring->write_pos.load(std::memory_order_relaxed);
+
+    for (std::string_view run_buffer : buffers) {
+        while (!run_buffer.empty()) {
+            uint64_t free_space = 0;
+            waitUntil(m_tx_space_wakeup, [&] {
+                free_space = ring_size - (write_pos - m_tx_ring->read_pos.load());
+                return free_space > 0 || m_shutdown || m_rx_ring->closed;
+            });
+
+            if (m_shutdown || m_rx_ring->closed) {
+                spdlog::error("Send failed, shared memory transport has been closed");
+                throw SendFailed();
+            }
+
+            size_t count = static_cast<size_t>((std::min<uint64_t>)(run_buffer.size(), free_space));
+            copyToRing(m_tx_data, m_ring_mask, write_pos, run_buffer.data(), count);
+            run_buffer.remove_prefix(count);
+            write_pos += count;
+
+            m_tx_ring->write_pos.store(write_pos);
+            wake(m_tx_data_wakeup);
+        }
+    }
+}
+
+size_t SharedMemoryTransport::receive(char *buffer, size_t length)
+{
+    uint64_t read_pos = m_rx_ring->read_pos.load(std::memory_order_relaxed);
+
+    uint64_t available = 0;
+    waitUntil(m_rx_data_wakeup, [&] {
+        available = m_rx_ring->write_pos.load() - read_pos;
+        return available > 0 || m_shutdown || m_rx_ring->closed;
+    });
+
+    if (m_shutdown) {
+        throw ConnectionClosed();
+    } else if (available == 0) {
+        spdlog::error("Server closed connection");
+        throw ConnectionClosed();
+    }
+
+    size_t count = static_cast<size_t>((std::min<uint64_t>)(length, available));
+    copyFromRing(m_rx_data, m_ring_mask, read_pos, buffer, count);
+
+    m_rx_ring->read_pos.store(read_pos + count);
+    wake(m_rx_space_wakeup);
+
+    return count;
+}
+
+void SharedMemoryTransport::shutdown()
+{
+    m_shutdown = true;
+
+    // Both of the waits that this side may be blocked in are woken up, regardless of their waiting flag
+    wake(m_rx_data_wakeup, true);
+    wake(m_tx_space_wakeup, true);
+}
+
+// The waiting flag is raised before the condition is checked for the last time, while the other side updates the ring
+// before checking the flag; with both being sequentially consistent, at least one of the sides sees the other's
+// update, so a wakeup cannot be lost
+template <typename Condition>
+void SharedMemoryTransport::waitUntil(const Wakeup &wakeup, Condition condition)
+{
+    for (int i = 0; i < SPIN_COUNT; i++) {
+        if (condition()) {
+            return;
+        }
+    }
+
+    for (;;) {
+        uint32_t seq = wakeup.seq->load();
+        wakeup.waiting->store(1);
+
+        if (condition()) {
+            wakeup.waiting->store(0);
+            return;
+        }
+
+#ifdef _WIN32
+        WaitForSingleObject(wakeup.event, INFINITE);
+#else
+        futexWait(wakeup.seq, seq);
+#endif
+        wakeup.waiting->store(0);
+    }
+}
+
+void SharedMemoryTransport::wake(const Wakeup &wakeup, bool force)
+{
+    if (!force && !wakeup.waiting->load()) {
+        return;
+    }
+
+    wakeup.seq->fetch_add(1);
+
+#ifdef _WIN32
+    SetEvent(wakeup.event);
+#else
+    futexWake(wakeup.seq);
+#endif
+}
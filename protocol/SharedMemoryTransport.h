@@ -0,0 +1,89 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "SharedMemoryLayout.h"
+#include "Transport.h"
+
+// Transport over a pair of rings in a shared mapping created by a server running on the same host (see
+// SharedMemoryLayout.h). Messages are copied straight into / out of the rings, without any system call unless one of
+// the sides has to wait for the other.
+class SharedMemoryTransport : public Transport
+{
+public:
+    explicit SharedMemoryTransport(const std::string &name);
+    ~SharedMemoryTransport() override;
+
+    SharedMemoryTransport(const SharedMemoryTransport &) = delete;
+    SharedMemoryTransport &operator=(const SharedMemoryTransport &) = delete;
+
+    void sendv(std::vector<std::string_view> buffers) override;
+    size_t receive(char *buffer, size_t length) override;
+    void shutdown() override;
+
+private:
+    // Everything needed in order to sleep until / wake up the other side from a change in one of the rings
+    struct Wakeup
+    {
+        std::atomic<uint32_t> *seq;
+        std::atomic<uint32_t> *waiting;
+#ifdef _WIN32
+        HANDLE event;
+#endif
+    };
+
+    void mapSharedMemory(const std::string &name);
+    void unmapSharedMemory();
+    void validateHeader();
+
+    template <typename Condition>
+    void waitUntil(const Wakeup &wakeup, Condition condition);
+    static void wake(const Wakeup &wakeup, bool force = false);
+
+    SharedMemoryHeader *m_header = nullptr;
+    size_t m_mapping_size = 0;
+#ifdef _WIN32
+    HANDLE m_mapping = NULL;
+    HANDLE m_events[4] = {NULL, NULL, NULL, NULL};
+#endif
+
+    SharedMemoryRing *m_tx_ring = nullptr;
+    char *m_tx_data = nullptr;
+    SharedMemoryRing *m_rx_ring = nullptr;
+    char *m_rx_data = nullptr;
+    uint64_t m_ring_mask = 0;
+
+    Wakeup m_tx_data_wakeup;
+    Wakeup m_tx_space_wakeup;
+    Wakeup m_rx_data_wakeup;
+    Wakeup m_rx_space_wakeup;
+
+    std::atomic<bool> m_shutdown = false;
+};
@@ -0,0 +1,338 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "Executor.h"
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+class TaskPromiseBase
+{
+public:
+    // Once the coroutine completes, whoever awaited it is resumed right away (symmetric transfer)
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            return handle.promise().m_continuation;
+        }
+
+        void await_resume() noexcept
+        {}
+    };
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        m_error = std::current_exception();
+    }
+
+    void setContinuation(std::coroutine_handle<> continuation)
+    {
+        m_continuation = continuation;
+    }
+
+    void rethrowIfFailed()
+    {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+private:
+    std::coroutine_handle<> m_continuation = std::noop_coroutine();
+    std::exception_ptr m_error;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object();
+
+    void return_value(T value)
+    {
+        m_value.emplace(std::move(value));
+    }
+
+    T takeValue()
+    {
+        rethrowIfFailed();
+        return std::move(*m_value);
+    }
+
+private:
+    std::optional<T> m_value;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object();
+
+    void return_void()
+    {}
+
+    void takeValue()
+    {
+        rethrowIfFailed();
+    }
+};
+
+// Coroutine that starts right away and cleans up after itself, used for waiting on a task from synchronous code
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object()
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {}
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+} // namespace detail
+
+// Lazily started coroutine producing a value of type T. The coroutine starts running when the task is awaited, and
+// whoever awaits it is resumed once it completes, with its value or exception.
+template <typename T>
+class Task
+{
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+    {}
+
+    Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr))
+    {}
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other) {
+            destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~Task()
+    {
+        destroy();
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().setContinuation(awaiting);
+        return m_handle;
+    }
+
+    T await_resume()
+    {
+        return m_handle.promise().takeValue();
+    }
+
+private:
+    void destroy()
+    {
+        if (m_handle) {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <typename T>
+Task<T> detail::TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+namespace detail {
+
+// Runs the coroutines of a task waited for by syncWait() on the waiting thread itself, instead of on the event loop of
+// the session, so that synchronous callers do not have to take turns on the single thread of the loop
+class SyncWaitExecutor : public Executor
+{
+public:
+    void post(std::coroutine_handle<> handle) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(handle);
+        m_cv.notify_one();
+    }
+
+    // Notifying while holding the lock makes sure that the waiting thread cannot return (and destroy the executor)
+    // before the caller is done with it
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+        m_cv.notify_one();
+    }
+
+    // Resumes the coroutines posted until finish() is called
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        for (;;) {
+            m_cv.wait(lock, [&] { return m_done || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;
+            }
+
+            std::coroutine_handle<> handle = m_queue.front();
+            m_queue.pop_front();
+
+            lock.unlock();
+            {
+                Executor::Scope scope(this);
+                handle.resume();
+            }
+            lock.lock();
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::coroutine_handle<>> m_queue;
+    bool m_done = false;
+};
+
+} // namespace detail
+
+// Runs the task and blocks the calling thread until it completes, returning its value or throwing its exception. The
+// task runs on the calling thread throughout, including whenever it is resumed after waiting for a response.
+template <typename T>
+T syncWait(Task<T> task)
+{
+    detail::SyncWaitExecutor executor;
+    std::exception_ptr error;
+    std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+
+    // The task is passed as a parameter rather than captured, as GCC attempts to copy a captured task when awaiting it
+    auto run = [&](Task<T> &awaited_task) -> detail::DetachedTask {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await awaited_task;
+                value.emplace(true);
+            } else {
+                T result = co_await awaited_task;
+                value.emplace(std::move(result));
+            }
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        executor.finish();
+    };
+
+    {
+        Executor::Scope scope(&executor);
+        run(task);
+    }
+
+    executor.run();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    if constexpr (!std::is_void_v<T>) {
+        return std::move(*value);
+    }
+}
+
+// Starts running the task without waiting for it to complete. The task must handle any error itself, as there is no
+// one to report it to. As it may outlive whoever started it, it is resumed on the event loops rather than by the
+// current executor.
+inline void startDetached(Task<void> task)
+{
+    Executor::Scope scope(nullptr);
+    [](Task<void> detached_task) -> detail::DetachedTask {
+        co_await detached_task;
+    }(std::move(task));
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "Transport.h"
+
+#include "Client.h"
+#include "SharedMemoryTransport.h"
+
+#ifdef _WIN32
+#include "WinsockTransport.h"
+#else
+#include "EpollTransport.h"
+#include "IoUringTransport.h"
+#include "PosixSocket.h"
+#endif
+
+#include "spdlog/spdlog.h"
+
+void removeSentData(std::vector<std::string_view> *buffers, size_t count)
+{
+    auto it = buffers->begin();
+    while (it != buffers->end() && count >= it->size()) {
+        count -= it->size();
+        ++it;
+    }
+
+    it = buffers->erase(buffers->begin(), it);
+    if (it != buffers->end()) {
+        it->remove_prefix(count);
+    }
+}
+
+std::unique_ptr<Transport> createTransport(const ClientConfiguration &config)
+{
+    if (!config.shared_memory_name.empty()) {
+        return std::make_unique<SharedMemoryTransport>(config.shared_memory_name);
+    }
+
+#ifdef _WIN32
+    if (config.transport_backend != TransportBackend::Default) {
+        spdlog::warn("Requested transport backend is not available, falling back to Winsock");
+    }
+
+    if (!config.unix_socket_path.empty()) {
+        return std::make_unique<WinsockTransport>(config.unix_socket_path);
+    }
+
+    return std::make_unique<WinsockTransport>(config.host, config.service);
+#else
+    int s = -1;
+    if (!config.unix_socket_path.empty()) {
+        s = connectPosixUnixSocket(config.unix_socket_path);
+    } else {
+        s = connectPosixTcpSocket(config.host, config.service);
+    }
+
+    if (config.transport_backend == TransportBackend::IoUring) {
+        return std::make_unique<IoUringTransport>(s);
+    } else {
+        return std::make_unique<EpollTransport>(s);
+    }
+#endif
+}
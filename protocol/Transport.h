@@ -0,0 +1,57 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+struct ClientConfiguration;
+
+// Reliable, ordered byte stream towards the server over which 9P messages are exchanged. A transport is used by at
+// most one sending and one receiving thread at a time; shutdown() may be called from any thread in order to wake up a
+// receiver blocked in receive().
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    // Sends all the given buffers in order with as few system calls as possible (gather write), throws SendFailed on
+    // error
+    virtual void sendv(std::vector<std::string_view> buffers) = 0;
+
+    void send(std::string_view data)
+    {
+        sendv({data});
+    }
+
+    // Receives at least one and at most length bytes. Throws ConnectionClosed when the server has closed the
+    // connection (or after shutdown) and RecvFailed on error.
+    virtual size_t receive(char *buffer, size_t length) = 0;
+
+    virtual void shutdown() = 0;
+};
+
+// Drops the first count bytes from the given buffers, used after a partial gather write
+void removeSentData(std::vector<std::string_view> *buffers, size_t count);
+
+std::unique_ptr<Transport> createTransport(const ClientConfiguration &config);
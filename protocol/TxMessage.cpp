@@ -86,6 +86,9 @@ void TxMessage::writeInteger(T value)
 void TxMessage::writeRawData(const std::string_view &data)
 {
     size_t data_len = data.length();
+    if (!hasRoomFor(data_len)) {
+        return;
+    }
 
     memcpy(m_cursor, data.data(), data_len);
     m_cursor += data_len;
@@ -94,7 +97,7 @@ void TxMessage::writeRawData(const std::string_view &data)
 void TxMessage::writeString(const std::string_view &str)
 {
     size_t str_size = str.size();
-    if (!hasRoomFor(str_size) || str_size > std::numeric_limits<uint16_t>::max()) {
+    if (!hasRoomFor(sizeof(uint16_t) + str_size) || str_size > std::numeric_limits<uint16_t>::max()) {
         return;
     }
 
@@ -103,22 +106,36 @@ void TxMessage::writeString(const std::string_view &str)
     writeRawData(str);
 }
 
+void TxMessage::setTrailingData(std::string_view data)
+{
+    assert(static_cast<size_t>(m_buffer_end - m_cursor) >= data.size());
+    m_trailing_data = data;
+}
+
+std::string_view TxMessage::getTrailingData() const
+{
+    return m_trailing_data;
+}
+
+// Room left in the buffer, which the trailing data is taken out of too
 bool TxMessage::hasRoomFor(size_t num_bytes) const
 {
-    return m_buffer + num_bytes <= m_buffer_end;
+    return num_bytes <= static_cast<size_t>(m_buffer_end - m_cursor) - m_trailing_data.size();
 }
 
 std::string_view TxMessage::getData() const
 {
-    MsgLength size = static_cast<MsgLength>(m_cursor - m_buffer);
+    size_t data_size = m_cursor - m_buffer;
+    MsgLength size = static_cast<MsgLength>(data_size + m_trailing_data.size());
     writeLowEndianInteger<MsgLength>(size, m_buffer);
 
-    return std::string_view(m_buffer, size);
+    return std::string_view(m_buffer, data_size);
 }
 
 void TxMessage::resetCursor()
 {
     m_cursor = m_buffer + sizeof(MsgLength);
+    m_trailing_data = std::string_view();
 }
 
 // Explicit template instantiation of writeInteger method for different integer types
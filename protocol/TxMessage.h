@@ -43,6 +43,12 @@ public:
     void writeRawData(const std::string_view &data);
     void writeString(const std::string_view &str);
 
+    // Data that makes up the rest of the message without being copied into it, such as the payload of a TWrite. It is
+    // counted in the size of the message, but has to be sent separately right after getData() (see TxQueue::push())
+    // and must remain valid until then. It must fit into the capacity of the message along with what precedes it.
+    void setTrailingData(std::string_view data);
+    std::string_view getTrailingData() const;
+
     bool hasRoomFor(size_t num_bytes) const;
 
     std::string_view getData() const;
@@ -54,4 +60,5 @@ private:
     char *m_buffer_end;
 
     char *m_cursor;
+    std::string_view m_trailing_data;
 };
@@ -143,7 +143,8 @@ void TxMessageBuilder::buildTWrite(Tag tag, Fid fid, uint64_t offset, const std:
     uint32_t count = static_cast<uint32_t>(data.length());
     m_tx_message->writeInteger(count);
 
-    m_tx_message->writeRawData(data);
+    // The data is sent straight from the caller's buffer
+    m_tx_message->setTrailingData(data);
 }
 
 void TxMessageBuilder::buildTClunk(Tag tag, Fid fid)
@@ -177,6 +178,10 @@ void TxMessageBuilder::buildTWstat(Tag tag, Fid fid, const TStat &stat)
     m_tx_message->writeInteger(tag);
     m_tx_message->writeInteger(fid);
 
+    // The stat is preceded by its size as a whole, on top of the size field that it starts with
+    uint16_t stat_size = static_cast<uint16_t>(sizeof(uint16_t) + getEncodedStatSize(stat));
+    m_tx_message->writeInteger(stat_size);
+
     writeStat(stat);
 }
 
@@ -0,0 +1,212 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "TxQueue.h"
+
+#include "Transport.h"
+
+TxQueue::TxQueue(Transport *transport, size_t flush_threshold, std::chrono::microseconds max_delay)
+    : m_transport(transport), m_flush_threshold(flush_threshold), m_max_delay(max_delay),
+      m_thread(&TxQueue::sendForAsyncWaiters, this)
+{}
+
+TxQueue::~TxQueue()
+{
+    stop();
+}
+
+uint64_t TxQueue::push(std::string_view message, std::string_view trailing_data)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_batch_buffer.append(message);
+    if (!trailing_data.empty()) {
+        m_batch_trailing_data.push_back(TrailingData{m_batch_buffer.size(), trailing_data});
+    }
+
+    m_pending_size += message.size() + trailing_data.size();
+
+    if (m_pending_size >= m_flush_threshold) {
+        m_cv.notify_all();
+    }
+
+    return ++m_pushed_count;
+}
+
+void TxQueue::flush(uint64_t sequence)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_cv.wait(lock, [&] { return m_failure || m_flushed_count >= sequence || !m_flushing; });
+    if (m_failure) {
+        std::rethrow_exception(m_failure);
+    }
+
+    if (m_flushed_count >= sequence) {
+        return;
+    }
+
+    sendBatch(lock);
+
+    if (m_failure) {
+        std::rethrow_exception(m_failure);
+    }
+}
+
+TxQueue::FlushAwaiter TxQueue::flushAsync(uint64_t sequence, EventLoop *event_loop)
+{
+    return FlushAwaiter(this, sequence, event_loop);
+}
+
+void TxQueue::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_cv.notify_all();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+// Returns true (i.e. the coroutine is not suspended) once the message has been flushed by the awaiting thread itself,
+// which is fine for any thread but the event loop
+bool TxQueue::flushOffLoop(FlushAwaiter *waiter)
+{
+    if (waiter->m_event_loop->isCurrentThread()) {
+        return false;
+    }
+
+    try {
+        flush(waiter->m_sequence);
+    }
+    catch (...) {
+        waiter->m_failure = std::current_exception();
+    }
+
+    return true;
+}
+
+// Returns false (i.e. the coroutine is not suspended) if the message has been written, or writing it has failed, in
+// the meantime
+bool TxQueue::addAsyncWaiter(FlushAwaiter *waiter)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_failure || m_flushed_count >= waiter->m_sequence) {
+        waiter->m_failure = m_failure;
+        return false;
+    }
+
+    m_async_waiters.push_back(waiter);
+    m_cv.notify_all();
+    return true;
+}
+
+// Sends everything queued up to now in a single batch, becoming the flusher for its duration. Must be called with the
+// lock held, and while there is no other flusher.
+void TxQueue::sendBatch(std::unique_lock<std::mutex> &lock)
+{
+    m_flushing = true;
+
+    if (m_max_delay.count() > 0) {
+        m_cv.wait_for(lock, m_max_delay, [&] { return m_pending_size >= m_flush_threshold; });
+    }
+
+    // The buffers of the batch sent last become the ones that the next batch is built in
+    m_sending_buffer.clear();
+    m_sending_buffer.swap(m_batch_buffer);
+    m_sending_trailing_data.clear();
+    m_sending_trailing_data.swap(m_batch_trailing_data);
+    m_pending_size = 0;
+    uint64_t batch_end = m_pushed_count;
+
+    lock.unlock();
+
+    // Consecutive messages without trailing data go out as a single buffer
+    std::string_view batch_data = m_sending_buffer;
+    std::vector<std::string_view> buffers;
+    size_t sent_offset = 0;
+    for (const TrailingData &run_trailing_data : m_sending_trailing_data) {
+        if (run_trailing_data.offset > sent_offset) {
+            buffers.push_back(batch_data.substr(sent_offset, run_trailing_data.offset - sent_offset));
+        }
+
+        buffers.push_back(run_trailing_data.data);
+        sent_offset = run_trailing_data.offset;
+    }
+
+    if (sent_offset < batch_data.size()) {
+        buffers.push_back(batch_data.substr(sent_offset));
+    }
+
+    std::exception_ptr failure;
+    try {
+        m_transport->sendv(std::move(buffers));
+    }
+    catch (...) {
+        failure = std::current_exception();
+    }
+
+    lock.lock();
+
+    // After a failed write the stream may end in the middle of a message, so nothing can be sent over it any more
+    m_failure = failure;
+    m_flushed_count = batch_end;
+    m_flushing = false;
+    m_cv.notify_all();
+
+    resumeAsyncWaiters();
+}
+
+// Hands the coroutines whose message has been written (or can no longer be) back to their event loops. Must be called
+// with the lock held.
+void TxQueue::resumeAsyncWaiters()
+{
+    std::vector<FlushAwaiter *> remaining_waiters;
+    for (FlushAwaiter *run_waiter : m_async_waiters) {
+        if (m_failure || m_flushed_count >= run_waiter->m_sequence) {
+            run_waiter->m_failure = m_failure;
+            run_waiter->m_event_loop->post(run_waiter->m_awaiting);
+        } else {
+            remaining_waiters.push_back(run_waiter);
+        }
+    }
+
+    m_async_waiters.swap(remaining_waiters);
+}
+
+// Runs on the thread of the queue, becoming the flusher whenever coroutines are waiting and no one else is flushing
+void TxQueue::sendForAsyncWaiters()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;) {
+        m_cv.wait(lock, [&] { return m_stopping || (!m_flushing && !m_async_waiters.empty()); });
+        if (m_stopping) {
+            return;
+        }
+
+        sendBatch(lock);
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "EventLoop.h"
+
+class Transport;
+
+// Queue of outgoing messages, which are written to the transport in batches with a single gather write. Any thread
+// that has queued a message calls flush() for it; the first one to do so becomes the flusher and sends everything
+// queued up to that point, while the rest wait for their message to go out with its batch. Messages queued while a
+// batch is being sent form the next batch.
+//
+// The flusher may additionally wait for up to max_delay for more messages to be queued, unless flush_threshold bytes
+// are already pending. Since the batching is done here, the transport should have Nagle's algorithm disabled
+// (TCP_NODELAY), so that a flushed batch is not delayed further by the network stack.
+//
+// Coroutines running on an event loop wait with flushAsync() instead, which leaves sending to a thread of the queue's
+// own, as the loop must not be held up by waiting for the flusher or for the transport.
+class TxQueue
+{
+public:
+    class FlushAwaiter;
+
+    TxQueue(Transport *transport, size_t flush_threshold, std::chrono::microseconds max_delay);
+    ~TxQueue();
+
+    TxQueue(const TxQueue &) = delete;
+    TxQueue &operator=(const TxQueue &) = delete;
+
+    // Returns a sequence number to be passed to flush(). The message is appended to the batch being built, except for
+    // its trailing data (see TxMessage::setTrailingData()), which is sent from where it is and so must remain valid
+    // until flush() returns.
+    uint64_t push(std::string_view message, std::string_view trailing_data = std::string_view());
+
+    // Returns once the message with the given sequence number has been written to the transport. Throws SendFailed
+    // (then and for every subsequent call) if writing to the transport failed.
+    void flush(uint64_t sequence);
+
+    // Awaitable form of flush(). On the given event loop, the awaiting coroutine is suspended until its message has
+    // been written by the thread of the queue, and then resumed on the loop; elsewhere it flushes just like flush().
+    FlushAwaiter flushAsync(uint64_t sequence, EventLoop *event_loop);
+
+    // Stops the thread of the queue, after which coroutines still waiting for their message are never resumed
+    void stop();
+
+private:
+    // Data to be sent from where it is, after the first offset bytes of the batch buffer
+    struct TrailingData
+    {
+        size_t offset;
+        std::string_view data;
+    };
+
+    bool flushOffLoop(FlushAwaiter *waiter);
+    bool addAsyncWaiter(FlushAwaiter *waiter);
+    void sendBatch(std::unique_lock<std::mutex> &lock);
+    void resumeAsyncWaiters();
+    void sendForAsyncWaiters();
+
+    Transport *m_transport;
+    const size_t m_flush_threshold;
+    const std::chrono::microseconds m_max_delay;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // The batch being built, whose messages are stored back to back in a single buffer. The flusher swaps it with the
+    // batch it last sent, so that both buffers are reused rather than allocated for every message.
+    std::string m_batch_buffer;
+    std::vector<TrailingData> m_batch_trailing_data;
+    std::string m_sending_buffer;
+    std::vector<TrailingData> m_sending_trailing_data;
+    size_t m_pending_size = 0;
+    uint64_t m_pushed_count = 0;
+    uint64_t m_flushed_count = 0;
+    bool m_flushing = false;
+    std::exception_ptr m_failure;
+
+    // Coroutines waiting for their message to be written, which the thread of the queue sends batches for
+    std::vector<FlushAwaiter *> m_async_waiters;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+class TxQueue::FlushAwaiter
+{
+public:
+    FlushAwaiter(TxQueue *queue, uint64_t sequence, EventLoop *event_loop)
+        : m_queue(queue), m_sequence(sequence), m_event_loop(event_loop)
+    {}
+
+    bool await_ready()
+    {
+        return m_queue->flushOffLoop(this);
+    }
+
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+        m_awaiting = awaiting;
+        return m_queue->addAsyncWaiter(this);
+    }
+
+    void await_resume()
+    {
+        if (m_failure) {
+            std::rethrow_exception(m_failure);
+        }
+    }
+
+private:
+    friend class TxQueue;
+
+    TxQueue *m_queue;
+    uint64_t m_sequence;
+    EventLoop *m_event_loop;
+    std::exception_ptr m_failure;
+    std::coroutine_handle<> m_awaiting;
+};
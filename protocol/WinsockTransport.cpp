@@ -0,0 +1,281 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifdef _WIN32
+
+#include "WinsockTransport.h"
+
+#include <Ws2ipdef.h>
+#include <MSWSock.h>
+#include <winternl.h>
+#include <ip2string.h>
+#include <afunix.h>
+
+#include "Exceptions.h"
+
+#include "utils/TextUtilities.h"
+
+#include "spdlog/spdlog.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Ntdll.lib")
+
+namespace {
+
+SOCKET createSocket(int address_family)
+{
+    SOCKET s = socket(address_family, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) {
+        spdlog::error("Socket could not be created. Error status: {}", WSAGetLastError());
+        throw ClientInitializationError();
+    }
+
+    return s;
+}
+
+void unsetIPv6OnlySocketOption(SOCKET s)
+{
+    int ipv6_only = 0;
+    int res = setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&ipv6_only, sizeof(ipv6_only));
+    if (res == SOCKET_ERROR) {
+        spdlog::error("Disable 'IPv6 Only' socket option failed. Error status: {}", WSAGetLastError());
+        throw ClientInitializationError();
+    }
+
+    spdlog::trace("Socket option 'IPv6 Only' successfully disabled");
+}
+
+// Outgoing messages are already batched by the session, so they should go out as soon as they are handed to the socket
+void setNoDelaySocketOption(SOCKET s)
+{
+    BOOL no_delay = TRUE;
+    int res = setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&no_delay, sizeof(no_delay));
+    if (res == SOCKET_ERROR) {
+        spdlog::warn("Setting of TCP_NODELAY socket option failed. Error status: {}", WSAGetLastError());
+    }
+}
+
+void updateConnectContextSocketOption(SOCKET s)
+{
+    int res = setsockopt(s, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0);
+    if (res == SOCKET_ERROR) {
+        spdlog::warn("Update connect context failed. Error stats: {}", WSAGetLastError());
+        throw ConnectionFailed();
+    }
+
+    spdlog::trace("Connect context successfully updated");
+}
+
+std::string printSockAddrIn(const SOCKADDR_IN &sockaddr_in)
+{
+    const IN_ADDR *in_addr = &sockaddr_in.sin_addr;
+    USHORT port = sockaddr_in.sin_port;
+
+    char buffer[INET_ADDRSTRLEN + 6] = {0};
+    ULONG addr_str_len = sizeof(buffer);
+
+    NTSTATUS res = RtlIpv4AddressToStringExA(in_addr, port, buffer, &addr_str_len);
+
+    if (res == 0) {
+        return std::string(buffer);
+    } else {
+        spdlog::warn("Conversion of IPv4 address/port to string failed");
+        return std::string("<conversion failed>");
+    }
+}
+
+std::string printSockAddrIn6(const SOCKADDR_IN6 &sockaddr_in)
+{
+    const IN6_ADDR *in_addr = &sockaddr_in.sin6_addr;
+    ULONG scope_id = sockaddr_in.sin6_scope_id;
+    USHORT port = sockaddr_in.sin6_port;
+
+    char buffer[INET6_ADDRSTRLEN + 8] = {0};
+    ULONG addr_str_len = sizeof(buffer);
+
+    NTSTATUS res = RtlIpv6AddressToStringExA(in_addr, scope_id, port, buffer, &addr_str_len);
+
+    if (res == 0) {
+        return std::string(buffer);
+    } else {
+        spdlog::warn("Conversion of IPv6 address/port to string failed");
+        return std::string("<conversion failed>");
+    }
+}
+
+std::string printAddr(const SOCKADDR_STORAGE &sock_addr_storage)
+{
+    const SOCKADDR &sock_addr = reinterpret_cast<const SOCKADDR &>(sock_addr_storage);
+    ADDRESS_FAMILY sa_family = sock_addr.sa_family;
+    if (sa_family == AF_INET) {
+        const SOCKADDR_IN &sockaddr_in = reinterpret_cast<const SOCKADDR_IN &>(sock_addr);
+        return printSockAddrIn(sockaddr_in);
+    } else if (sa_family == AF_INET6) {
+        const SOCKADDR_IN6 &sockaddr_in6 = reinterpret_cast<const SOCKADDR_IN6 &>(sock_addr);
+        return printSockAddrIn6(sockaddr_in6);
+    } else {
+        spdlog::warn("Cannot print address, unsupported address family ({})", sa_family);
+        return "<Unsupported address family>";
+    }
+}
+
+void validateRecvResult(int res)
+{
+    if (res == 0) {
+        spdlog::error("Server closed connection");
+        throw ConnectionClosed();
+    } else if (res == SOCKET_ERROR) {
+        spdlog::error("Reading from socket failed. Error status: {}", WSAGetLastError());
+        throw RecvFailed();
+    }
+}
+
+} // namespace
+
+WinsockInitializer::WinsockInitializer()
+{
+    WSADATA wsaData;
+    int res = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (res) {
+        spdlog::error("Winsock initialization failed");
+        throw WinsockInitializationFailed();
+    }
+}
+
+WinsockInitializer::~WinsockInitializer()
+{
+    spdlog::trace("Shutting down Winsock");
+    WSACleanup();
+}
+
+WinsockTransport::WinsockTransport(const std::string &host, const std::string &service)
+    : m_socket(createSocket(AF_INET6))
+{
+    try {
+        connectToServer(host, service);
+    }
+    catch (...) {
+        closesocket(m_socket);
+        throw;
+    }
+}
+
+WinsockTransport::WinsockTransport(const std::string &unix_socket_path) : m_socket(createSocket(AF_UNIX))
+{
+    try {
+        connectToUnixSocket(unix_socket_path);
+    }
+    catch (...) {
+        closesocket(m_socket);
+        throw;
+    }
+}
+
+WinsockTransport::~WinsockTransport()
+{
+    if (m_socket != INVALID_SOCKET) {
+        closesocket(m_socket);
+    }
+}
+
+void WinsockTransport::connectToServer(const std::string &host, const std::string &service)
+{
+    unsetIPv6OnlySocketOption(m_socket);
+
+    SOCKADDR_STORAGE local_addr = {0};
+    DWORD local_addr_len = sizeof(local_addr);
+
+    SOCKADDR_STORAGE remote_addr = {0};
+    DWORD remote_addr_len = sizeof(remote_addr);
+
+    // WSAConnectByNameW takes non-const strings, even though it does not modify them
+    std::wstring host_buf = convertUtf8ToWstring(host);
+    std::wstring service_buf = convertUtf8ToWstring(service);
+    bool res = WSAConnectByNameW(m_socket, host_buf.data(), service_buf.data(), &local_addr_len,
+                                 (SOCKADDR *)&local_addr, &remote_addr_len, (SOCKADDR *)&remote_addr, NULL, NULL);
+
+    if (!res) {
+        spdlog::warn("Connection could not be established. Error status: {}", WSAGetLastError());
+        throw ConnectionFailed();
+    }
+
+    spdlog::debug("Successfully connected to port {}", printAddr(remote_addr));
+
+    updateConnectContextSocketOption(m_socket);
+    setNoDelaySocketOption(m_socket);
+}
+
+void WinsockTransport::connectToUnixSocket(const std::string &unix_socket_path)
+{
+    SOCKADDR_UN addr = {0};
+    addr.sun_family = AF_UNIX;
+
+    if (unix_socket_path.empty() || unix_socket_path.size() >= sizeof(addr.sun_path)) {
+        spdlog::warn("Invalid unix socket path: {}", unix_socket_path);
+        throw ConnectionFailed();
+    }
+
+    memcpy(addr.sun_path, unix_socket_path.data(), unix_socket_path.size());
+
+    int res = connect(m_socket, (SOCKADDR *)&addr, sizeof(addr));
+    if (res == SOCKET_ERROR) {
+        spdlog::warn("Connection to unix socket {} could not be established. Error status: {}", unix_socket_path,
+                     WSAGetLastError());
+        throw ConnectionFailed();
+    }
+
+    spdlog::debug("Successfully connected to unix socket {}", unix_socket_path);
+}
+
+void WinsockTransport::sendv(std::vector<std::string_view> buffers)
+{
+    std::vector<WSABUF> wsabufs;
+
+    while (!buffers.empty()) {
+        wsabufs.clear();
+        for (std::string_view run_buffer : buffers) {
+            wsabufs.push_back(WSABUF{static_cast<ULONG>(run_buffer.size()), const_cast<char *>(run_buffer.data())});
+        }
+
+        DWORD sent_count = 0;
+        int res = WSASend(m_socket, wsabufs.data(), static_cast<DWORD>(wsabufs.size()), &sent_count, 0, NULL, NULL);
+        if (res == SOCKET_ERROR) {
+            spdlog::error("Send failed. Error status: {}", WSAGetLastError());
+            throw SendFailed();
+        }
+
+        removeSentData(&buffers, sent_count);
+    }
+}
+
+size_t WinsockTransport::receive(char *buffer, size_t length)
+{
+    int res = recv(m_socket, buffer, static_cast<int>(length), 0);
+    validateRecvResult(res);
+
+    return res;
+}
+
+void WinsockTransport::shutdown()
+{
+    ::shutdown(m_socket, SD_BOTH);
+}
+
+#endif
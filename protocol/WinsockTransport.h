@@ -0,0 +1,66 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+
+#include <string>
+#include <vector>
+
+#include "Transport.h"
+
+class WinsockInitializer
+{
+public:
+    WinsockInitializer();
+    ~WinsockInitializer();
+};
+
+class WinsockTransport : public Transport
+{
+public:
+    // Connects over TCP to the given host and service
+    WinsockTransport(const std::string &host, const std::string &service);
+
+    // Connects to the AF_UNIX stream socket at the given path (supported since Windows 10 1803)
+    explicit WinsockTransport(const std::string &unix_socket_path);
+    ~WinsockTransport() override;
+
+    WinsockTransport(const WinsockTransport &) = delete;
+    WinsockTransport &operator=(const WinsockTransport &) = delete;
+
+    void sendv(std::vector<std::string_view> buffers) override;
+    size_t receive(char *buffer, size_t length) override;
+    void shutdown() override;
+
+private:
+    void connectToServer(const std::string &host, const std::string &service);
+    void connectToUnixSocket(const std::string &unix_socket_path);
+
+    WinsockInitializer m_winsock_initializer;
+    SOCKET m_socket = INVALID_SOCKET;
+};
+
+#endif
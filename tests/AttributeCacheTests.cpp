@@ -0,0 +1,185 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/AttributeCache.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+RStat makeRStat(const std::string &name, uint64_t qid_path, uint32_t qid_vers = 0, uint64_t length = 0)
+{
+    RStat rstat;
+    rstat.qid = Qid(0, qid_vers, qid_path);
+    rstat.name = name;
+    rstat.length = length;
+    return rstat;
+}
+
+} // namespace
+
+TEST(AttributeCache, ReturnsCachedAttributes)
+{
+    AttributeCache cache(1min, 8, 8, 1min, 8);
+    EXPECT_FALSE(cache.find("a"));
+
+    cache.add("a", makeRStat("a", 1, 0, 42));
+    std::optional<RStat> rstat = cache.find("a");
+    ASSERT_TRUE(rstat);
+    EXPECT_EQ(rstat->length, 42u);
+
+    AttributeCacheStatistics statistics = cache.getStatistics();
+    EXPECT_EQ(statistics.hits, 1u);
+    EXPECT_EQ(statistics.misses, 1u);
+}
+
+TEST(AttributeCache, ZeroTimeToLiveDisablesCache)
+{
+    AttributeCache cache(0ms, 8, 8, 0ms, 8);
+    cache.add("a", makeRStat("a", 1));
+    cache.addListing("", Qid(0x80, 0, 0), {makeRStat("a", 1)});
+    cache.addMissing("b", std::nullopt);
+
+    EXPECT_FALSE(cache.find("a"));
+    EXPECT_FALSE(cache.findListing(""));
+    EXPECT_FALSE(cache.isKnownMissing("b"));
+}
+
+TEST(AttributeCache, EntriesExpire)
+{
+    AttributeCache cache(20ms, 8, 8, 20ms, 8);
+    cache.add("a", makeRStat("a", 1));
+    cache.addMissing("b", std::nullopt);
+
+    std::this_thread::sleep_for(40ms);
+    EXPECT_FALSE(cache.find("a"));
+    EXPECT_FALSE(cache.isKnownMissing("b"));
+}
+
+TEST(AttributeCache, EvictsLeastRecentlyUsedAttributes)
+{
+    AttributeCache cache(1min, 2, 8, 1min, 8);
+    cache.add("a", makeRStat("a", 1));
+    cache.add("b", makeRStat("b", 2));
+    cache.find("a");
+    cache.add("c", makeRStat("c", 3));
+
+    EXPECT_TRUE(cache.find("a"));
+    EXPECT_FALSE(cache.find("b"));
+    EXPECT_TRUE(cache.find("c"));
+}
+
+TEST(AttributeCache, ListingCachesAttributesOfItsFiles)
+{
+    AttributeCache cache(1min, 8, 8, 1min, 8);
+    cache.addListing("dir", Qid(0x80, 1, 10), {makeRStat("x", 11), makeRStat("y", 12)});
+
+    std::optional<std::vector<RStat>> listing = cache.findListing("dir");
+    ASSERT_TRUE(listing);
+    EXPECT_EQ(listing->size(), 2u);
+
+    std::optional<RStat> rstat = cache.find("dir/y");
+    ASSERT_TRUE(rstat);
+    EXPECT_EQ(rstat->qid.path, 12u);
+}
+
+TEST(AttributeCache, ValidateDropsEntriesOfChangedFile)
+{
+    AttributeCache cache(1min, 8, 8, 1min, 8);
+    cache.add("a", makeRStat("a", 1, 3));
+    cache.addListing("dir", Qid(0x80, 1, 10), {});
+
+    cache.validate("a", Qid(0, 3, 1));
+    cache.validate("dir", Qid(0x80, 1, 10));
+    EXPECT_TRUE(cache.find("a"));
+    EXPECT_TRUE(cache.findListing("dir"));
+
+    // A different version, or a different file at the same path
+    cache.validate("a", Qid(0, 4, 1));
+    cache.validate("dir", Qid(0x80, 1, 20));
+    EXPECT_FALSE(cache.find("a"));
+    EXPECT_FALSE(cache.findListing("dir"));
+}
+
+TEST(AttributeCache, MissingPathIsForgottenWhenParentChanges)
+{
+    AttributeCache cache(1min, 8, 8, 1min, 8);
+    cache.addMissing("dir/x", Qid(0x80, 1, 10));
+    cache.addMissing("dir/y", std::nullopt);
+
+    // Only the path found missing with the directory at an unknown version is forgotten on seeing the same version
+    cache.validate("dir", Qid(0x80, 1, 10));
+    EXPECT_TRUE(cache.isKnownMissing("dir/x"));
+    EXPECT_FALSE(cache.isKnownMissing("dir/y"));
+
+    cache.validate("dir", Qid(0x80, 2, 10));
+    EXPECT_FALSE(cache.isKnownMissing("dir/x"));
+}
+
+TEST(AttributeCache, AddingAttributesClearsMissingPath)
+{
+    AttributeCache cache(1min, 8, 8, 1min, 8);
+    cache.addMissing("a", std::nullopt);
+    EXPECT_TRUE(cache.isKnownMissing("a"));
+
+    cache.add("a", makeRStat("a", 1));
+    EXPECT_FALSE(cache.isKnownMissing("a"));
+
+    // And the other way round
+    cache.addMissing("a", std::nullopt);
+    EXPECT_FALSE(cache.find("a"));
+}
+
+TEST(AttributeCache, InvalidateDropsPathAndParentListing)
+{
+    AttributeCache cache(1min, 8, 8, 1min, 8);
+    cache.addListing("dir", Qid(0x80, 1, 10), {makeRStat("x", 11)});
+    cache.addListing("dir/x", Qid(0x80, 1, 11), {});
+    cache.addMissing("dir/z", Qid(0x80, 1, 10));
+    cache.add("other", makeRStat("other", 20));
+
+    cache.invalidate("dir/x");
+
+    EXPECT_FALSE(cache.find("dir/x"));
+    EXPECT_FALSE(cache.findListing("dir/x"));
+    EXPECT_FALSE(cache.findListing("dir"));
+    EXPECT_FALSE(cache.isKnownMissing("dir/z"));
+    EXPECT_TRUE(cache.find("other"));
+}
+
+TEST(AttributeCache, BoundsMissingPaths)
+{
+    AttributeCache cache(1min, 8, 8, 1min, 2);
+    cache.addMissing("a", std::nullopt);
+    cache.addMissing("b", std::nullopt);
+    cache.addMissing("c", std::nullopt);
+
+    EXPECT_FALSE(cache.isKnownMissing("a"));
+    EXPECT_TRUE(cache.isKnownMissing("b"));
+    EXPECT_TRUE(cache.isKnownMissing("c"));
+    EXPECT_EQ(cache.getStatistics().missing_hits, 2u);
+}
@@ -0,0 +1,254 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+// Benchmarks of the protocol engine, run by hand as they take a while and their results depend on the machine:
+//
+//     protocol_benchmarks [name...]
+//
+// runs the benchmarks with the given names, or all of them.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "protocol/Client.h"
+#include "protocol/ConstantValues.h"
+#include "protocol/IdAllocator.h"
+#include "protocol/Task.h"
+
+#include "SharedMemoryServer.h"
+#include "StandInServer.h"
+
+namespace {
+
+constexpr int LATENCY_ROUND_TRIPS = 20000;
+
+void printLatencies(const char *transport_name, const char *request_name, std::vector<double> latencies_us)
+{
+    std::sort(latencies_us.begin(), latencies_us.end());
+
+    double total_us = 0;
+    for (double run_latency : latencies_us) {
+        total_us += run_latency;
+    }
+
+    printf("%-10s %-12s mean %7.1f us   median %7.1f us   p99 %7.1f us\n", transport_name, request_name,
+           total_us / latencies_us.size(), latencies_us[latencies_us.size() / 2],
+           latencies_us[latencies_us.size() * 99 / 100]);
+}
+
+// Round trip time of requests sent one at a time, which is dominated by the transport as the server answers them
+// right away from memory
+void measureLatency(const char *transport_name, ClientConfiguration config)
+{
+    config.attribute_cache_ttl_ms = 0;
+    config.block_cache_size = 0;
+    config.read_ahead_max_size = 0;
+
+    Client client(config);
+    RemoteFile file = syncWait(client.walk("\\file"));
+    syncWait(client.open(file, FileMode(FileMode::Access::Read)));
+
+    std::vector<double> stat_latencies_us;
+    std::vector<double> read_latencies_us;
+    std::vector<char> buffer(4096);
+
+    for (int i = 0; i < LATENCY_ROUND_TRIPS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        syncWait(client.stat(file));
+        auto stat_end = std::chrono::steady_clock::now();
+        syncWait(client.read(file, 0, static_cast<uint32_t>(buffer.size()), buffer.data()));
+        auto read_end = std::chrono::steady_clock::now();
+
+        stat_latencies_us.push_back(std::chrono::duration<double, std::micro>(stat_end - start).count());
+        read_latencies_us.push_back(std::chrono::duration<double, std::micro>(read_end - stat_end).count());
+    }
+
+    syncWait(client.clunk(file));
+
+    printLatencies(transport_name, "TStat", stat_latencies_us);
+    printLatencies(transport_name, "TRead 4 KiB", read_latencies_us);
+}
+
+void benchmarkTransportLatency()
+{
+    StandInServer server;
+    server.addFile("file", std::string(64 * 1024, 'x'));
+
+    measureLatency("TCP", ClientConfiguration("127.0.0.1", server.listenTcp()));
+
+    ClientConfiguration unix_config("", "");
+    unix_config.unix_socket_path = server.listenUnix();
+    measureLatency("AF_UNIX", unix_config);
+
+    SharedMemoryServer shared_memory_server(&server, 1024 * 1024);
+    ClientConfiguration shared_memory_config("", "");
+    shared_memory_config.shared_memory_name = shared_memory_server.getName();
+    measureLatency("shm", shared_memory_config);
+}
+
+// Throughput of synchronous callers sharing a session, whose coroutines each run on the caller's own thread rather
+// than taking turns on the event loop of the session
+void benchmarkSyncCallers()
+{
+    StandInServer server;
+    server.addFile("file", std::string(1024 * 1024, 'x'));
+
+    ClientConfiguration config("127.0.0.1", server.listenTcp());
+    config.attribute_cache_ttl_ms = 0;
+    config.block_cache_size = 0;
+    config.read_ahead_max_size = 0;
+    Client client(config);
+
+    for (int thread_count : {1, 2, 4, 8}) {
+        constexpr int READS_PER_THREAD = 500;
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thread_count; i++) {
+            threads.emplace_back([&client, i] {
+                std::vector<char> buffer(64 * 1024);
+                for (int j = 0; j < READS_PER_THREAD; j++) {
+                    client.readFile("\\file", ((i + j) % 16) * buffer.size(), buffer.data(), buffer.size());
+                }
+            });
+        }
+
+        for (std::thread &run_thread : threads) {
+            run_thread.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%d threads   %8.0f reads of 64 KiB / s\n", thread_count, thread_count * READS_PER_THREAD / seconds);
+    }
+}
+
+// Free list guarded by a mutex, the straightforward allocator that reuses ids, as a baseline
+class LockedIdAllocator
+{
+public:
+    explicit LockedIdAllocator(size_t capacity)
+    {
+        for (size_t i = capacity; i > 0; i--) {
+            m_free_ids.push_back(static_cast<uint16_t>(i - 1));
+        }
+    }
+
+    uint16_t allocate()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint16_t id = m_free_ids.back();
+        m_free_ids.pop_back();
+        return id;
+    }
+
+    void release(uint16_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free_ids.push_back(id);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<uint16_t> m_free_ids;
+};
+
+// Each thread keeps a few ids in use at a time, as a caller with several requests in flight does
+template <class Allocator>
+void measureAllocatorThroughput(const char *allocator_name)
+{
+    constexpr int ALLOCATIONS_PER_THREAD = 1000000;
+    constexpr size_t IDS_HELD_PER_THREAD = 8;
+
+    for (int thread_count : {1, 2, 4, 8, 16}) {
+        Allocator allocator(constant::NOTAG);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thread_count; i++) {
+            threads.emplace_back([&allocator] {
+                uint16_t held_ids[IDS_HELD_PER_THREAD];
+                for (uint16_t &run_id : held_ids) {
+                    run_id = allocator.allocate();
+                }
+
+                for (int j = 0; j < ALLOCATIONS_PER_THREAD; j++) {
+                    uint16_t &slot = held_ids[j % IDS_HELD_PER_THREAD];
+                    allocator.release(slot);
+                    slot = allocator.allocate();
+                }
+
+                for (uint16_t run_id : held_ids) {
+                    allocator.release(run_id);
+                }
+            });
+        }
+
+        for (std::thread &run_thread : threads) {
+            run_thread.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%-8s %2d threads   %6.1f M allocations / s\n", allocator_name, thread_count,
+               thread_count * ALLOCATIONS_PER_THREAD / seconds / 1e6);
+    }
+}
+
+void benchmarkAllocatorContention()
+{
+    measureAllocatorThroughput<IdAllocator<uint16_t>>("bitmap");
+    measureAllocatorThroughput<LockedIdAllocator>("mutex");
+}
+
+struct Benchmark
+{
+    const char *name;
+    std::function<void()> run;
+};
+
+const std::vector<Benchmark> BENCHMARKS = {
+    {"transport-latency", benchmarkTransportLatency},
+    {"sync-callers", benchmarkSyncCallers},
+    {"allocator-contention", benchmarkAllocatorContention},
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    for (const Benchmark &run_benchmark : BENCHMARKS) {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; i++) {
+            selected |= strcmp(argv[i], run_benchmark.name) == 0;
+        }
+
+        if (selected) {
+            printf("%s\n", run_benchmark.name);
+            run_benchmark.run();
+        }
+    }
+
+    return 0;
+}
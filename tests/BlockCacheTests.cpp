@@ -0,0 +1,281 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/BlockCache.h"
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const FileVersion VERSION{1, 100, 4096};
+
+// Blocks of a single byte, so that the memory budget of a cache is the number of blocks it holds
+BlockPtr makeBlock(char value)
+{
+    return std::make_shared<const Block>(1, value);
+}
+
+// Adds the blocks of the file that are not cached yet, reading each of them once
+void scan(BlockCache *cache, uint64_t qid_path, uint64_t block_count)
+{
+    for (uint64_t i = 0; i < block_count; i++) {
+        if (!cache->find(qid_path, i, VERSION)) {
+            cache->add(qid_path, i, VERSION, makeBlock('s'));
+        }
+    }
+}
+
+int countCached(BlockCache *cache, uint64_t qid_path, uint64_t block_count)
+{
+    int cached = 0;
+    for (uint64_t i = 0; i < block_count; i++) {
+        cached += cache->contains(qid_path, i, VERSION);
+    }
+
+    return cached;
+}
+
+using BlockAccess = std::pair<uint64_t, uint64_t>;
+
+// Reads of blocks of a working set (file 1) in random order, interleaved with a scan through a large file (file 2)
+// that never reads a block twice, as when a backup or a search goes through the share while it is in use
+std::vector<BlockAccess> makeScanPollutedTrace(uint64_t working_set_size, int access_count)
+{
+    std::mt19937 generator(12345);
+    std::uniform_int_distribution<uint64_t> working_set_block(0, working_set_size - 1);
+    std::bernoulli_distribution is_scan(0.3);
+
+    std::vector<BlockAccess> trace;
+    uint64_t next_scan_block = 0;
+    for (int i = 0; i < access_count; i++) {
+        if (is_scan(generator)) {
+            trace.emplace_back(2, next_scan_block++);
+        } else {
+            trace.emplace_back(1, working_set_block(generator));
+        }
+    }
+
+    return trace;
+}
+
+double measureHitRatio(BlockCache *cache, const std::vector<BlockAccess> &trace)
+{
+    int hits = 0;
+    for (const auto &[qid_path, block_index] : trace) {
+        if (cache->find(qid_path, block_index, VERSION)) {
+            hits++;
+        } else {
+            cache->add(qid_path, block_index, VERSION, makeBlock('t'));
+        }
+    }
+
+    return static_cast<double>(hits) / trace.size();
+}
+
+// Plain LRU replacement of the same number of blocks, as a baseline
+double measureLruHitRatio(size_t capacity, const std::vector<BlockAccess> &trace)
+{
+    std::list<BlockAccess> blocks;
+    std::map<BlockAccess, std::list<BlockAccess>::iterator> positions;
+
+    int hits = 0;
+    for (const BlockAccess &run_access : trace) {
+        auto it = positions.find(run_access);
+        if (it != positions.end()) {
+            hits++;
+            blocks.splice(blocks.begin(), blocks, it->second);
+            continue;
+        }
+
+        blocks.push_front(run_access);
+        positions[run_access] = blocks.begin();
+        if (blocks.size() > capacity) {
+            positions.erase(blocks.back());
+            blocks.pop_back();
+        }
+    }
+
+    return static_cast<double>(hits) / trace.size();
+}
+
+} // namespace
+
+TEST(BlockCache, IsDisabledWithoutRoomForBlock)
+{
+    BlockCache cache(4096, 1000);
+    EXPECT_FALSE(cache.isEnabled());
+
+    cache.add(1, 0, VERSION, std::make_shared<const Block>(4096, 'x'));
+    EXPECT_FALSE(cache.find(1, 0, VERSION));
+}
+
+TEST(BlockCache, ReturnsBlockOfSameVersionOnly)
+{
+    BlockCache cache(1, 4);
+    BlockPtr block = makeBlock('x');
+    cache.add(1, 0, VERSION, block);
+
+    EXPECT_EQ(cache.find(1, 0, VERSION), block);
+    EXPECT_FALSE(cache.find(2, 0, VERSION));
+    EXPECT_FALSE(cache.find(1, 1, VERSION));
+
+    // Looking up another version drops the block
+    EXPECT_FALSE(cache.find(1, 0, FileVersion{2, 100, 4096}));
+    EXPECT_FALSE(cache.contains(1, 0, VERSION));
+
+    BlockCacheStatistics statistics = cache.getStatistics();
+    EXPECT_EQ(statistics.hits, 1u);
+    EXPECT_EQ(statistics.misses, 3u);
+}
+
+TEST(BlockCache, EraseDropsBlocksInRange)
+{
+    BlockCache cache(1, 16);
+    scan(&cache, 1, 8);
+    scan(&cache, 2, 4);
+
+    cache.erase(1, 2, 5);
+    EXPECT_EQ(countCached(&cache, 1, 8), 5);
+    EXPECT_FALSE(cache.contains(1, 2, VERSION));
+    EXPECT_FALSE(cache.contains(1, 4, VERSION));
+
+    // A range larger than the cache is matched against the cached blocks
+    cache.erase(1, 0, UINT64_MAX);
+    EXPECT_EQ(countCached(&cache, 1, 8), 0);
+    EXPECT_EQ(countCached(&cache, 2, 4), 4);
+}
+
+TEST(BlockCache, ScanDoesNotDisplaceBlocksReadRepeatedly)
+{
+    BlockCache cache(1, 10);
+    for (int i = 0; i < 2; i++) {
+        scan(&cache, 1, 5);
+    }
+
+    scan(&cache, 2, 100);
+    EXPECT_EQ(countCached(&cache, 1, 5), 5);
+}
+
+TEST(BlockCache, ScanDisplacesBlocksReadOnce)
+{
+    BlockCache cache(1, 10);
+    scan(&cache, 1, 5);
+
+    scan(&cache, 2, 100);
+    EXPECT_EQ(countCached(&cache, 1, 5), 0);
+}
+
+TEST(BlockCache, GhostHitBringsBlockBackAsFrequent)
+{
+    BlockCache cache(1, 4);
+    for (int i = 0; i < 2; i++) {
+        scan(&cache, 1, 2);
+    }
+
+    // The recent list evicts block 2 of the second file to make room, keeping its key as a ghost
+    scan(&cache, 2, 5);
+    EXPECT_FALSE(cache.contains(2, 2, VERSION));
+    EXPECT_TRUE(cache.contains(2, 3, VERSION));
+
+    // Reading it again grows the share of the recent list, which still gives up block 3 for it
+    cache.add(2, 2, VERSION, makeBlock('g'));
+    EXPECT_TRUE(cache.contains(2, 2, VERSION));
+    EXPECT_FALSE(cache.contains(2, 3, VERSION));
+    EXPECT_TRUE(cache.contains(2, 4, VERSION));
+    EXPECT_EQ(countCached(&cache, 1, 2), 2);
+}
+
+TEST(BlockCache, PrefetchedBlockReadOnceCountsAsSingleUse)
+{
+    BlockCache cache(1, 10);
+    for (uint64_t i = 0; i < 5; i++) {
+        cache.add(1, i, VERSION, makeBlock('p'), true);
+    }
+
+    for (uint64_t i = 0; i < 5; i++) {
+        EXPECT_TRUE(cache.find(1, i, VERSION));
+    }
+
+    scan(&cache, 2, 10);
+    EXPECT_EQ(countCached(&cache, 1, 5), 0);
+}
+
+TEST(BlockCache, PrefetchedBlockReadTwiceIsKept)
+{
+    BlockCache cache(1, 10);
+    for (uint64_t i = 0; i < 5; i++) {
+        cache.add(1, i, VERSION, makeBlock('p'), true);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        for (uint64_t j = 0; j < 5; j++) {
+            cache.find(1, j, VERSION);
+        }
+    }
+
+    scan(&cache, 2, 10);
+    EXPECT_EQ(countCached(&cache, 1, 5), 5);
+}
+
+TEST(BlockCache, ReadsBySameStreamCountAsSingleUse)
+{
+    constexpr uint64_t STREAM_ID = 7;
+    constexpr uint64_t OTHER_STREAM_ID = 8;
+
+    BlockCache cache(1, 10);
+    for (uint64_t i = 0; i < 5; i++) {
+        cache.add(1, i, VERSION, makeBlock('r'), false, STREAM_ID);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        for (uint64_t j = 0; j < 5; j++) {
+            cache.find(1, j, VERSION, STREAM_ID);
+        }
+    }
+
+    cache.find(1, 0, VERSION, OTHER_STREAM_ID);
+
+    scan(&cache, 2, 10);
+    EXPECT_EQ(countCached(&cache, 1, 5), 1);
+    EXPECT_TRUE(cache.contains(1, 0, VERSION));
+}
+
+TEST(BlockCache, BeatsLruOnScanPollutedTrace)
+{
+    constexpr size_t CAPACITY = 64;
+    std::vector<BlockAccess> trace = makeScanPollutedTrace(60, 20000);
+
+    BlockCache cache(1, CAPACITY);
+    double arc_hit_ratio = measureHitRatio(&cache, trace);
+    double lru_hit_ratio = measureLruHitRatio(CAPACITY, trace);
+
+    // The working set fits, so that ARC serves nearly all of its 70% of the reads, whereas LRU lets the scan push the
+    // working set out between two reads of the same block
+    EXPECT_GT(arc_hit_ratio, 0.65);
+    EXPECT_GT(arc_hit_ratio, lru_hit_ratio + 0.2);
+}
@@ -0,0 +1,334 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/Client.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol/Exceptions.h"
+#include "protocol/MessageTypes.h"
+
+#include "StandInServer.h"
+
+namespace {
+
+// Client that goes to the server for everything, so that the requests it sends can be told apart
+ClientConfiguration uncachedConfiguration(const std::string &port)
+{
+    ClientConfiguration config("127.0.0.1", port);
+    config.attribute_cache_ttl_ms = 0;
+    config.missing_cache_ttl_ms = 0;
+    config.block_cache_size = 0;
+    config.read_ahead_max_size = 0;
+    config.write_back_delay_ms = 0;
+
+    return config;
+}
+
+// Fids are clunked in the background once released, so the server is given a moment to see the TClunk messages
+bool waitForFidCount(const StandInServer &server, size_t fid_count)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (server.countFids() != fid_count) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+// Blocks read from the server are added to the block cache by a thread of its own, shortly after the read
+void waitForCacheFill()
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+} // namespace
+
+class ClientTest : public ::testing::Test
+{
+protected:
+    ClientTest()
+    {
+        m_server.addFile("dir/file", "contents of file");
+        m_server.addDirectory("dir/empty");
+    }
+
+    StandInServer m_server;
+};
+
+TEST_F(ClientTest, ReadsFileOverTcp)
+{
+    Client client(uncachedConfiguration(m_server.listenTcp()));
+
+    char buffer[64];
+    ASSERT_EQ(client.readFile("\\dir\\file", 0, buffer, sizeof(buffer)), 16);
+    EXPECT_EQ(std::string(buffer, 16), "contents of file");
+}
+
+TEST_F(ClientTest, ReadsFileOverUnixSocket)
+{
+    ClientConfiguration config = uncachedConfiguration("");
+    config.unix_socket_path = m_server.listenUnix();
+    Client client(config);
+
+    char buffer[64];
+    ASSERT_EQ(client.readFile("\\dir\\file", 9, buffer, sizeof(buffer)), 7);
+    EXPECT_EQ(std::string(buffer, 7), "of file");
+}
+
+#ifdef __linux__
+TEST_F(ClientTest, WritesAndReadsFileOverIoUring)
+{
+    ClientConfiguration config = uncachedConfiguration(m_server.listenTcp());
+    config.transport_backend = TransportBackend::IoUring;
+
+    std::unique_ptr<Client> client;
+    try {
+        client = std::make_unique<Client>(config);
+    }
+    catch (const ClientInitializationError &) {
+        GTEST_SKIP() << "io_uring is not available";
+    }
+
+    // Several messages' worth of data, which is sent in batches of many buffers
+    std::string data(1024 * 1024 + 777, '\0');
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 13 + 5);
+    }
+
+    OpenedFile *file = client->createFile("\\dir\\written", false);
+    ASSERT_NE(file, nullptr);
+    client->writeFile(file, 0, data.data(), data.size());
+    client->flushFile(file);
+    client->closeFile(file);
+    EXPECT_EQ(m_server.getFileData("dir/written"), data);
+
+    std::vector<char> buffer(data.size() + 1);
+    ASSERT_EQ(client->readFile("\\dir\\written", 0, buffer.data(), buffer.size()),
+              static_cast<int64_t>(data.size()));
+    EXPECT_EQ(std::string(buffer.data(), data.size()), data);
+}
+#endif
+
+TEST_F(ClientTest, ListsDirectory)
+{
+    Client client(uncachedConfiguration(m_server.listenTcp()));
+
+    std::vector<RStat> entries = client.getDirectoryContents("\\dir");
+    ASSERT_EQ(entries.size(), 2u);
+    EXPECT_EQ(entries[0].name, "empty");
+    EXPECT_EQ(entries[1].name, "file");
+    EXPECT_EQ(entries[1].length, 16u);
+
+    EXPECT_EQ(client.openFile("\\dir\\missing"), nullptr);
+}
+
+TEST_F(ClientTest, ReplacedFileIsWalkedAnewAfterListing)
+{
+    Client client(uncachedConfiguration(m_server.listenTcp()));
+
+    char buffer[64];
+    ASSERT_EQ(client.readFile("\\dir\\file", 0, buffer, sizeof(buffer)), 16);
+
+    // The cached fid still leads to the removed file, until the listing shows another file in its place
+    m_server.removeFile("dir/file");
+    m_server.addFile("dir/file", "replaced");
+    client.getDirectoryContents("\\dir");
+
+    ASSERT_EQ(client.readFile("\\dir\\file", 0, buffer, sizeof(buffer)), 8);
+    EXPECT_EQ(std::string(buffer, 8), "replaced");
+}
+
+TEST_F(ClientTest, HandleReusesItsFids)
+{
+    Client client(uncachedConfiguration(m_server.listenTcp()));
+
+    OpenedFile *file = client.openFile("\\dir\\file");
+    ASSERT_NE(file, nullptr);
+    size_t walk_count = m_server.countRequests(msg_type::TWalk);
+    size_t open_count = m_server.countRequests(msg_type::TOpen);
+
+    // The root fid, the walked fid and its clone opened for reading
+    EXPECT_EQ(m_server.countFids(), 3u);
+
+    char buffer[64];
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(client.getFileInformation(file).length, 16u);
+        EXPECT_EQ(client.readFile(file, 0, buffer, sizeof(buffer)), 16);
+    }
+
+    EXPECT_EQ(m_server.countRequests(msg_type::TWalk), walk_count);
+    EXPECT_EQ(m_server.countRequests(msg_type::TOpen), open_count);
+    EXPECT_EQ(m_server.countFids(), 3u);
+
+    // The fids stay in the fid cache after closing, for the next handle to the file to reuse
+    client.closeFile(file);
+    file = client.openFile("\\dir\\file");
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(m_server.countRequests(msg_type::TWalk), walk_count);
+    EXPECT_EQ(m_server.countRequests(msg_type::TOpen), open_count);
+
+    client.closeFile(file);
+    EXPECT_EQ(m_server.countFids(), 3u);
+}
+
+TEST_F(ClientTest, ClosingUncachedHandleClunksItsFids)
+{
+    ClientConfiguration config = uncachedConfiguration(m_server.listenTcp());
+    config.fid_cache_size = 0;
+    Client client(config);
+
+    OpenedFile *file = client.openFile("\\dir\\file");
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(m_server.countFids(), 3u);
+
+    OpenedFile *directory = client.openFile("\\dir");
+    ASSERT_NE(directory, nullptr);
+    EXPECT_EQ(client.getDirectoryContents(directory).size(), 2u);
+
+    // The directory is read through a clone of its fid, which is clunked after the listing
+    EXPECT_TRUE(waitForFidCount(m_server, 4));
+
+    client.closeFile(file);
+    EXPECT_TRUE(waitForFidCount(m_server, 2));
+
+    client.closeFile(directory);
+    EXPECT_TRUE(waitForFidCount(m_server, 1));
+}
+
+TEST_F(ClientTest, BlockCacheKeepsAlignedReadsAndBypassesLargeUnalignedOnes)
+{
+    std::string data(64 * 1024 + 100, 'x');
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 7);
+    }
+
+    m_server.addFile("big", data);
+
+    ClientConfiguration config = uncachedConfiguration(m_server.listenTcp());
+    config.block_cache_size = 1024 * 1024;
+    config.block_cache_block_size = 4096;
+    Client client(config);
+
+    // Read straight into the buffer, including the short last block that the end of the file cuts off
+    std::vector<char> buffer(data.size() + 1000);
+    ASSERT_EQ(client.readFile("\\big", 0, buffer.data(), buffer.size()), static_cast<int64_t>(data.size()));
+    EXPECT_EQ(std::string(buffer.data(), data.size()), data);
+    waitForCacheFill();
+
+    size_t read_count = m_server.countRequests(msg_type::TRead);
+    ASSERT_EQ(client.readFile("\\big", 100, buffer.data(), 3 * 4096), 3 * 4096);
+    EXPECT_EQ(std::string(buffer.data(), 3 * 4096), data.substr(100, 3 * 4096));
+    EXPECT_EQ(client.readFile("\\big", 64 * 1024, buffer.data(), 4096), 100);
+    EXPECT_EQ(m_server.countRequests(msg_type::TRead), read_count);
+
+    // A fresh version of the file is no longer cached; a large read that would have to be staged goes to the server
+    // every time
+    m_server.addFile("big", data);
+    for (int i = 0; i < 2; i++) {
+        read_count = m_server.countRequests(msg_type::TRead);
+        ASSERT_EQ(client.readFile("\\big", 100, buffer.data(), 8 * 4096), 8 * 4096);
+        EXPECT_EQ(std::string(buffer.data(), 8 * 4096), data.substr(100, 8 * 4096));
+        EXPECT_GT(m_server.countRequests(msg_type::TRead), read_count);
+    }
+
+    // A small one is staged, and cached
+    ASSERT_EQ(client.readFile("\\big", 4096 + 100, buffer.data(), 4096), 4096);
+    waitForCacheFill();
+    read_count = m_server.countRequests(msg_type::TRead);
+    ASSERT_EQ(client.readFile("\\big", 4096 + 200, buffer.data(), 4096), 4096);
+    EXPECT_EQ(std::string(buffer.data(), 4096), data.substr(4096 + 200, 4096));
+    EXPECT_EQ(m_server.countRequests(msg_type::TRead), read_count);
+}
+
+TEST_F(ClientTest, ReadsDoNotFetchBlocksBeingReadAhead)
+{
+    std::string data(256 * 1024, 'x');
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 13);
+    }
+
+    m_server.addFile("big", data);
+    m_server.setReadDelay(std::chrono::milliseconds(2));
+
+    // With the attributes cached, the reads send nothing but TRead messages
+    ClientConfiguration config = uncachedConfiguration(m_server.listenTcp());
+    config.attribute_cache_ttl_ms = 60000;
+    config.block_cache_size = 1024 * 1024;
+    config.block_cache_block_size = 4096;
+    config.read_ahead_max_size = 64 * 1024;
+    Client client(config);
+
+    OpenedFile *file = client.openFile("\\big");
+    ASSERT_NE(file, nullptr);
+
+    // Each read right after the previous one finds the blocks it needs being read ahead, and waits for them
+    std::vector<char> buffer(4096);
+    for (size_t offset = 0; offset < data.size(); offset += buffer.size()) {
+        ASSERT_EQ(client.readFile(file, offset, buffer.data(), buffer.size()), 4096);
+        ASSERT_EQ(std::string(buffer.data(), buffer.size()), data.substr(offset, buffer.size()));
+    }
+
+    client.closeFile(file);
+    EXPECT_EQ(m_server.countFileBytesRead(), data.size());
+}
+
+TEST_F(ClientTest, ReadsSeeBufferedWritesWithoutSendingThem)
+{
+    m_server.addFile("file", "hello world");
+
+    ClientConfiguration config = uncachedConfiguration(m_server.listenTcp());
+    config.write_back_delay_ms = 60000;
+    Client client(config);
+
+    OpenedFile *file = client.openFile("\\file");
+    ASSERT_NE(file, nullptr);
+    ASSERT_TRUE(client.openFileForWriting(file));
+
+    client.writeFile(file, 6, "there", 5);
+
+    char buffer[64];
+    ASSERT_EQ(client.readFile(file, 0, buffer, sizeof(buffer)), 11);
+    EXPECT_EQ(std::string(buffer, 11), "hello there");
+
+    EXPECT_EQ(m_server.countRequests(msg_type::TWrite), 0);
+
+    // A write that does not continue the buffer sends it. Past the end of the file on the server, the file reads as
+    // zeros up to the data buffered next.
+    client.writeFile(file, 16, "again", 5);
+    ASSERT_EQ(client.readFile(file, 8, buffer, sizeof(buffer)), 13);
+    EXPECT_EQ(std::string(buffer, 13), std::string("ere\0\0\0\0\0again", 13));
+    EXPECT_EQ(m_server.countRequests(msg_type::TWrite), 1);
+
+    client.flushFile(file);
+    EXPECT_EQ(m_server.getFileData("file"), std::string("hello there\0\0\0\0\0again", 21));
+
+    client.closeFile(file);
+}
@@ -0,0 +1,222 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/DiskCache.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const FileVersion VERSION{1, 100, 4 * 4096};
+constexpr size_t BLOCK_SIZE = 4096;
+const std::string SERVER = "127.0.0.1:564/export";
+
+// Room for the index and four slots (each slot takes a block and an entry of the index)
+constexpr uint64_t CACHE_SIZE = 4096 + 4 * (BLOCK_SIZE + 64);
+
+std::string makeBlockData(char value)
+{
+    return std::string(BLOCK_SIZE, value);
+}
+
+std::optional<std::string> readBlock(DiskCache *cache, uint64_t qid_path, uint64_t block_index,
+                                     FileVersion version = VERSION)
+{
+    std::string data(BLOCK_SIZE, '\0');
+    std::optional<size_t> data_size = cache->read(qid_path, block_index, version, 0, data.data(), data.size());
+    if (!data_size) {
+        return std::nullopt;
+    }
+
+    data.resize(*data_size);
+    return data;
+}
+
+void addBlock(DiskCache *cache, uint64_t qid_path, uint64_t block_index, const std::string &data)
+{
+    cache->add(qid_path, block_index, VERSION, data.data(), data.size());
+}
+
+} // namespace
+
+// Each test gets a cache file of its own in the temporary directory, removed once done
+class DiskCacheTest : public ::testing::Test
+{
+protected:
+    DiskCacheTest()
+        : m_path((std::filesystem::temp_directory_path() /
+                  (std::string("9p-disk-cache-") + ::testing::UnitTest::GetInstance()->current_test_info()->name()))
+                     .string())
+    {
+        std::filesystem::remove(m_path);
+    }
+
+    ~DiskCacheTest()
+    {
+        std::filesystem::remove(m_path);
+    }
+
+    std::unique_ptr<DiskCache> openCache(const std::string &server = SERVER, size_t block_size = BLOCK_SIZE)
+    {
+        return std::make_unique<DiskCache>(m_path, server, block_size, CACHE_SIZE);
+    }
+
+    std::string m_path;
+};
+
+TEST_F(DiskCacheTest, IsDisabledWithoutPath)
+{
+    DiskCache cache("", SERVER, BLOCK_SIZE, CACHE_SIZE);
+    EXPECT_FALSE(cache.isEnabled());
+
+    addBlock(&cache, 1, 0, makeBlockData('x'));
+    EXPECT_FALSE(cache.contains(1, 0, VERSION));
+}
+
+TEST_F(DiskCacheTest, ReadsBlockOfSameVersionOnly)
+{
+    std::unique_ptr<DiskCache> cache = openCache();
+    ASSERT_TRUE(cache->isEnabled());
+
+    addBlock(cache.get(), 1, 0, makeBlockData('a'));
+    addBlock(cache.get(), 1, 1, "short");
+    EXPECT_EQ(readBlock(cache.get(), 1, 0), makeBlockData('a'));
+    EXPECT_EQ(readBlock(cache.get(), 1, 1), "short");
+    EXPECT_FALSE(readBlock(cache.get(), 2, 0));
+
+    // Part of a block, starting within it
+    char buffer[3];
+    EXPECT_EQ(cache->read(1, 1, VERSION, 2, buffer, sizeof(buffer)), 5u);
+    EXPECT_EQ(std::string(buffer, 3), "ort");
+
+    // Looking up another version drops the block
+    EXPECT_FALSE(readBlock(cache.get(), 1, 0, FileVersion{2, 100, 4 * 4096}));
+    EXPECT_FALSE(cache->contains(1, 0, VERSION));
+}
+
+TEST_F(DiskCacheTest, IsUsedByOneClientAtATime)
+{
+    std::unique_ptr<DiskCache> cache = openCache();
+    ASSERT_TRUE(cache->isEnabled());
+
+    EXPECT_FALSE(openCache()->isEnabled());
+}
+
+TEST_F(DiskCacheTest, ReloadsIndexOfEarlierRun)
+{
+    std::unique_ptr<DiskCache> cache = openCache();
+    addBlock(cache.get(), 1, 0, makeBlockData('a'));
+    addBlock(cache.get(), 2, 5, "last block");
+    cache.reset();
+
+    cache = openCache();
+    ASSERT_TRUE(cache->isEnabled());
+    EXPECT_EQ(readBlock(cache.get(), 1, 0), makeBlockData('a'));
+    EXPECT_EQ(readBlock(cache.get(), 2, 5), "last block");
+}
+
+TEST_F(DiskCacheTest, StartsEmptyForOtherServer)
+{
+    std::unique_ptr<DiskCache> cache = openCache();
+    addBlock(cache.get(), 1, 0, makeBlockData('a'));
+    cache.reset();
+
+    // The same qid path may well stand for another file on another server
+    cache = openCache("127.0.0.1:564/other");
+    ASSERT_TRUE(cache->isEnabled());
+    EXPECT_FALSE(readBlock(cache.get(), 1, 0));
+    cache.reset();
+
+    // Going back to the first server does not bring the block back either, as the file has been initialized anew
+    cache = openCache();
+    EXPECT_FALSE(readBlock(cache.get(), 1, 0));
+}
+
+TEST_F(DiskCacheTest, StartsEmptyForOtherBlockSize)
+{
+    std::unique_ptr<DiskCache> cache = openCache();
+    addBlock(cache.get(), 1, 0, makeBlockData('a'));
+    cache.reset();
+
+    cache = openCache(SERVER, BLOCK_SIZE / 2);
+    ASSERT_TRUE(cache->isEnabled());
+    EXPECT_FALSE(cache->contains(1, 0, VERSION));
+}
+
+TEST_F(DiskCacheTest, DropsBlockWhoseChecksumFails)
+{
+    std::unique_ptr<DiskCache> cache = openCache();
+    addBlock(cache.get(), 1, 0, makeBlockData('a'));
+    addBlock(cache.get(), 1, 1, makeBlockData('b'));
+    cache.reset();
+
+    // Damage the data of the first block, as a crash before the data reached the disk would
+    std::string contents;
+    {
+        std::ifstream file(m_path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    size_t data_offset = contents.find(makeBlockData('a'));
+    ASSERT_NE(data_offset, std::string::npos);
+    contents[data_offset + 100] = 'z';
+    {
+        std::ofstream file(m_path, std::ios::binary | std::ios::in);
+        file.write(contents.data(), contents.size());
+    }
+
+    cache = openCache();
+    EXPECT_TRUE(cache->contains(1, 0, VERSION));
+    EXPECT_FALSE(readBlock(cache.get(), 1, 0));
+    EXPECT_FALSE(cache->contains(1, 0, VERSION));
+    EXPECT_EQ(readBlock(cache.get(), 1, 1), makeBlockData('b'));
+}
+
+TEST_F(DiskCacheTest, ReusesLeastRecentlyUsedSlotWhenFull)
+{
+    std::unique_ptr<DiskCache> cache = openCache();
+    for (uint64_t i = 0; i < 4; i++) {
+        addBlock(cache.get(), 1, i, makeBlockData('a' + static_cast<char>(i)));
+    }
+
+    // Reading the first block makes the second one the least recently used
+    EXPECT_TRUE(readBlock(cache.get(), 1, 0));
+    addBlock(cache.get(), 1, 4, makeBlockData('e'));
+    EXPECT_FALSE(cache->contains(1, 1, VERSION));
+    EXPECT_TRUE(cache->contains(1, 0, VERSION));
+
+    // The order of use is kept across runs as well, the third block being the least recently used now
+    cache.reset();
+    cache = openCache();
+    addBlock(cache.get(), 1, 5, makeBlockData('f'));
+    EXPECT_FALSE(cache->contains(1, 2, VERSION));
+    EXPECT_EQ(readBlock(cache.get(), 1, 0), makeBlockData('a'));
+    EXPECT_EQ(readBlock(cache.get(), 1, 3), makeBlockData('d'));
+    EXPECT_EQ(readBlock(cache.get(), 1, 4), makeBlockData('e'));
+    EXPECT_EQ(readBlock(cache.get(), 1, 5), makeBlockData('f'));
+}
@@ -0,0 +1,204 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/FidTracker.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+FidHandle makeEntry(Fid fid, const std::string &path)
+{
+    return std::make_shared<FidEntry>(fid, path, Qid(0, 0, fid));
+}
+
+} // namespace
+
+TEST(FidTracker, MakePathKeyJoinsComponents)
+{
+    EXPECT_EQ(FidTracker::makePathKey({}), "");
+    EXPECT_EQ(FidTracker::makePathKey({"dir"}), "dir");
+    EXPECT_EQ(FidTracker::makePathKey({"dir", "sub", "file"}), "dir/sub/file");
+}
+
+TEST(FidTracker, KeepsRootEntry)
+{
+    FidTracker tracker(4);
+    EXPECT_EQ(tracker.getRootEntry(), nullptr);
+
+    tracker.setRoot(1, Qid(0x80, 0, 5));
+    ASSERT_NE(tracker.getRootEntry(), nullptr);
+    EXPECT_EQ(tracker.getRootEntry()->fid, 1u);
+    EXPECT_EQ(tracker.getRootEntry()->path, "");
+}
+
+TEST(FidTracker, FindClosestReturnsDeepestCachedAncestor)
+{
+    FidTracker tracker(8);
+    FidHandle dir = tracker.add(makeEntry(10, "a"));
+    FidHandle file = tracker.add(makeEntry(11, "a/b/c"));
+
+    size_t depth;
+    EXPECT_EQ(tracker.findClosest({"a", "b", "c"}, &depth), file);
+    EXPECT_EQ(depth, 3u);
+
+    EXPECT_EQ(tracker.findClosest({"a", "b", "d"}, &depth), dir);
+    EXPECT_EQ(depth, 1u);
+
+    EXPECT_EQ(tracker.findClosest({"x", "y"}, &depth), nullptr);
+    EXPECT_EQ(depth, 0u);
+}
+
+TEST(FidTracker, AddKeepsEntryWalkedFirst)
+{
+    FidTracker tracker(8);
+    FidHandle first = tracker.add(makeEntry(10, "a"));
+    FidHandle second = makeEntry(11, "a");
+
+    EXPECT_EQ(tracker.add(second), first);
+    EXPECT_EQ(second.use_count(), 1);
+}
+
+TEST(FidTracker, EvictsLeastRecentlyUsedEntry)
+{
+    FidTracker tracker(2);
+    tracker.add(makeEntry(10, "a"));
+    tracker.add(makeEntry(11, "b"));
+
+    size_t depth;
+    tracker.findClosest({"a"}, &depth);
+    tracker.add(makeEntry(12, "c"));
+
+    EXPECT_NE(tracker.findClosest({"a"}, &depth), nullptr);
+    EXPECT_EQ(tracker.findClosest({"b"}, &depth), nullptr);
+    EXPECT_NE(tracker.findClosest({"c"}, &depth), nullptr);
+}
+
+TEST(FidTracker, EvictedEntryIsDroppedOnceUnused)
+{
+    FidTracker tracker(1);
+    std::weak_ptr<FidEntry> evicted = tracker.add(makeEntry(10, "a"));
+    FidHandle held = tracker.add(makeEntry(11, "b"));
+
+    // The tracker no longer owns the evicted entry, so nothing else keeps its fid from being clunked
+    EXPECT_TRUE(evicted.expired());
+    EXPECT_EQ(held.use_count(), 2);
+}
+
+TEST(FidTracker, RemoveOnlyRemovesCurrentEntry)
+{
+    FidTracker tracker(8);
+    FidHandle entry = tracker.add(makeEntry(10, "a"));
+    FidHandle stale = makeEntry(11, "a");
+
+    size_t depth;
+    tracker.remove(stale);
+    EXPECT_EQ(tracker.findClosest({"a"}, &depth), entry);
+
+    tracker.remove(entry);
+    EXPECT_EQ(tracker.findClosest({"a"}, &depth), nullptr);
+    EXPECT_EQ(entry.use_count(), 1);
+}
+
+TEST(FidTracker, RemoveTreeRemovesPathAndDescendants)
+{
+    FidTracker tracker(8);
+    tracker.add(makeEntry(10, "a"));
+    tracker.add(makeEntry(11, "a/b"));
+    tracker.add(makeEntry(12, "a/b/c"));
+    FidHandle sibling = tracker.add(makeEntry(13, "ab"));
+
+    tracker.removeTree("a");
+
+    size_t depth;
+    EXPECT_EQ(tracker.findClosest({"a", "b", "c"}, &depth), nullptr);
+    EXPECT_EQ(tracker.findClosest({"ab"}, &depth), sibling);
+}
+
+TEST(FidTracker, ValidateRemovesTreeOfReplacedFile)
+{
+    FidTracker tracker(8);
+    FidHandle dir = tracker.add(makeEntry(10, "a"));
+    tracker.add(makeEntry(11, "a/b"));
+
+    // A new version of the same file keeps its fid valid
+    tracker.validate("a", Qid(0, 1, 10));
+    size_t depth;
+    EXPECT_EQ(tracker.findClosest({"a", "b"}, &depth)->fid, 11u);
+
+    tracker.validate("a", Qid(0, 0, 20));
+    EXPECT_EQ(tracker.findClosest({"a", "b"}, &depth), nullptr);
+    EXPECT_EQ(dir.use_count(), 1);
+}
+
+TEST(FidTracker, ExpiredEntryIsWalkedPast)
+{
+    FidTracker tracker(8, 20ms);
+    tracker.add(makeEntry(10, "a"));
+    tracker.add(makeEntry(11, "a/b/c"));
+
+    std::this_thread::sleep_for(40ms);
+    FidHandle fresh = tracker.add(makeEntry(12, "a/b"));
+
+    size_t depth;
+    EXPECT_EQ(tracker.findClosest({"a", "b", "c"}, &depth), fresh);
+    EXPECT_EQ(depth, 2u);
+
+    // The expired entries have been dropped, so walking to their paths anew caches the new fids
+    EXPECT_EQ(tracker.add(makeEntry(13, "a"))->fid, 13u);
+    EXPECT_EQ(tracker.add(makeEntry(14, "a/b/c"))->fid, 14u);
+}
+
+TEST(FidTracker, ClearKeepsRootEntry)
+{
+    FidTracker tracker(8);
+    tracker.setRoot(1, Qid(0x80, 0, 5));
+    tracker.add(makeEntry(10, "a"));
+
+    tracker.clear();
+
+    size_t depth;
+    EXPECT_EQ(tracker.findClosest({"a"}, &depth), nullptr);
+    EXPECT_NE(tracker.getRootEntry(), nullptr);
+}
+
+TEST(FidEntry, KeepsFirstOpenedFid)
+{
+    FidEntry entry(10, "a", Qid(0, 0, 1));
+    EXPECT_FALSE(entry.getReadFid());
+
+    EXPECT_FALSE(entry.setReadFid(OpenedFid{20, 8192}));
+    std::optional<OpenedFid> existing = entry.setReadFid(OpenedFid{21, 8192});
+    ASSERT_TRUE(existing);
+    EXPECT_EQ(existing->fid, 20u);
+    EXPECT_EQ(entry.getReadFid()->fid, 20u);
+
+    EXPECT_FALSE(entry.getWriteFid());
+    EXPECT_FALSE(entry.setWriteFid(OpenedFid{22, 4096}));
+    EXPECT_EQ(entry.getWriteFid()->iounit, 4096u);
+}
@@ -0,0 +1,133 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/IdAllocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol/EventLoop.h"
+#include "protocol/Task.h"
+
+namespace {
+
+Task<uint16_t> allocateOnLoop(IdAllocator<uint16_t> *allocator, EventLoop *event_loop)
+{
+    co_return co_await allocator->allocateAsync(event_loop);
+}
+
+} // namespace
+
+TEST(IdAllocator, AllocatesEveryIdInRangeOnce)
+{
+    // Not a multiple of the bitmap word size, so that the ids past the capacity are covered too
+    IdAllocator<uint16_t> allocator(100);
+
+    std::set<uint16_t> ids;
+    for (int i = 0; i < 100; i++) {
+        ids.insert(allocator.allocate());
+    }
+
+    EXPECT_EQ(ids.size(), 100u);
+    EXPECT_EQ(*ids.rbegin(), 99);
+}
+
+TEST(IdAllocator, ReusesReleasedId)
+{
+    IdAllocator<uint16_t> allocator(10);
+    for (int i = 0; i < 10; i++) {
+        allocator.allocate();
+    }
+
+    allocator.release(7);
+    EXPECT_EQ(allocator.allocate(), 7);
+}
+
+TEST(IdAllocator, AllocateBlocksUntilRelease)
+{
+    IdAllocator<uint16_t> allocator(1);
+    uint16_t id = allocator.allocate();
+
+    std::thread releaser([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        allocator.release(id);
+    });
+
+    EXPECT_EQ(allocator.allocate(), id);
+    releaser.join();
+}
+
+TEST(IdAllocator, ConcurrentAllocationsAreUnique)
+{
+    constexpr int THREAD_COUNT = 4;
+    constexpr int IDS_PER_THREAD = 200;
+    IdAllocator<uint16_t> allocator(THREAD_COUNT * IDS_PER_THREAD);
+
+    std::vector<std::vector<uint16_t>> ids(THREAD_COUNT);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        threads.emplace_back([&, i] {
+            for (int j = 0; j < IDS_PER_THREAD; j++) {
+                ids[i].push_back(allocator.allocate());
+            }
+        });
+    }
+
+    for (std::thread &run_thread : threads) {
+        run_thread.join();
+    }
+
+    std::set<uint16_t> all_ids;
+    for (const std::vector<uint16_t> &run_ids : ids) {
+        all_ids.insert(run_ids.begin(), run_ids.end());
+    }
+
+    EXPECT_EQ(all_ids.size(), size_t(THREAD_COUNT * IDS_PER_THREAD));
+}
+
+TEST(IdAllocator, AllocateAsyncCompletesWithoutWaitingWhenIdIsFree)
+{
+    EventLoop event_loop;
+    IdAllocator<uint16_t> allocator(2);
+
+    EXPECT_EQ(syncWait(allocateOnLoop(&allocator, &event_loop)), 0);
+    EXPECT_EQ(syncWait(allocateOnLoop(&allocator, &event_loop)), 1);
+}
+
+TEST(IdAllocator, AllocateAsyncIsHandedReleasedId)
+{
+    EventLoop event_loop;
+    IdAllocator<uint16_t> allocator(1);
+    uint16_t id = allocator.allocate();
+
+    std::thread releaser([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        allocator.release(id);
+    });
+
+    EXPECT_EQ(syncWait(allocateOnLoop(&allocator, &event_loop)), id);
+    releaser.join();
+}
@@ -0,0 +1,303 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/PendingRequests.h"
+
+#include <chrono>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol/EventLoop.h"
+#include "protocol/Exceptions.h"
+#include "protocol/Task.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr size_t TAG_COUNT = 4;
+
+// Messages are told apart by the ename of an RError
+ParsedRMessage message(Tag tag, std::string_view ename)
+{
+    return ParsedRMessage(tag, ParsedRError(ename));
+}
+
+std::string enameOf(const ParsedRMessage &message)
+{
+    return std::get<ParsedRError>(message.payload).ename;
+}
+
+Task<std::string> awaitResponse(Response response)
+{
+    ParsedRMessage message = co_await response;
+    co_return enameOf(message);
+}
+
+} // namespace
+
+class PendingRequestsTest : public ::testing::Test
+{
+protected:
+    PendingRequestsTest() : m_tag_allocator(TAG_COUNT), m_pending_requests(&m_event_loop, &m_tag_allocator, 50ms)
+    {}
+
+    // Counts the tags that are not in use, without keeping any of them
+    size_t countFreeTags()
+    {
+        std::vector<Tag> tags;
+        for (;;) {
+            auto awaiter = m_tag_allocator.allocateAsync(&m_event_loop);
+            if (!awaiter.await_ready()) {
+                break;
+            }
+
+            tags.push_back(awaiter.await_resume());
+        }
+
+        for (Tag run_tag : tags) {
+            m_tag_allocator.release(run_tag);
+        }
+
+        return tags.size();
+    }
+
+    EventLoop m_event_loop;
+    IdAllocator<Tag> m_tag_allocator;
+    PendingRequests m_pending_requests;
+};
+
+TEST_F(PendingRequestsTest, CompleteHandsOverMessageAndReleasesTag)
+{
+    Tag tag = m_tag_allocator.allocate();
+    Response response = m_pending_requests.add(tag);
+    EXPECT_EQ(m_pending_requests.count(), 1u);
+    EXPECT_EQ(countFreeTags(), TAG_COUNT - 1);
+
+    EXPECT_TRUE(m_pending_requests.complete(tag, message(tag, "reply")));
+    EXPECT_EQ(enameOf(response.get()), "reply");
+    EXPECT_EQ(m_pending_requests.count(), 0u);
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+
+    // Nothing is pending for the tag any more
+    EXPECT_FALSE(m_pending_requests.complete(tag, message(tag, "again")));
+}
+
+TEST_F(PendingRequestsTest, AwaitingCoroutineIsResumedWithMessage)
+{
+    Tag tag = m_tag_allocator.allocate();
+    Response response = m_pending_requests.add(tag);
+
+    std::thread receiver([&] {
+        std::this_thread::sleep_for(20ms);
+        m_pending_requests.complete(tag, message(tag, "reply"));
+    });
+
+    EXPECT_EQ(syncWait(awaitResponse(response)), "reply");
+    receiver.join();
+}
+
+TEST_F(PendingRequestsTest, SyncWaitCallerIsResumedOnItsOwnThread)
+{
+    Tag tag = m_tag_allocator.allocate();
+    Response response = m_pending_requests.add(tag);
+
+    std::thread receiver([&] {
+        std::this_thread::sleep_for(20ms);
+        m_pending_requests.complete(tag, message(tag, "reply"));
+    });
+
+    auto awaitOnThread = [](Response awaited_response) -> Task<std::thread::id> {
+        co_await awaited_response;
+        co_return std::this_thread::get_id();
+    };
+
+    EXPECT_EQ(syncWait(awaitOnThread(response)), std::this_thread::get_id());
+    receiver.join();
+}
+
+TEST_F(PendingRequestsTest, AwaitingCoroutineOutsideSyncWaitIsResumedOnEventLoop)
+{
+    Tag tag = m_tag_allocator.allocate();
+    Response response = m_pending_requests.add(tag);
+
+    std::promise<bool> resumed_on_loop;
+    startDetached([](Response awaited_response, EventLoop *event_loop, std::promise<bool> *result) -> Task<void> {
+        co_await awaited_response;
+        result->set_value(event_loop->isCurrentThread());
+    }(response, &m_event_loop, &resumed_on_loop));
+
+    m_pending_requests.complete(tag, message(tag, "reply"));
+    EXPECT_TRUE(resumed_on_loop.get_future().get());
+}
+
+TEST_F(PendingRequestsTest, FailFailsOnlyThatRequest)
+{
+    Tag tag = m_tag_allocator.allocate();
+    Tag other_tag = m_tag_allocator.allocate();
+    Response response = m_pending_requests.add(tag);
+    Response other_response = m_pending_requests.add(other_tag);
+
+    EXPECT_TRUE(m_pending_requests.fail(tag, std::make_exception_ptr(BufferOverrun())));
+    EXPECT_THROW(response.get(), BufferOverrun);
+    EXPECT_FALSE(m_pending_requests.fail(tag, std::make_exception_ptr(BufferOverrun())));
+
+    EXPECT_TRUE(m_pending_requests.complete(other_tag, message(other_tag, "reply")));
+    EXPECT_EQ(enameOf(other_response.get()), "reply");
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+}
+
+TEST_F(PendingRequestsTest, RemoveReleasesTagOnlyOnce)
+{
+    Tag tag = m_tag_allocator.allocate();
+    m_pending_requests.add(tag);
+
+    EXPECT_TRUE(m_pending_requests.remove(tag));
+    EXPECT_FALSE(m_pending_requests.remove(tag));
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+}
+
+TEST_F(PendingRequestsTest, FailAllFailsPendingAndLaterRequests)
+{
+    Tag tag = m_tag_allocator.allocate();
+    Response response = m_pending_requests.add(tag);
+
+    m_pending_requests.failAll(std::make_exception_ptr(std::runtime_error("connection lost")));
+    EXPECT_THROW(response.get(), std::runtime_error);
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+
+    Tag later_tag = m_tag_allocator.allocate();
+    Response later_response = m_pending_requests.add(later_tag);
+    EXPECT_THROW(later_response.get(), std::runtime_error);
+    EXPECT_EQ(m_pending_requests.count(), 0u);
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+}
+
+TEST_F(PendingRequestsTest, ExpireFailsOnlyRequestsPastTheirDeadline)
+{
+    Tag tag = m_tag_allocator.allocate();
+    Response response = m_pending_requests.add(tag);
+
+    RequestDetails no_deadline;
+    no_deadline.has_deadline = false;
+    Tag flush_tag = m_tag_allocator.allocate();
+    m_pending_requests.add(flush_tag, no_deadline);
+
+    EXPECT_TRUE(m_pending_requests.expire(std::chrono::steady_clock::now()).empty());
+
+    std::vector<ExpiredRequest> expired = m_pending_requests.expire(std::chrono::steady_clock::now() + 1s);
+    ASSERT_EQ(expired.size(), 1u);
+    EXPECT_EQ(expired[0].tag, tag);
+    EXPECT_THROW(response.get(), RequestTimedOut);
+
+    // Expiring again does not hand out the same request twice
+    EXPECT_TRUE(m_pending_requests.expire(std::chrono::steady_clock::now() + 1s).empty());
+}
+
+TEST_F(PendingRequestsTest, ExpiredTagIsKeptUntilFlushed)
+{
+    RequestDetails details;
+    details.new_fid = 12;
+    details.walk_length = 3;
+    Tag tag = m_tag_allocator.allocate();
+    m_pending_requests.add(tag, details);
+
+    std::vector<ExpiredRequest> expired = m_pending_requests.expire(std::chrono::steady_clock::now() + 1s);
+    ASSERT_EQ(expired.size(), 1u);
+    EXPECT_EQ(expired[0].new_fid, 12u);
+    EXPECT_EQ(expired[0].walk_length, 3u);
+
+    // The server may still be working on the request, so its tag must not be reused before the RFlush
+    EXPECT_EQ(m_pending_requests.count(), 1u);
+    EXPECT_EQ(countFreeTags(), TAG_COUNT - 1);
+
+    EXPECT_TRUE(m_pending_requests.releaseExpired(tag));
+    EXPECT_EQ(m_pending_requests.count(), 0u);
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+    EXPECT_FALSE(m_pending_requests.releaseExpired(tag));
+}
+
+TEST_F(PendingRequestsTest, TagNotFromAllocatorIsNotReleased)
+{
+    // Such as the reserved tag of a TFlush, which lies outside of the range of the allocator
+    RequestDetails details;
+    details.release_tag = false;
+    Tag tag = TAG_COUNT + 1;
+    m_pending_requests.add(tag, details);
+
+    EXPECT_TRUE(m_pending_requests.complete(tag, message(tag, "done")));
+    EXPECT_EQ(m_pending_requests.count(), 0u);
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+}
+
+TEST_F(PendingRequestsTest, LateResponseToExpiredRequestIsReported)
+{
+    Tag tag = m_tag_allocator.allocate();
+    m_pending_requests.add(tag);
+
+    std::vector<ExpiredRequest> expired = m_pending_requests.expire(std::chrono::steady_clock::now() + 1s);
+    ASSERT_EQ(expired.size(), 1u);
+
+    // The response arriving before the RFlush completes the late response, and the tag stays in use until the RFlush
+    EXPECT_TRUE(m_pending_requests.complete(tag, message(tag, "late")));
+    EXPECT_FALSE(m_pending_requests.complete(tag, message(tag, "later")));
+    EXPECT_EQ(enameOf(expired[0].late_response.get()), "late");
+    EXPECT_EQ(countFreeTags(), TAG_COUNT - 1);
+
+    EXPECT_FALSE(m_pending_requests.releaseExpired(tag));
+    EXPECT_EQ(countFreeTags(), TAG_COUNT);
+}
+
+TEST_F(PendingRequestsTest, RequestReceivingDataDoesNotExpire)
+{
+    char buffer[16];
+    RequestDetails details;
+    details.read_destination = ReadDestination{buffer, sizeof(buffer)};
+    Tag tag = m_tag_allocator.allocate();
+    m_pending_requests.add(tag, details);
+
+    EXPECT_FALSE(m_pending_requests.beginReceivingReadData(tag, sizeof(buffer) + 1));
+
+    std::optional<ReadDestination> destination = m_pending_requests.beginReceivingReadData(tag, sizeof(buffer));
+    ASSERT_TRUE(destination);
+    EXPECT_EQ(destination->data, buffer);
+
+    EXPECT_TRUE(m_pending_requests.expire(std::chrono::steady_clock::now() + 1s).empty());
+}
+
+TEST_F(PendingRequestsTest, ExpiredRequestDoesNotReceiveData)
+{
+    char buffer[16];
+    RequestDetails details;
+    details.read_destination = ReadDestination{buffer, sizeof(buffer)};
+    Tag tag = m_tag_allocator.allocate();
+    m_pending_requests.add(tag, details);
+
+    m_pending_requests.expire(std::chrono::steady_clock::now() + 1s);
+    EXPECT_FALSE(m_pending_requests.beginReceivingReadData(tag, 4));
+}
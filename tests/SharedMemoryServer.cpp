@@ -0,0 +1,253 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "SharedMemoryServer.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "protocol/ConstantValues.h"
+
+#include "StandInServer.h"
+
+namespace {
+
+void futexWait(std::atomic<uint32_t> *word, uint32_t expected_value)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected_value, nullptr, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// Same protocol as SharedMemoryTransport::waitUntil(), without polling first
+template <typename Condition>
+void waitUntil(std::atomic<uint32_t> *seq, std::atomic<uint32_t> *waiting, Condition condition)
+{
+    for (;;) {
+        uint32_t seen_seq = seq->load();
+        waiting->store(1);
+
+        if (condition()) {
+            waiting->store(0);
+            return;
+        }
+
+        futexWait(seq, seen_seq);
+        waiting->store(0);
+    }
+}
+
+// Returns true if the other side was waiting
+bool wake(std::atomic<uint32_t> *seq, std::atomic<uint32_t> *waiting)
+{
+    if (!waiting->load()) {
+        return false;
+    }
+
+    seq->fetch_add(1);
+    futexWake(seq);
+    return true;
+}
+
+} // namespace
+
+SharedMemoryServer::SharedMemoryServer(StandInServer *server, uint32_t ring_size,
+                                       std::chrono::microseconds response_delay)
+    : m_server(server), m_ring_size(ring_size), m_response_delay(response_delay)
+{
+    static unsigned mapping_count = 0;
+    m_name = "/9p-stand-in-" + std::to_string(getpid()) + "-" + std::to_string(mapping_count++);
+    shm_unlink(m_name.c_str());
+
+    int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    m_mapping_size = sizeof(SharedMemoryHeader) + 2 * static_cast<size_t>(ring_size);
+
+    void *mapping = MAP_FAILED;
+    if (fd != -1 && ftruncate(fd, static_cast<off_t>(m_mapping_size)) == 0) {
+        mapping = mmap(nullptr, m_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    if (mapping == MAP_FAILED) {
+        shm_unlink(m_name.c_str());
+        throw std::runtime_error(std::string("Could not set up shared memory: ") + strerror(errno));
+    }
+
+    m_header = new (mapping) SharedMemoryHeader();
+    m_header->magic = shared_memory::MAGIC;
+    m_header->version = shared_memory::VERSION;
+    m_header->ring_size = ring_size;
+
+    m_to_server_data = reinterpret_cast<char *>(m_header + 1);
+    m_to_client_data = m_to_server_data + ring_size;
+
+    m_thread = std::thread(&SharedMemoryServer::serve, this);
+}
+
+SharedMemoryServer::~SharedMemoryServer()
+{
+    m_stopping = true;
+
+    SharedMemoryRing &to_server = m_header->to_server;
+    to_server.data_seq.fetch_add(1);
+    futexWake(&to_server.data_seq);
+    SharedMemoryRing &to_client = m_header->to_client;
+    to_client.space_seq.fetch_add(1);
+    futexWake(&to_client.space_seq);
+
+    // A client still attached sees the server go away
+    to_client.closed = 1;
+    to_client.data_seq.fetch_add(1);
+    futexWake(&to_client.data_seq);
+
+    m_thread.join();
+
+    munmap(m_header, m_mapping_size);
+    shm_unlink(m_name.c_str());
+}
+
+const std::string &SharedMemoryServer::getName() const
+{
+    return m_name;
+}
+
+size_t SharedMemoryServer::countClientWakeups() const
+{
+    return m_client_wakeups;
+}
+
+void SharedMemoryServer::serve()
+{
+    unsigned connection = m_server->addConnection();
+
+    std::string received;
+    std::vector<char> chunk(m_ring_size);
+    for (;;) {
+        size_t received_count = receive(chunk.data(), chunk.size());
+        if (received_count == 0) {
+            break;
+        }
+
+        received.append(chunk.data(), received_count);
+
+        std::string responses;
+        size_t consumed = 0;
+        while (received.size() - consumed >= constant::MESSAGE_HEADER_SIZE) {
+            MsgLength length = 0;
+            for (size_t i = 0; i < sizeof(MsgLength); i++) {
+                length |= static_cast<MsgLength>(static_cast<uint8_t>(received[consumed + i])) << (8 * i);
+            }
+
+            if (received.size() - consumed < length) {
+                break;
+            }
+
+            responses += m_server->handleMessage(connection, std::string_view(received).substr(consumed, length));
+            consumed += length;
+        }
+
+        received.erase(0, consumed);
+
+        if (!responses.empty()) {
+            std::this_thread::sleep_for(m_response_delay);
+        }
+
+        if (!send(responses)) {
+            break;
+        }
+    }
+
+    m_server->removeConnection(connection);
+}
+
+// Returns zero once the client has detached or the server is stopping
+size_t SharedMemoryServer::receive(char *buffer, size_t length)
+{
+    SharedMemoryRing &ring = m_header->to_server;
+    uint64_t read_pos = ring.read_pos.load(std::memory_order_relaxed);
+
+    uint64_t available = 0;
+    waitUntil(&ring.data_seq, &ring.consumer_waiting, [&] {
+        available = ring.write_pos.load() - read_pos;
+        return available > 0 || ring.closed || m_stopping;
+    });
+
+    if (available == 0 || m_stopping) {
+        return 0;
+    }
+
+    size_t offset = static_cast<size_t>(read_pos % m_ring_size);
+    size_t count = static_cast<size_t>((std::min<uint64_t>)({available, length, m_ring_size - offset}));
+    memcpy(buffer, m_to_server_data + offset, count);
+
+    ring.read_pos.store(read_pos + count);
+    wake(&ring.space_seq, &ring.producer_waiting);
+
+    return count;
+}
+
+// Returns false if the server is stopping
+bool SharedMemoryServer::send(std::string_view data)
+{
+    SharedMemoryRing &ring = m_header->to_client;
+    uint64_t write_pos = ring.write_pos.load(std::memory_order_relaxed);
+
+    while (!data.empty()) {
+        uint64_t free_space = 0;
+        waitUntil(&ring.space_seq, &ring.producer_waiting, [&] {
+            free_space = m_ring_size - (write_pos - ring.read_pos.load());
+            return free_space > 0 || m_stopping;
+        });
+
+        if (m_stopping) {
+            return false;
+        }
+
+        size_t offset = static_cast<size_t>(write_pos % m_ring_size);
+        size_t count = static_cast<size_t>((std::min<uint64_t>)({free_space, data.size(), m_ring_size - offset}));
+        memcpy(m_to_client_data + offset, data.data(), count);
+        data.remove_prefix(count);
+        write_pos += count;
+
+        ring.write_pos.store(write_pos);
+        if (wake(&ring.data_seq, &ring.consumer_waiting)) {
+            m_client_wakeups++;
+        }
+    }
+
+    return true;
+}
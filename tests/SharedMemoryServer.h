@@ -0,0 +1,70 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "protocol/SharedMemoryLayout.h"
+
+class StandInServer;
+
+// Serves a StandInServer to a client attached through the shared memory transport, setting up the mapping and the
+// server side of the rings (see SharedMemoryLayout.h). Unlike the client, the server side never polls the rings, but
+// sleeps on the futex right away; it may also hold back every batch of responses for response_delay, so that the
+// client has to sleep until it is woken up as well.
+class SharedMemoryServer
+{
+public:
+    SharedMemoryServer(StandInServer *server, uint32_t ring_size,
+                       std::chrono::microseconds response_delay = std::chrono::microseconds(0));
+    ~SharedMemoryServer();
+
+    SharedMemoryServer(const SharedMemoryServer &) = delete;
+    SharedMemoryServer &operator=(const SharedMemoryServer &) = delete;
+
+    const std::string &getName() const;
+
+    // Number of times that the client was found asleep waiting for data, and woken up
+    size_t countClientWakeups() const;
+
+private:
+    void serve();
+    size_t receive(char *buffer, size_t length);
+    bool send(std::string_view data);
+
+    StandInServer *m_server;
+    const uint32_t m_ring_size;
+    const std::chrono::microseconds m_response_delay;
+
+    std::string m_name;
+    SharedMemoryHeader *m_header = nullptr;
+    size_t m_mapping_size = 0;
+    char *m_to_server_data = nullptr;
+    char *m_to_client_data = nullptr;
+
+    std::atomic<bool> m_stopping{false};
+    std::atomic<size_t> m_client_wakeups{0};
+    std::thread m_thread;
+};
@@ -0,0 +1,111 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/SharedMemoryTransport.h"
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol/Client.h"
+
+#include "SharedMemoryServer.h"
+#include "StandInServer.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+ClientConfiguration sharedMemoryConfiguration(const SharedMemoryServer &shared_memory_server)
+{
+    ClientConfiguration config("", "");
+    config.shared_memory_name = shared_memory_server.getName();
+    config.msize = 16 * 1024;
+    config.attribute_cache_ttl_ms = 0;
+    config.block_cache_size = 0;
+    config.read_ahead_max_size = 0;
+    config.write_back_delay_ms = 0;
+
+    return config;
+}
+
+std::string makeData(size_t size)
+{
+    std::string data(size, 0);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>(i * 7 + i / 251);
+    }
+
+    return data;
+}
+
+} // namespace
+
+// Messages several times as large as the rings wrap around them repeatedly, with either side waiting for the other to
+// make room in between
+TEST(SharedMemoryTransport, CarriesMessagesLargerThanRings)
+{
+    StandInServer server;
+    std::string data = makeData(200 * 1024 + 17);
+    server.addFile("file", data);
+    SharedMemoryServer shared_memory_server(&server, 4096);
+
+    Client client(sharedMemoryConfiguration(shared_memory_server));
+
+    std::vector<char> buffer(data.size() + 100);
+    ASSERT_EQ(client.readFile("\\file", 0, buffer.data(), buffer.size()), static_cast<int64_t>(data.size()));
+    EXPECT_EQ(std::string(buffer.data(), data.size()), data);
+
+    OpenedFile *file = client.createFile("\\written", false);
+    ASSERT_TRUE(file);
+    client.writeFile(file, 0, data.data(), data.size());
+    client.closeFile(file);
+    EXPECT_EQ(server.getFileData("written"), data);
+}
+
+TEST(SharedMemoryTransport, SleepingClientIsWokenUpByServer)
+{
+    StandInServer server;
+    server.addFile("file", "data");
+    SharedMemoryServer shared_memory_server(&server, 64 * 1024, 2ms);
+
+    Client client(sharedMemoryConfiguration(shared_memory_server));
+
+    for (int i = 0; i < 5; i++) {
+        std::optional<RStat> stat = client.getFileInformation("\\file");
+        ASSERT_TRUE(stat);
+        EXPECT_EQ(stat->length, 4u);
+    }
+
+    // Responses held back that long are only ever waited for asleep
+    EXPECT_GE(shared_memory_server.countClientWakeups(), 5u);
+}
+
+TEST(SharedMemoryTransport, OnlyOneClientMayAttach)
+{
+    StandInServer server;
+    SharedMemoryServer shared_memory_server(&server, 4096);
+
+    SharedMemoryTransport transport(shared_memory_server.getName());
+    EXPECT_ANY_THROW(SharedMemoryTransport(shared_memory_server.getName()));
+}
@@ -0,0 +1,852 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "StandInServer.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <stdexcept>
+
+#include "protocol/ConstantValues.h"
+#include "protocol/MessageTypes.h"
+
+namespace {
+
+// Open modes of TOpen / TCreate
+constexpr uint8_t OTRUNC = 0x10;
+
+class ServerError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Little-endian encoding of the fields of a message
+class FieldWriter
+{
+public:
+    template <typename T>
+    void put(T value)
+    {
+        for (size_t i = 0; i < sizeof(T); i++) {
+            m_data.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xff));
+        }
+    }
+
+    void putString(std::string_view value)
+    {
+        put<uint16_t>(static_cast<uint16_t>(value.size()));
+        m_data.append(value);
+    }
+
+    void putQid(const Qid &qid)
+    {
+        put<uint8_t>(qid.type);
+        put<uint32_t>(qid.vers);
+        put<uint64_t>(qid.path);
+    }
+
+    void putData(std::string_view data)
+    {
+        m_data.append(data);
+    }
+
+    std::string take()
+    {
+        return std::move(m_data);
+    }
+
+protected:
+    std::string m_data;
+};
+
+class MessageWriter : public FieldWriter
+{
+public:
+    MessageWriter(MsgType type, Tag tag)
+    {
+        put<MsgLength>(0);
+        put<MsgType>(type);
+        put<Tag>(tag);
+    }
+
+    std::string finish()
+    {
+        MsgLength length = static_cast<MsgLength>(m_data.size());
+        for (size_t i = 0; i < sizeof(MsgLength); i++) {
+            m_data[i] = static_cast<char>((length >> (8 * i)) & 0xff);
+        }
+
+        return take();
+    }
+};
+
+std::string errorMessage(Tag tag, std::string_view ename)
+{
+    MessageWriter writer(msg_type::RError, tag);
+    writer.putString(ename);
+    return writer.finish();
+}
+
+} // namespace
+
+// T-message being handled, whose fields are taken off the front in order
+class StandInServer::Request
+{
+public:
+    explicit Request(std::string_view message) : m_remaining(message)
+    {
+        if (message.size() < constant::MESSAGE_HEADER_SIZE) {
+            throw ServerError("message too short");
+        }
+
+        get<MsgLength>();
+        type = get<MsgType>();
+        tag = get<Tag>();
+    }
+
+    template <typename T>
+    T get()
+    {
+        std::string_view bytes = take(sizeof(T));
+
+        uint64_t value = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+        }
+
+        return static_cast<T>(value);
+    }
+
+    std::string getString()
+    {
+        uint16_t length = get<uint16_t>();
+        return std::string(take(length));
+    }
+
+    static MsgLength peekLength(std::string_view message)
+    {
+        return Request(message, 0).get<MsgLength>();
+    }
+
+    std::string_view take(size_t count)
+    {
+        if (m_remaining.size() < count) {
+            throw ServerError("message too short");
+        }
+
+        std::string_view taken = m_remaining.substr(0, count);
+        m_remaining.remove_prefix(count);
+        return taken;
+    }
+
+    MsgType type = 0;
+    Tag tag = 0;
+
+private:
+    Request(std::string_view message, int) : m_remaining(message)
+    {}
+
+    std::string_view m_remaining;
+};
+
+StandInServer::StandInServer(uint32_t max_message_size) : m_max_message_size(max_message_size)
+{
+    m_root = makeNode(nullptr, "", true);
+}
+
+StandInServer::~StandInServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+
+        for (int run_socket : m_listening_sockets) {
+            ::shutdown(run_socket, SHUT_RDWR);
+        }
+
+        for (int run_socket : m_connected_sockets) {
+            ::shutdown(run_socket, SHUT_RDWR);
+        }
+    }
+
+    // No connections are added once the accepting threads are done
+    for (std::thread &run_thread : m_accepting_threads) {
+        run_thread.join();
+    }
+
+    for (std::thread &run_thread : m_serving_threads) {
+        run_thread.join();
+    }
+
+    for (int run_socket : m_listening_sockets) {
+        close(run_socket);
+    }
+
+    for (int run_socket : m_connected_sockets) {
+        close(run_socket);
+    }
+
+    for (const std::string &run_path : m_socket_paths) {
+        unlink(run_path.c_str());
+    }
+}
+
+std::string StandInServer::listenTcp()
+{
+    int listening_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    socklen_t address_length = sizeof(address);
+    if (bind(listening_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listening_socket, SOMAXCONN) != 0 ||
+        getsockname(listening_socket, reinterpret_cast<sockaddr *>(&address), &address_length) != 0) {
+        close(listening_socket);
+        throw std::runtime_error(std::string("Could not listen on TCP socket: ") + strerror(errno));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listening_sockets.push_back(listening_socket);
+    m_accepting_threads.emplace_back(&StandInServer::acceptConnections, this, listening_socket);
+
+    return std::to_string(ntohs(address.sin_port));
+}
+
+std::string StandInServer::listenUnix()
+{
+    static unsigned socket_count = 0;
+    std::string path = "/tmp/9p-stand-in-" + std::to_string(getpid()) + "-" + std::to_string(socket_count++);
+    unlink(path.c_str());
+
+    int listening_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (bind(listening_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listening_socket, SOMAXCONN) != 0) {
+        close(listening_socket);
+        throw std::runtime_error(std::string("Could not listen on AF_UNIX socket: ") + strerror(errno));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listening_sockets.push_back(listening_socket);
+    m_socket_paths.push_back(path);
+    m_accepting_threads.emplace_back(&StandInServer::acceptConnections, this, listening_socket);
+
+    return path;
+}
+
+void StandInServer::addDirectory(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    findOrAddNode(path, true);
+}
+
+void StandInServer::addFile(const std::string &path, std::string data)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Node *node = findOrAddNode(path, false);
+    node->data = std::move(data);
+    touch(node);
+}
+
+void StandInServer::removeFile(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Node *node = const_cast<Node *>(findNode(path));
+    if (!node || !node->parent) {
+        return;
+    }
+
+    Node *parent = node->parent;
+    node->parent = nullptr;
+    parent->children.erase(node->name);
+    touch(parent);
+}
+
+std::optional<std::string> StandInServer::getFileData(const std::string &path) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const Node *node = findNode(path);
+    if (!node || node->is_directory) {
+        return std::nullopt;
+    }
+
+    return node->data;
+}
+
+size_t StandInServer::countRequests(MsgType type) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_request_counts[type];
+}
+
+void StandInServer::setReadDelay(std::chrono::microseconds read_delay)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_read_delay = read_delay;
+}
+
+uint64_t StandInServer::countFileBytesRead() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_file_bytes_read;
+}
+
+size_t StandInServer::countFids() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t fid_count = 0;
+    for (const auto &run_connection : m_connections) {
+        fid_count += run_connection.second.fids.size();
+    }
+
+    return fid_count;
+}
+
+unsigned StandInServer::addConnection()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    unsigned connection = m_next_connection++;
+    m_connections[connection].message_size = m_max_message_size;
+    return connection;
+}
+
+void StandInServer::removeConnection(unsigned connection)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_connections.erase(connection);
+}
+
+// The message must be at least as long as a message header
+std::string StandInServer::handleMessage(unsigned connection, std::string_view message)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    Request request(message);
+    if (request.type == msg_type::TRead && m_read_delay.count() > 0) {
+        // Only the connection of the request waits, the others are served meanwhile
+        std::chrono::microseconds read_delay = m_read_delay;
+        lock.unlock();
+        std::this_thread::sleep_for(read_delay);
+        lock.lock();
+    }
+
+    m_request_counts[request.type]++;
+
+    try {
+        return handle(m_connections.at(connection), request);
+    }
+    catch (const ServerError &e) {
+        return errorMessage(request.tag, e.what());
+    }
+}
+
+std::shared_ptr<StandInServer::Node> StandInServer::makeNode(Node *parent, const std::string &name, bool is_directory)
+{
+    auto node = std::make_shared<Node>();
+    node->name = name;
+    node->is_directory = is_directory;
+    node->path = m_next_path++;
+    node->mtime = static_cast<uint32_t>(time(nullptr));
+    node->parent = parent;
+
+    return node;
+}
+
+StandInServer::Node *StandInServer::findOrAddNode(const std::string &path, bool is_directory)
+{
+    Node *node = m_root.get();
+
+    size_t begin = 0;
+    while (begin < path.size()) {
+        size_t end = (std::min)(path.find('/', begin), path.size());
+        std::string name = path.substr(begin, end - begin);
+        begin = end + 1;
+
+        if (name.empty()) {
+            continue;
+        }
+
+        auto &child = node->children[name];
+        if (!child) {
+            child = makeNode(node, name, end < path.size() || is_directory);
+            touch(node);
+        }
+
+        node = child.get();
+    }
+
+    return node;
+}
+
+const StandInServer::Node *StandInServer::findNode(const std::string &path) const
+{
+    const Node *node = m_root.get();
+
+    size_t begin = 0;
+    while (node && begin < path.size()) {
+        size_t end = (std::min)(path.find('/', begin), path.size());
+        std::string name = path.substr(begin, end - begin);
+        begin = end + 1;
+
+        if (!name.empty()) {
+            auto it = node->children.find(name);
+            node = it == node->children.end() ? nullptr : it->second.get();
+        }
+    }
+
+    return node;
+}
+
+std::shared_ptr<StandInServer::Node> StandInServer::sharedNode(Node *node) const
+{
+    return node->parent ? node->parent->children.at(node->name) : m_root;
+}
+
+// Marks the file as changed, as seen in its qid version and modification time
+void StandInServer::touch(Node *node)
+{
+    node->version++;
+    node->mtime = static_cast<uint32_t>(time(nullptr));
+}
+
+Qid StandInServer::qidOf(const Node &node)
+{
+    return Qid(node.is_directory ? constant::QTDIR : 0, node.version, node.path);
+}
+
+// Stat of the file as found in RStat and in directory listings, i.e. starting with its size
+std::string StandInServer::encodeStat(const Node &node)
+{
+    FieldWriter writer;
+    writer.put<uint16_t>(0);
+    writer.put<uint32_t>(0);
+    writer.putQid(qidOf(node));
+    writer.put<uint32_t>(node.is_directory ? constant::DMDIR | 0755 : 0644);
+    writer.put<uint32_t>(node.mtime);
+    writer.put<uint32_t>(node.mtime);
+    writer.put<uint64_t>(node.is_directory ? 0 : node.data.size());
+    writer.putString(node.name);
+    writer.putString("nobody");
+    writer.putString("nobody");
+    writer.putString("nobody");
+    std::string body = writer.take();
+
+    FieldWriter stat_writer;
+    stat_writer.putString(body);
+    return stat_writer.take();
+}
+
+StandInServer::FidState &StandInServer::getFid(Connection &connection, Fid fid)
+{
+    auto it = connection.fids.find(fid);
+    if (it == connection.fids.end()) {
+        throw ServerError("unknown fid");
+    }
+
+    return it->second;
+}
+
+std::string StandInServer::handle(Connection &connection, Request &request)
+{
+    switch (request.type) {
+    case msg_type::TVersion: {
+        uint32_t message_size = request.get<uint32_t>();
+        connection.message_size = (std::min)(message_size, m_max_message_size);
+        connection.fids.clear();
+
+        MessageWriter writer(msg_type::RVersion, request.tag);
+        writer.put<uint32_t>(connection.message_size);
+        writer.putString("9P2000");
+        return writer.finish();
+    }
+    case msg_type::TAuth:
+        throw ServerError("authentication not required");
+    case msg_type::TAttach: {
+        Fid fid = request.get<Fid>();
+        if (connection.fids.count(fid)) {
+            throw ServerError("fid in use");
+        }
+
+        connection.fids[fid] = FidState{m_root, false};
+
+        MessageWriter writer(msg_type::RAttach, request.tag);
+        writer.putQid(qidOf(*m_root));
+        return writer.finish();
+    }
+    case msg_type::TFlush:
+        // Requests are handled one at a time, so the flushed one has been responded to already
+        return MessageWriter(msg_type::RFlush, request.tag).finish();
+    case msg_type::TWalk:
+        return handleWalk(connection, request);
+    case msg_type::TOpen: {
+        FidState &fid_state = getFid(connection, request.get<Fid>());
+        uint8_t mode = request.get<uint8_t>();
+        if (mode & OTRUNC && !fid_state.node->is_directory) {
+            fid_state.node->data.clear();
+            touch(fid_state.node.get());
+        }
+
+        fid_state.opened = true;
+
+        MessageWriter writer(msg_type::ROpen, request.tag);
+        writer.putQid(qidOf(*fid_state.node));
+        writer.put<uint32_t>(0);
+        return writer.finish();
+    }
+    case msg_type::TCreate:
+        return handleCreate(connection, request);
+    case msg_type::TRead:
+        return handleRead(connection, request);
+    case msg_type::TWrite: {
+        FidState &fid_state = getFid(connection, request.get<Fid>());
+        uint64_t offset = request.get<uint64_t>();
+        uint32_t count = request.get<uint32_t>();
+        std::string_view data = request.take(count);
+
+        Node &node = *fid_state.node;
+        if (!fid_state.opened || node.is_directory) {
+            throw ServerError("fid not open for writing");
+        }
+
+        if (node.data.size() < offset + count) {
+            node.data.resize(offset + count);
+        }
+
+        node.data.replace(offset, count, data);
+        touch(&node);
+
+        MessageWriter writer(msg_type::RWrite, request.tag);
+        writer.put<uint32_t>(count);
+        return writer.finish();
+    }
+    case msg_type::TClunk: {
+        Fid fid = request.get<Fid>();
+        getFid(connection, fid);
+        connection.fids.erase(fid);
+        return MessageWriter(msg_type::RClunk, request.tag).finish();
+    }
+    case msg_type::TRemove: {
+        Fid fid = request.get<Fid>();
+        std::shared_ptr<Node> node = getFid(connection, fid).node;
+
+        // The fid is clunked even if the file cannot be removed
+        connection.fids.erase(fid);
+        if (!node->parent) {
+            throw ServerError("cannot remove root");
+        } else if (!node->children.empty()) {
+            throw ServerError("directory not empty");
+        }
+
+        Node *parent = node->parent;
+        parent->children.erase(node->name);
+        node->parent = nullptr;
+        touch(parent);
+
+        return MessageWriter(msg_type::RRemove, request.tag).finish();
+    }
+    case msg_type::TStat: {
+        std::string stat = encodeStat(*getFid(connection, request.get<Fid>()).node);
+
+        MessageWriter writer(msg_type::RStat, request.tag);
+        writer.put<uint16_t>(static_cast<uint16_t>(stat.size()));
+        writer.putData(stat);
+        return writer.finish();
+    }
+    case msg_type::TWStat:
+        return handleWstat(connection, request);
+    default:
+        throw ServerError("unsupported request");
+    }
+}
+
+std::string StandInServer::handleWalk(Connection &connection, Request &request)
+{
+    Fid fid = request.get<Fid>();
+    Fid new_fid = request.get<Fid>();
+    uint16_t name_count = request.get<uint16_t>();
+    if (name_count > constant::MAXWELEM) {
+        throw ServerError("too many path components");
+    }
+
+    std::vector<std::string> names;
+    for (uint16_t i = 0; i < name_count; i++) {
+        names.push_back(request.getString());
+    }
+
+    std::shared_ptr<Node> node = getFid(connection, fid).node;
+    if (new_fid != fid && connection.fids.count(new_fid)) {
+        throw ServerError("fid in use");
+    }
+
+    std::vector<Qid> qids;
+    for (const std::string &run_name : names) {
+        std::shared_ptr<Node> next;
+        if (run_name == "..") {
+            next = node->parent ? sharedNode(node->parent) : node;
+        } else if (node->is_directory) {
+            auto it = node->children.find(run_name);
+            if (it != node->children.end()) {
+                next = it->second;
+            }
+        }
+
+        if (!next) {
+            break;
+        }
+
+        node = next;
+        qids.push_back(qidOf(*node));
+    }
+
+    if (name_count && qids.empty()) {
+        throw ServerError("file not found");
+    }
+
+    // The new fid is only associated with the file if all of the path has been walked
+    if (qids.size() == name_count) {
+        connection.fids[new_fid] = FidState{node, false};
+    }
+
+    MessageWriter writer(msg_type::RWalk, request.tag);
+    writer.put<uint16_t>(static_cast<uint16_t>(qids.size()));
+    for (const Qid &run_qid : qids) {
+        writer.putQid(run_qid);
+    }
+
+    return writer.finish();
+}
+
+std::string StandInServer::handleCreate(Connection &connection, Request &request)
+{
+    FidState &fid_state = getFid(connection, request.get<Fid>());
+    std::string name = request.getString();
+    uint32_t permissions = request.get<uint32_t>();
+    uint8_t mode = request.get<uint8_t>();
+    (void)mode;
+
+    Node &parent = *fid_state.node;
+    if (!parent.is_directory) {
+        throw ServerError("not a directory");
+    } else if (parent.children.count(name)) {
+        throw ServerError("file exists");
+    }
+
+    std::shared_ptr<Node> node = makeNode(&parent, name, permissions & constant::DMDIR);
+    parent.children[name] = node;
+    touch(&parent);
+
+    // The fid now stands for the new file, opened
+    fid_state = FidState{node, true};
+
+    MessageWriter writer(msg_type::RCreate, request.tag);
+    writer.putQid(qidOf(*node));
+    writer.put<uint32_t>(0);
+    return writer.finish();
+}
+
+std::string StandInServer::handleRead(Connection &connection, Request &request)
+{
+    FidState &fid_state = getFid(connection, request.get<Fid>());
+    uint64_t offset = request.get<uint64_t>();
+    uint32_t count = request.get<uint32_t>();
+    if (!fid_state.opened) {
+        throw ServerError("fid not open");
+    }
+
+    count = (std::min)(count, connection.message_size - static_cast<uint32_t>(constant::RREAD_HEADER_SIZE));
+
+    const Node &node = *fid_state.node;
+    std::string data;
+    if (node.is_directory) {
+        // Directories are read in whole entries, at offsets that are the sums of the sizes of the preceding ones
+        uint64_t entry_offset = 0;
+        for (const auto &run_child : node.children) {
+            std::string stat = encodeStat(*run_child.second);
+            if (entry_offset >= offset) {
+                if (data.size() + stat.size() > count) {
+                    break;
+                }
+
+                data += stat;
+            }
+
+            entry_offset += stat.size();
+        }
+    } else if (offset < node.data.size()) {
+        data = node.data.substr(offset, count);
+        m_file_bytes_read += data.size();
+    }
+
+    MessageWriter writer(msg_type::RRead, request.tag);
+    writer.put<uint32_t>(static_cast<uint32_t>(data.size()));
+    writer.putData(data);
+    return writer.finish();
+}
+
+// Supports changing the length and the name of a file, leaving alone all the fields set to their "don't touch" value
+std::string StandInServer::handleWstat(Connection &connection, Request &request)
+{
+    Node &node = *getFid(connection, request.get<Fid>()).node;
+
+    request.get<uint16_t>();
+    request.get<uint16_t>();
+    request.get<uint16_t>();
+    request.get<uint32_t>();
+    request.take(13);
+    request.get<uint32_t>();
+    request.get<uint32_t>();
+    request.get<uint32_t>();
+    uint64_t length = request.get<uint64_t>();
+    std::string name = request.getString();
+
+    if (length != (std::numeric_limits<uint64_t>::max)()) {
+        if (node.is_directory) {
+            throw ServerError("cannot change length of directory");
+        }
+
+        node.data.resize(length);
+        touch(&node);
+    }
+
+    if (!name.empty() && name != node.name) {
+        Node *parent = node.parent;
+        if (!parent) {
+            throw ServerError("cannot rename root");
+        } else if (parent->children.count(name)) {
+            throw ServerError("file exists");
+        }
+
+        std::shared_ptr<Node> renamed = parent->children[node.name];
+        parent->children.erase(node.name);
+        renamed->name = name;
+        parent->children[name] = renamed;
+        touch(parent);
+    }
+
+    return MessageWriter(msg_type::RWStat, request.tag).finish();
+}
+
+void StandInServer::acceptConnections(int listening_socket)
+{
+    for (;;) {
+        int connected_socket = accept(listening_socket, nullptr, nullptr);
+        if (connected_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return;
+        }
+
+        int enabled = 1;
+        setsockopt(connected_socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) {
+            close(connected_socket);
+            return;
+        }
+
+        m_connected_sockets.push_back(connected_socket);
+        m_serving_threads.emplace_back(&StandInServer::serveConnection, this, connected_socket);
+    }
+}
+
+void StandInServer::serveConnection(int connected_socket)
+{
+    unsigned connection = addConnection();
+
+    std::string received;
+    std::vector<char> chunk(64 * 1024);
+    for (;;) {
+        ssize_t received_count = recv(connected_socket, chunk.data(), chunk.size(), 0);
+        if (received_count <= 0) {
+            break;
+        }
+
+        received.append(chunk.data(), received_count);
+
+        // Responses to all the complete messages received are sent back together
+        std::string responses;
+        size_t consumed = 0;
+        while (received.size() - consumed >= sizeof(MsgLength)) {
+            MsgLength length = Request::peekLength(std::string_view(received).substr(consumed));
+            if (length < constant::MESSAGE_HEADER_SIZE) {
+                closeConnection(connection, connected_socket);
+                return;
+            } else if (received.size() - consumed < length) {
+                break;
+            }
+
+            responses += handleMessage(connection, std::string_view(received).substr(consumed, length));
+            consumed += length;
+        }
+
+        received.erase(0, consumed);
+
+        for (size_t sent_count = 0; sent_count < responses.size();) {
+            ssize_t sent = send(connected_socket, responses.data() + sent_count, responses.size() - sent_count,
+                                MSG_NOSIGNAL);
+            if (sent <= 0) {
+                closeConnection(connection, connected_socket);
+                return;
+            }
+
+            sent_count += sent;
+        }
+    }
+
+    closeConnection(connection, connected_socket);
+}
+
+void StandInServer::closeConnection(unsigned connection, int connected_socket)
+{
+    removeConnection(connection);
+
+    // Sockets still open when the server is stopped are closed by the destructor
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_stopping) {
+        m_connected_sockets.erase(std::find(m_connected_sockets.begin(), m_connected_sockets.end(), connected_socket));
+        close(connected_socket);
+    }
+}
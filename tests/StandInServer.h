@@ -0,0 +1,146 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol/DataTypes.h"
+
+// In-memory 9P2000 file server that tests and benchmarks run the client against. It listens on the loopback
+// interface and / or on AF_UNIX sockets, serving each connection on a thread of its own, where requests are handled
+// one at a time in the order in which they arrive. Other transports can feed it through handleMessage().
+class StandInServer
+{
+public:
+    explicit StandInServer(uint32_t max_message_size = 1024 * 1024);
+    ~StandInServer();
+
+    StandInServer(const StandInServer &) = delete;
+    StandInServer &operator=(const StandInServer &) = delete;
+
+    // Returns the port / socket path on which the server accepts connections from then on
+    std::string listenTcp();
+    std::string listenUnix();
+
+    // Paths are relative to the root, with their components separated by slashes. Missing parent directories are
+    // created along the way.
+    void addDirectory(const std::string &path);
+    void addFile(const std::string &path, std::string data);
+
+    // Removes the file as another client would, leaving the fids walked to it leading to the removed file
+    void removeFile(const std::string &path);
+    std::optional<std::string> getFileData(const std::string &path) const;
+
+    size_t countRequests(MsgType type) const;
+
+    // Holds back each TRead for read_delay before handling it, so that the client finds its reads still in flight
+    void setReadDelay(std::chrono::microseconds read_delay);
+
+    // Bytes of file data (not directory entries) sent in RRead messages, over all connections
+    uint64_t countFileBytesRead() const;
+
+    // Number of fids currently associated with a file, over all connections
+    size_t countFids() const;
+
+    // Connection over a transport of the caller's own, with handleMessage() returning the R-message to send back for
+    // each T-message received
+    unsigned addConnection();
+    void removeConnection(unsigned connection);
+    std::string handleMessage(unsigned connection, std::string_view message);
+
+private:
+    struct Node
+    {
+        std::string name;
+        bool is_directory = false;
+        std::string data;
+        uint32_t version = 0;
+        uint64_t path = 0;
+        uint32_t mtime = 0;
+        Node *parent = nullptr;
+        std::map<std::string, std::shared_ptr<Node>> children;
+    };
+
+    struct FidState
+    {
+        std::shared_ptr<Node> node;
+        bool opened = false;
+    };
+
+    struct Connection
+    {
+        uint32_t message_size = 0;
+        std::unordered_map<Fid, FidState> fids;
+    };
+
+    class Request;
+
+    static Qid qidOf(const Node &node);
+    static std::string encodeStat(const Node &node);
+
+    std::shared_ptr<Node> makeNode(Node *parent, const std::string &name, bool is_directory);
+    Node *findOrAddNode(const std::string &path, bool is_directory);
+    const Node *findNode(const std::string &path) const;
+    std::shared_ptr<Node> sharedNode(Node *node) const;
+    void touch(Node *node);
+
+    FidState &getFid(Connection &connection, Fid fid);
+
+    std::string handle(Connection &connection, Request &request);
+    std::string handleWalk(Connection &connection, Request &request);
+    std::string handleCreate(Connection &connection, Request &request);
+    std::string handleRead(Connection &connection, Request &request);
+    std::string handleWstat(Connection &connection, Request &request);
+
+    void acceptConnections(int listening_socket);
+    void serveConnection(int connected_socket);
+    void closeConnection(unsigned connection, int connected_socket);
+
+    const uint32_t m_max_message_size;
+
+    mutable std::mutex m_mutex;
+    std::shared_ptr<Node> m_root;
+    uint64_t m_next_path = 1;
+    std::array<size_t, 256> m_request_counts{};
+    uint64_t m_file_bytes_read = 0;
+    std::chrono::microseconds m_read_delay{0};
+    std::unordered_map<unsigned, Connection> m_connections;
+    unsigned m_next_connection = 0;
+
+    bool m_stopping = false;
+    std::vector<int> m_listening_sockets;
+    std::vector<int> m_connected_sockets;
+    std::vector<std::string> m_socket_paths;
+    std::vector<std::thread> m_accepting_threads;
+    std::vector<std::thread> m_serving_threads;
+};
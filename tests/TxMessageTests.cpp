@@ -0,0 +1,118 @@
+/*
+ * This file is part of 9p-dokany <https://github.com/gedimitr/9p-dokany>.
+ *
+ * 9p-dokany is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 9p-dokany is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 9p-dokany. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2020-2021 Gerasimos Dimitriadis
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "protocol/TxMessage.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+constexpr MsgType TEST_MSG_TYPE = 118;
+
+uint32_t readMessageSize(std::string_view data)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data.data());
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+} // namespace
+
+TEST(TxMessage, WritesLittleEndianFieldsAfterSize)
+{
+    TxMessage message(64);
+    message.initialize(TEST_MSG_TYPE);
+    message.writeInteger<uint16_t>(0x1234);
+    message.writeInteger<uint32_t>(0x89abcdef);
+    message.writeString("ab");
+
+    std::string_view data = message.getData();
+    const std::string expected("\x0f\x00\x00\x00\x76\x34\x12\xef\xcd\xab\x89\x02\x00" "ab", 15);
+    EXPECT_EQ(data, expected);
+}
+
+TEST(TxMessage, HasRoomForUpToCapacity)
+{
+    TxMessage message(16);
+    message.initialize(TEST_MSG_TYPE);
+
+    // The size and type fields take up 5 bytes
+    EXPECT_TRUE(message.hasRoomFor(11));
+    EXPECT_FALSE(message.hasRoomFor(12));
+
+    message.writeInteger<uint64_t>(1);
+    EXPECT_TRUE(message.hasRoomFor(3));
+    EXPECT_FALSE(message.hasRoomFor(4));
+}
+
+TEST(TxMessage, DataNotFittingIsNotWritten)
+{
+    TxMessage message(16);
+    message.initialize(TEST_MSG_TYPE);
+
+    message.writeString("this does not fit");
+    message.writeRawData("nor this either");
+    EXPECT_EQ(message.getData().size(), 5u);
+
+    message.writeString("fits");
+    EXPECT_EQ(message.getData().size(), 11u);
+}
+
+TEST(TxMessage, TrailingDataCountsTowardsSizeButIsNotCopied)
+{
+    TxMessage message(32);
+    message.initialize(TEST_MSG_TYPE);
+    message.writeInteger<uint32_t>(7);
+
+    const std::string payload = "payload";
+    message.setTrailingData(payload);
+    EXPECT_EQ(message.getTrailingData().data(), payload.data());
+
+    std::string_view data = message.getData();
+    EXPECT_EQ(data.size(), 9u);
+    EXPECT_EQ(readMessageSize(data), 9u + payload.size());
+}
+
+TEST(TxMessage, TrailingDataTakesRoom)
+{
+    TxMessage message(32);
+    message.initialize(TEST_MSG_TYPE);
+    EXPECT_TRUE(message.hasRoomFor(27));
+
+    message.setTrailingData(std::string_view("0123456789"));
+    EXPECT_TRUE(message.hasRoomFor(17));
+    EXPECT_FALSE(message.hasRoomFor(18));
+}
+
+TEST(TxMessage, InitializeDropsTrailingData)
+{
+    TxMessage message(32);
+    message.initialize(TEST_MSG_TYPE);
+    message.setTrailingData(std::string_view("0123456789"));
+
+    message.initialize(TEST_MSG_TYPE);
+    EXPECT_TRUE(message.getTrailingData().empty());
+    EXPECT_EQ(readMessageSize(message.getData()), 5u);
+    EXPECT_TRUE(message.hasRoomFor(27));
+}
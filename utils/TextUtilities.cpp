@@ -20,6 +20,10 @@
  */
 #include "TextUtilities.h"
 
+#include <algorithm>
+
+#ifdef _WIN32
+
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
@@ -50,11 +54,109 @@ std::string convertWstringToUtf8(const std::wstring_view &wstr)
     return str;
 }
 
+#else
+
+namespace {
+
+constexpr char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+bool isContinuationByte(unsigned char c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+} // namespace
+
+// wchar_t holds UTF-32 on the POSIX systems. Malformed sequences are replaced by U+FFFD, as MultiByteToWideChar does
+std::wstring convertUtf8ToWstring(const std::string_view &str)
+{
+    std::wstring wstr;
+    wstr.reserve(str.size());
+
+    size_t pos = 0;
+    while (pos < str.size()) {
+        unsigned char lead = static_cast<unsigned char>(str[pos]);
+
+        size_t length;
+        char32_t code_point;
+        char32_t min_code_point;
+        if (lead < 0x80) {
+            length = 1;
+            code_point = lead;
+            min_code_point = 0;
+        } else if ((lead & 0xE0) == 0xC0) {
+            length = 2;
+            code_point = lead & 0x1F;
+            min_code_point = 0x80;
+        } else if ((lead & 0xF0) == 0xE0) {
+            length = 3;
+            code_point = lead & 0x0F;
+            min_code_point = 0x800;
+        } else if ((lead & 0xF8) == 0xF0) {
+            length = 4;
+            code_point = lead & 0x07;
+            min_code_point = 0x10000;
+        } else {
+            wstr.push_back(static_cast<wchar_t>(REPLACEMENT_CHARACTER));
+            pos++;
+            continue;
+        }
+
+        size_t run_length = 1;
+        while (run_length < length && pos + run_length < str.size() &&
+               isContinuationByte(static_cast<unsigned char>(str[pos + run_length]))) {
+            code_point = (code_point << 6) | (static_cast<unsigned char>(str[pos + run_length]) & 0x3F);
+            run_length++;
+        }
+
+        bool is_valid = run_length == length && code_point >= min_code_point && code_point <= 0x10FFFF &&
+                        (code_point < 0xD800 || code_point > 0xDFFF);
+        wstr.push_back(static_cast<wchar_t>(is_valid ? code_point : REPLACEMENT_CHARACTER));
+        pos += run_length;
+    }
+
+    return wstr;
+}
+
+std::string convertWstringToUtf8(const std::wstring_view &wstr)
+{
+    std::string str;
+    str.reserve(wstr.size());
+
+    for (wchar_t run_char : wstr) {
+        char32_t code_point = static_cast<char32_t>(run_char);
+        if (code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+            code_point = REPLACEMENT_CHARACTER;
+        }
+
+        if (code_point < 0x80) {
+            str.push_back(static_cast<char>(code_point));
+        } else if (code_point < 0x800) {
+            str.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+            str.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else if (code_point < 0x10000) {
+            str.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+            str.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else {
+            str.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+            str.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        }
+    }
+
+    return str;
+}
+
+#endif
+
 void copyUtf8StringToWcharArr(const std::string_view &str, wchar_t *warr, size_t warr_size)
 {
     std::wstring wname = convertUtf8ToWstring(str);
-    wcsncpy_s(warr, warr_size, wname.c_str(), warr_size - 1);
-    warr[warr_size - 1] = L'\0';
+    size_t count = (std::min)(wname.size(), warr_size - 1);
+    std::copy_n(wname.begin(), count, warr);
+    warr[count] = L'\0';
 }
 
 std::vector<std::string> splitToPathComponents(const std::string &str)
@@ -21,6 +21,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 std::wstring convertUtf8ToWstring(const std::string_view &str);